@@ -0,0 +1,168 @@
+#include "corpus.h"
+#include "batch.h"
+#include "batch_io.h"
+#include "md_to_html.h"
+#include "compress.h"
+#include "replacements.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+static
+bool write_file(const char* const path,  const std::string& contents){
+	// Synced, so that its pages are clean, and can be dropped from the page cache
+	const int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (unlikely(fd == -1))
+		return false;
+	std::size_t n_written = 0;
+	while(n_written < contents.size()){
+		const ssize_t n = write(fd, contents.data() + n_written, contents.size() - n_written);
+		if (unlikely(n <= 0))
+			break;
+		n_written += n;
+	}
+	const bool is_ok = (n_written == contents.size()) and (fdatasync(fd) == 0);
+	close(fd);
+	return is_ok;
+}
+
+static
+void drop_from_page_cache(const char* const path){
+	const int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+
+int main(int argc,  const char* const* argv){
+	unsigned n_docs = 2000;
+	std::size_t doc_sz = 8;
+	unsigned n_runs = 3;
+	const char* parent_dirpath = ".";
+	bool any_errors = false;
+	++argv;
+	--argc;
+	while((argc != 0) and (argv[0][0] == '-') and (argv[0][1] != 0) and (argv[0][2] == 0)){
+		switch(argv[0][1]){
+			case 'n':
+				n_docs = strtoul(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 's':
+				doc_sz = strtoul(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 'r':
+				n_runs = strtoul(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 'd':
+				parent_dirpath = *(++argv);
+				--argc;
+				break;
+			default:
+				any_errors = true;
+				break;
+		}
+		++argv;
+		--argc;
+	}
+	if (unlikely(any_errors or (argc != 0) or (n_docs == 0) or (n_runs == 0))){
+		fprintf(stderr,
+			"USAGE: [[OPTIONS]]\n"
+			"	Writes generated documents, converts them all in batch mode with each I/O backend - with the inputs in the page cache, and then dropped from it - and reports the time each takes\n"
+			"	Cold runs need a disk-backed directory: the page cache of a tmpfs cannot be dropped\n"
+			"OPTIONS:\n"
+			"	-n [N]\n"
+			"		Documents (default 2000)\n"
+			"	-s [KiB]\n"
+			"		Size of each document (default 8)\n"
+			"	-r [N]\n"
+			"		Report the fastest of N runs of each (default 3)\n"
+			"	-d [/path/to/directory]\n"
+			"		Where the documents are written (default .)\n"
+		);
+		return 1;
+	}
+
+	const std::string dirpath_template = std::string(parent_dirpath) + "/md_to_html_batch_io_bench.XXXXXX";
+	std::vector<char> dirpath(dirpath_template.begin(), dirpath_template.end());
+	dirpath.push_back(0);
+	if (unlikely(mkdtemp(dirpath.data()) == nullptr)){
+		fprintf(stderr, "ERROR: Cannot create a directory in %s\n", parent_dirpath);
+		return 1;
+	}
+	// Every construct but replacements, which needs the snippets of md_to_html_bench
+	std::vector<const CorpusConstruct*> constructs;
+	for (std::size_t i = 0;  i < n_corpus_constructs;  ++i)
+		if (strcmp(corpus_constructs[i].name, "replacements") != 0)
+			constructs.push_back(&corpus_constructs[i]);
+	std::vector<std::string> input_paths;
+	std::vector<std::string> output_paths;
+	std::size_t total_sz = 0;
+	for (unsigned i = 0;  i < n_docs;  ++i){
+		const std::string doc = generate_corpus(*constructs[i % constructs.size()], doc_sz*1024, i+1);
+		input_paths.push_back(std::string(dirpath.data()) + "/" + std::to_string(i) + ".rmd");
+		output_paths.push_back(std::string(dirpath.data()) + "/" + std::to_string(i) + ".html");
+		total_sz += doc.size();
+		if (unlikely(not write_file(input_paths.back().c_str(), doc))){
+			fprintf(stderr, "ERROR: Cannot write %s\n", input_paths.back().c_str());
+			any_errors = true;
+			break;
+		}
+	}
+
+	ReplacementTable replacements;
+	ConversionOptions options;
+	options.replacements = &replacements;
+	const CompressionOptions compression_options;
+	{
+		BatchIo::Ring ring;
+		if (not ring.init(BATCH_IO_URING_DEPTH))
+			printf("io_uring is unavailable: uring falls back to threads\n");
+	}
+	printf("%u documents, %.1f MiB\n", n_docs, total_sz/(1024.0*1024.0));
+	printf("%-8s %-5s %10s %10s\n", "backend", "cache", "ms", "docs/s");
+	constexpr BatchIoBackend backends[] = {batch_io_sync, batch_io_threads, batch_io_uring};
+	constexpr const char* backend_names[] = {"sync", "threads", "uring"};
+	for (unsigned is_cold = 0;  (is_cold < 2) and not any_errors;  ++is_cold){
+		for (unsigned b = 0;  (b < 3) and not any_errors;  ++b){
+			double t = 1e9;
+			for (unsigned run = 0;  run < n_runs;  ++run){
+				std::vector<BatchJob> jobs;
+				for (unsigned i = 0;  i < n_docs;  ++i){
+					unlink(output_paths[i].c_str());
+					if (is_cold)
+						drop_from_page_cache(input_paths[i].c_str());
+					jobs.push_back({input_paths[i].c_str(), output_paths[i].c_str(), 0});
+				}
+				const auto started_at = std::chrono::steady_clock::now();
+				if (unlikely(not convert_batch(options, compression_options, backends[b], jobs))){
+					any_errors = true;
+					break;
+				}
+				t = std::min(t, std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count());
+			}
+			printf("%-8s %-5s %10.1f %10.0f\n", backend_names[b], is_cold ? "cold" : "warm", t*1e3, n_docs/t);
+			fflush(stdout);
+		}
+	}
+
+	for (unsigned i = 0;  i < input_paths.size();  ++i){
+		unlink(input_paths[i].c_str());
+		unlink(output_paths[i].c_str());
+	}
+	rmdir(dirpath.data());
+	return any_errors;
+}
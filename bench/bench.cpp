@@ -0,0 +1,234 @@
+#include "corpus.h"
+#include "md_to_html.h"
+#include "input.h"
+#include "output.h"
+#include "replacements.h"
+#include "inline_functions.h"
+
+#include <compsky/macros/likely.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+
+static
+bool write_all(const int fd,  const std::string& contents){
+	std::size_t n_written = 0;
+	while(n_written < contents.size()){
+		const ssize_t n = write(fd, contents.data() + n_written, contents.size() - n_written);
+		if (unlikely(n <= 0))
+			break;
+		n_written += n;
+	}
+	return (n_written == contents.size());
+}
+
+static
+bool write_file(const char* const path,  const std::string& contents){
+	const int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (unlikely(fd == -1))
+		return false;
+	const bool is_ok = write_all(fd, contents);
+	close(fd);
+	return is_ok;
+}
+
+static
+bool make_snippets(const char* const dirpath,  ReplacementTable& replacements){
+	// The -R directory for the replacements corpus
+	for (unsigned i = 0;  i < CORPUS_N_SNIPPETS;  ++i){
+		const std::string path = std::string(dirpath) + "/R_E_P_L_A_C_E_snippet" + std::to_string(i);
+		if (unlikely(not write_file(path.c_str(), "<span class=\"snippet\">snippet " + std::to_string(i) + "</span>")))
+			return false;
+	}
+	return read_replacement_dir(dirpath, replacements.filenames);
+}
+
+static
+double time_conversion(const ConversionOptions& options,  const char* const input_path,  HtmlOutput& html_output,  const unsigned n_repeats){
+	// Returns the fastest of n_repeats conversions, in seconds
+	// The converter's warnings, such as those listing the display rules in <style> elements, are discarded
+	const int stderr_fd = dup(2);
+	const int null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, 2);
+	double best = 1e9;
+	for (unsigned i = 0;  i < n_repeats;  ++i){
+		ftruncate(html_output.fd, 0);
+		lseek(html_output.fd, 0, SEEK_SET);
+		const auto started_at = std::chrono::steady_clock::now();
+		MarkdownInput markdown_input(input_path, false);
+		md_to_html(options, markdown_input, html_output);
+		const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+		if (t < best)
+			best = t;
+	}
+	dup2(stderr_fd, 2);
+	close(stderr_fd);
+	close(null_fd);
+	return best;
+}
+
+
+int main(int argc,  const char* const* argv){
+	std::size_t corpus_sz = 1024*1024*16;
+	unsigned n_repeats = 5;
+	uint64_t seed = 1;
+	bool is_generating = false;
+	bool is_copying_all = false;
+	bool is_via_tree = false;
+	unsigned minify_level = 0;
+	bool is_memoising = true;
+	bool any_errors = false;
+	++argv;
+	--argc;
+	while((argc != 0) and (argv[0][0] == '-') and (argv[0][1] != 0) and (argv[0][2] == 0)){
+		switch(argv[0][1]){
+			case 's':
+				corpus_sz = 1024*1024*strtoul(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 'n':
+				n_repeats = strtoul(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 'S':
+				seed = strtoull(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 'g':
+				is_generating = true;
+				break;
+			case 'G':
+				is_copying_all = true;
+				break;
+			case 'T':
+				is_via_tree = true;
+				break;
+			case 'm':
+				minify_level = strtoul(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 'F':
+				is_memoising = false;
+				break;
+			default:
+				any_errors = true;
+				break;
+		}
+		++argv;
+		--argc;
+	}
+	std::vector<const CorpusConstruct*> constructs;
+	for (int i = 0;  i < argc;  ++i){
+		const CorpusConstruct* const construct = find_corpus_construct(argv[i]);
+		if (unlikely(construct == nullptr)){
+			fprintf(stderr, "ERROR: No such construct: %s\n", argv[i]);
+			any_errors = true;
+		}
+		constructs.push_back(construct);
+	}
+	if (constructs.empty())
+		for (std::size_t i = 0;  i < n_corpus_constructs;  ++i)
+			constructs.push_back(&corpus_constructs[i]);
+	if (unlikely(any_errors or (n_repeats == 0) or (is_generating and (constructs.size() != 1)))){
+		fprintf(stderr,
+			"USAGE: [[OPTIONS]] [[CONSTRUCTS]]\n"
+			"	Converts a generated document for each construct, and reports the throughput of each\n"
+			"	By default, every construct:"
+		);
+		for (std::size_t i = 0;  i < n_corpus_constructs;  ++i)
+			fprintf(stderr, " %s", corpus_constructs[i].name);
+		fprintf(stderr,
+			"\n"
+			"OPTIONS:\n"
+			"	-s [MiB]\n"
+			"		Size of each document (default 16)\n"
+			"	-n [N]\n"
+			"		Time the fastest of N conversions (default 5)\n"
+			"	-S [SEED]\n"
+			"		Seed of the generator (default 1)\n"
+			"	-g\n"
+			"		Write the document of the single construct given to stdout instead, e.g. to compare with other converters\n"
+			"	-G\n"
+			"		Copy all of the output into the output buffer, rather than writing large spans of the input from where they are - to measure what that saves\n"
+			"	-T\n"
+			"		Render the output from a document tree of it, as the transforms do - to measure what that costs\n"
+			"	-m [LEVEL]\n"
+			"		Minify the output, as md_to_html -m does - to measure what that costs, and how much smaller the output is\n"
+			"	-F\n"
+			"		Compute every inline function call, rather than memoising their results - to measure what that saves\n"
+		);
+		return 1;
+	}
+	if (is_generating){
+		const std::string doc = generate_corpus(*constructs[0], corpus_sz, seed);
+		return not write_all(1, doc);
+	}
+
+	char tmp_dirpath[] = "/tmp/md_to_html_bench.XXXXXX";
+	if (unlikely(mkdtemp(tmp_dirpath) == nullptr)){
+		fprintf(stderr, "ERROR: Cannot create a temporary directory\n");
+		return 1;
+	}
+	const std::string snippets_dirpath = std::string(tmp_dirpath) + "/R";
+	mkdir(snippets_dirpath.c_str(), 0755);
+	ReplacementTable replacements;
+	if (unlikely(not make_snippets(snippets_dirpath.c_str(), replacements))){
+		fprintf(stderr, "ERROR: Cannot write the snippets to %s\n", snippets_dirpath.c_str());
+		return 1;
+	}
+	replacements.trie.build(replacements.filenames);
+	ConversionOptions options;
+	options.replacements = &replacements;
+	options.is_via_tree = is_via_tree;
+	options.minify_level = minify_level;
+	InlineFunctionCache inline_function_cache;
+	if (is_memoising)
+		options.inline_function_cache = &inline_function_cache;
+	const std::string input_path = std::string(tmp_dirpath) + "/corpus.rmd";
+	const std::string output_path = std::string(tmp_dirpath) + "/corpus.html";
+
+	printf("%-14s %10s %10s %10s %9s\n", "construct", "in MiB", "out MiB", "MiB/s", "ns/byte");
+	for (const CorpusConstruct* const construct : constructs){
+		const std::string doc = generate_corpus(*construct, corpus_sz, seed);
+		if (unlikely(not write_file(input_path.c_str(), doc))){
+			fprintf(stderr, "ERROR: Cannot write %s\n", input_path.c_str());
+			any_errors = true;
+			break;
+		}
+		// Written to a file, not /dev/null, so that the cost of writing the output is included
+		const int out_fd = open(output_path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		HtmlOutput html_output(out_fd);
+		if (unlikely((out_fd == -1) or html_output.is_null())){
+			fprintf(stderr, "ERROR: Cannot write %s\n", output_path.c_str());
+			any_errors = true;
+			break;
+		}
+		if (is_copying_all)
+			html_output.span_min_sz = SIZE_MAX;
+		const double t = time_conversion(options, input_path.c_str(), html_output, n_repeats);
+		const off_t output_sz = lseek(out_fd, 0, SEEK_END);
+		close(out_fd);
+		constexpr double MiB = 1024*1024;
+		printf("%-14s %10.1f %10.1f %10.1f %9.3f\n", construct->name, doc.size()/MiB, output_sz/MiB, doc.size()/MiB/t, t*1e9/doc.size());
+		fflush(stdout);
+	}
+
+	for (const Filename& filename : replacements.filenames)
+		filename.deconstruct(false);
+	for (unsigned i = 0;  i < CORPUS_N_SNIPPETS;  ++i)
+		unlink((snippets_dirpath + "/R_E_P_L_A_C_E_snippet" + std::to_string(i)).c_str());
+	rmdir(snippets_dirpath.c_str());
+	unlink(input_path.c_str());
+	unlink(output_path.c_str());
+	rmdir(tmp_dirpath);
+	return any_errors;
+}
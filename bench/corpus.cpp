@@ -0,0 +1,370 @@
+#include "corpus.h"
+
+#include <cstring>
+
+
+constexpr const char* words[] = {
+	"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do",
+	"eiusmod", "tempor", "incididunt", "ut", "labore", "et", "dolore", "magna", "aliqua", "enim",
+	"ad", "minim", "veniam", "quis", "nostrud", "exercitation", "ullamco", "laboris", "nisi", "aliquip",
+	"ex", "ea", "commodo", "consequat", "duis", "aute", "irure", "in", "reprehenderit", "voluptate"
+};
+constexpr unsigned n_words = sizeof(words) / sizeof(words[0]);
+
+constexpr const char* custom_tag_names[] = {
+	"card", "panel", "note", "aside-box", "badge", "chip", "figure-x", "caption-x"
+};
+constexpr unsigned n_custom_tag_names = sizeof(custom_tag_names) / sizeof(custom_tag_names[0]);
+
+
+static
+void append_words(std::string& doc,  CorpusRng& rng,  const unsigned n){
+	for (unsigned i = 0;  i < n;  ++i){
+		if (i != 0)
+			doc += (rng.below(12) == 0) ? ", " : " ";
+		doc += words[rng.below(n_words)];
+	}
+}
+
+static
+void append_number(std::string& doc,  CorpusRng& rng){
+	doc += std::to_string(rng.below(100000));
+}
+
+
+static
+void append_prose(std::string& doc,  CorpusRng& rng){
+	const unsigned n_lines = 1 + rng.below(4);
+	for (unsigned i = 0;  i < n_lines;  ++i){
+		append_words(doc, rng, 8 + rng.below(10));
+		doc += (i+1 == n_lines) ? ".\n\n" : "\n";
+	}
+}
+
+static
+void append_heading(std::string& doc,  CorpusRng& rng){
+	doc.append(1 + rng.below(6), '#');
+	doc += ' ';
+	append_words(doc, rng, 2 + rng.below(5));
+	doc += "\n\n";
+}
+
+static
+void append_links(std::string& doc,  CorpusRng& rng){
+	const unsigned n_items = 6 + rng.below(8);
+	for (unsigned i = 0;  i < n_items;  ++i){
+		if (i != 0)
+			doc += ' ';
+		if (rng.below(2) == 0){
+			doc += '[';
+			append_words(doc, rng, 1 + rng.below(3));
+			doc += "](https://example.com/";
+			doc += words[rng.below(n_words)];
+			doc += '/';
+			append_number(doc, rng);
+			doc += ')';
+		} else {
+			append_words(doc, rng, 1 + rng.below(3));
+		}
+	}
+	doc += ".\n\n";
+}
+
+static
+void append_emphasis(std::string& doc,  CorpusRng& rng){
+	const unsigned n_items = 6 + rng.below(8);
+	for (unsigned i = 0;  i < n_items;  ++i){
+		if (i != 0)
+			doc += ' ';
+		const char* const asterisks = (rng.below(2) == 0) ? "*" : "**";
+		switch(rng.below(3)){
+			case 0:
+				append_words(doc, rng, 1 + rng.below(3));
+				break;
+			default:
+				doc += asterisks;
+				append_words(doc, rng, 1 + rng.below(3));
+				doc += asterisks;
+		}
+	}
+	doc += ".\n\n";
+}
+
+static
+void append_list(std::string& doc,  CorpusRng& rng){
+	// Nested by two spaces per level, deepening one level at a time
+	const unsigned n_items = 3 + rng.below(10);
+	unsigned depth = 0;
+	for (unsigned i = 0;  i < n_items;  ++i){
+		if (i != 0)
+			depth = ((depth < 3) and (rng.below(3) == 0)) ? depth + 1 : rng.below(depth + 1);
+		doc.append(2*depth, ' ');
+		doc += "* ";
+		append_words(doc, rng, 2 + rng.below(8));
+		doc += '\n';
+	}
+	doc += '\n';
+}
+
+static
+void append_blockquote(std::string& doc,  CorpusRng& rng){
+	const unsigned n_lines = 1 + rng.below(3);
+	for (unsigned i = 0;  i < n_lines;  ++i){
+		doc += "> ";
+		append_words(doc, rng, 6 + rng.below(12));
+		doc += '\n';
+	}
+	doc += '\n';
+}
+
+static
+void append_inline_html(std::string& doc,  CorpusRng& rng){
+	// Only tags with built in display rules, so that nothing is warned about
+	const bool is_div = (rng.below(4) == 0);
+	if (is_div)
+		doc += "<div class=\"box\">";
+	const unsigned n_items = 5 + rng.below(8);
+	for (unsigned i = 0;  i < n_items;  ++i){
+		if (i != 0)
+			doc += ' ';
+		switch(rng.below(5)){
+			case 0:
+				doc += "<span>";
+				append_words(doc, rng, 1 + rng.below(3));
+				doc += "</span>";
+				break;
+			case 1:
+				doc += "<b>";
+				append_words(doc, rng, 1 + rng.below(2));
+				doc += "</b>";
+				break;
+			case 2:
+				doc += "<a href=\"https://example.com/";
+				append_number(doc, rng);
+				doc += "\">";
+				append_words(doc, rng, 1 + rng.below(3));
+				doc += "</a>";
+				break;
+			case 3:
+				doc += "<em>";
+				append_words(doc, rng, 1 + rng.below(2));
+				doc += "</em>";
+				break;
+			default:
+				append_words(doc, rng, 1 + rng.below(4));
+		}
+	}
+	doc += is_div ? "</div>\n\n" : ".\n\n";
+}
+
+static
+void append_script_line(std::string& doc,  CorpusRng& rng){
+	doc += "var ";
+	doc += words[rng.below(n_words)];
+	doc += " = (x < ";
+	append_number(doc, rng);
+	doc += ") ? \"";
+	doc += words[rng.below(n_words)];
+	doc += "\" : [";
+	append_number(doc, rng);
+	doc += "];\n";
+}
+
+static
+void append_style_or_script(std::string& doc,  CorpusRng& rng){
+	switch(rng.below(3)){
+		case 0: {
+			doc += "<style>\nhtml{}\n";
+			const unsigned n_rules = 1 + rng.below(4);
+			for (unsigned i = 0;  i < n_rules;  ++i){
+				doc += custom_tag_names[rng.below(n_custom_tag_names)];
+				doc += ", ";
+				doc += custom_tag_names[rng.below(n_custom_tag_names)];
+				doc += (rng.below(2) == 0) ? " {\n\tdisplay:block;\n}\n" : " {display: inline-block}\n";
+			}
+			doc += "</style>\n\n";
+			break;
+		}
+		case 1: {
+			doc += "<script>\n";
+			const unsigned n_lines = 3 + rng.below(10);
+			for (unsigned i = 0;  i < n_lines;  ++i)
+				append_script_line(doc, rng);
+			doc += "</script>\n\n";
+			break;
+		}
+		default: {
+			// Tags which the <style> elements give display rules to
+			const char* const tag_name = custom_tag_names[rng.below(n_custom_tag_names)];
+			doc += '<';
+			doc += tag_name;
+			doc += '>';
+			append_words(doc, rng, 3 + rng.below(8));
+			doc += "</";
+			doc += tag_name;
+			doc += ">\n\n";
+		}
+	}
+}
+
+static
+void append_bundled_script(std::string& doc,  CorpusRng& rng){
+	// As inlined by htmlwidgets and the like: a short paragraph, then a script of tens or hundreds of KiB
+	append_prose(doc, rng);
+	doc += "<script>\n";
+	const std::size_t script_sz = 1024*(32 + rng.below(480));
+	const std::size_t script_end = doc.size() + script_sz;
+	while(doc.size() < script_end)
+		append_script_line(doc, rng);
+	doc += "</script>\n\n";
+}
+
+static
+void append_knitr(std::string& doc,  CorpusRng& rng){
+	switch(rng.below(3)){
+		case 0: {
+			doc += "```r\n";
+			const unsigned n_lines = 1 + rng.below(8);
+			for (unsigned i = 0;  i < n_lines;  ++i){
+				doc += words[rng.below(n_words)];
+				doc += " <- c(";
+				append_number(doc, rng);
+				doc += ", ";
+				append_number(doc, rng);
+				doc += ")\n";
+			}
+			doc += "```\n\n";
+			break;
+		}
+		case 1:
+			doc += "```\n## [1] \"<span>";
+			append_words(doc, rng, 3 + rng.below(10));
+			if (rng.below(2) == 0){
+				doc += " \\\"";
+				append_words(doc, rng, 1 + rng.below(3));
+				doc += "\\\"";
+			}
+			doc += "</span>\"\n```\n\n";
+			break;
+		default:
+			doc += "```\n## ";
+			append_words(doc, rng, 3 + rng.below(10));
+			doc += "\n```\n\n";
+	}
+}
+
+static
+void append_replacements(std::string& doc,  CorpusRng& rng){
+	const unsigned n_items = 6 + rng.below(8);
+	for (unsigned i = 0;  i < n_items;  ++i){
+		if (i != 0)
+			doc += ' ';
+		if (rng.below(2) == 0){
+			doc += "R_E_P_L_A_C_E_snippet";
+			doc += std::to_string(rng.below(CORPUS_N_SNIPPETS));
+		} else {
+			append_words(doc, rng, 1 + rng.below(3));
+		}
+	}
+	doc += " .\n\n";
+}
+
+static
+void append_inline_functions(std::string& doc,  CorpusRng& rng){
+	// Inline R calling the inline functions, with few enough distinct calls that most are repeated, as computed snippets are
+	const unsigned n_items = 6 + rng.below(8);
+	for (unsigned i = 0;  i < n_items;  ++i){
+		if (i != 0)
+			doc += ' ';
+		if (rng.below(2) == 0){
+			switch(rng.below(4)){
+				case 0:
+					doc += "`r paste0(\"";
+					doc += words[rng.below(n_words)];
+					doc += "\", \"-\", ";
+					doc += std::to_string(rng.below(CORPUS_N_SNIPPETS));
+					doc += ")`";
+					break;
+				case 1:
+					doc += "`r toupper(\"";
+					doc += words[rng.below(n_words)];
+					doc += "\")`";
+					break;
+				case 2:
+					doc += "`r strrep(\"";
+					doc += words[rng.below(n_words)];
+					doc += " \", ";
+					doc += std::to_string(1 + rng.below(4));
+					doc += ")`";
+					break;
+				default:
+					doc += "`r nchar('";
+					doc += words[rng.below(n_words)];
+					doc += "')`";
+			}
+		} else {
+			append_words(doc, rng, 1 + rng.below(3));
+		}
+	}
+	doc += " .\n\n";
+}
+
+static
+void append_unmatched(std::string& doc,  CorpusRng& rng){
+	// A long line of delimiters which nothing closes, as machine-generated documents have: each would be looked ahead from to the end of the line
+	for (unsigned i = 0;  i < 1024;  ++i){
+		switch(rng.below(8)){
+			case 0:
+			case 1:
+				doc += '[';
+				break;
+			case 2:
+				doc += "<b ";
+				break;
+			case 3:
+				doc += "[w](x ";
+				break;
+		}
+		append_words(doc, rng, 1);
+		doc += ' ';
+	}
+	doc.append(256 + rng.below(256), '*');
+	doc += "a.\n\n";
+}
+
+
+const CorpusConstruct corpus_constructs[] = {
+	{"prose", append_prose},
+	{"headings", append_heading},
+	{"links", append_links},
+	{"emphasis", append_emphasis},
+	{"lists", append_list},
+	{"blockquotes", append_blockquote},
+	{"inline_html", append_inline_html},
+	{"style_script", append_style_or_script},
+	{"bundled_script", append_bundled_script},
+	{"knitr", append_knitr},
+	{"replacements", append_replacements},
+	{"inline_functions", append_inline_functions},
+	{"unmatched", append_unmatched}
+};
+const std::size_t n_corpus_constructs = sizeof(corpus_constructs) / sizeof(corpus_constructs[0]);
+
+const CorpusConstruct* find_corpus_construct(const char* const name){
+	for (std::size_t i = 0;  i < n_corpus_constructs;  ++i)
+		if (strcmp(corpus_constructs[i].name, name) == 0)
+			return &corpus_constructs[i];
+	return nullptr;
+}
+
+std::string generate_corpus(const CorpusConstruct& construct,  const std::size_t min_sz,  const uint64_t seed){
+	CorpusRng rng(seed);
+	std::string doc;
+	doc.reserve(min_sz + 4096);
+	doc += "---\ntitle: \"";
+	doc += construct.name;
+	doc += "\"\noutput: html_document\n---\n\n";
+	while(doc.size() < min_sz)
+		construct.append_block(doc, rng);
+	return doc;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+constexpr unsigned CORPUS_N_SNIPPETS = 16; // The R_E_P_L_A_C_E_ tokens of the replacements corpus name files R_E_P_L_A_C_E_snippet0 to R_E_P_L_A_C_E_snippet15
+
+
+struct CorpusRng {
+	// xorshift64*, so that a corpus is the same on every platform and run
+	uint64_t state;
+
+	explicit CorpusRng(const uint64_t seed)
+	: state((seed == 0) ? 1 : seed)
+	{}
+
+	uint64_t next(){
+		this->state ^= this->state >> 12;
+		this->state ^= this->state << 25;
+		this->state ^= this->state >> 27;
+		return this->state * 0x2545f4914f6cdd1du;
+	}
+	unsigned below(const unsigned n){
+		return this->next() % n;
+	}
+};
+
+
+struct CorpusConstruct {
+	const char* name;
+	void(*append_block)(std::string& doc,  CorpusRng& rng); // Appends one top-level block, ending with a blank line
+};
+
+extern const CorpusConstruct corpus_constructs[];
+extern const std::size_t n_corpus_constructs;
+
+const CorpusConstruct* find_corpus_construct(const char* const name);
+std::string generate_corpus(const CorpusConstruct& construct,  const std::size_t min_sz,  const uint64_t seed); // A document of at least min_sz bytes, consisting mostly of the construct
@@ -0,0 +1,129 @@
+#include "daemon.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+static
+bool read_file(const char* const path,  std::string& contents){
+	const int fd = open(path, O_RDONLY);
+	if (unlikely(fd == -1))
+		return false;
+	char buf[1024*64];
+	ssize_t n;
+	while((n = read(fd, buf, sizeof(buf))) > 0)
+		contents.append(buf, n);
+	close(fd);
+	return (n == 0);
+}
+
+static
+double percentile(const std::vector<double>& sorted,  const unsigned p){
+	return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+
+int main(int argc,  const char* const* argv){
+	unsigned concurrency = 8;
+	unsigned n_requests = 1000;
+	bool is_inline = false;
+	bool any_errors = false;
+	++argv;
+	--argc;
+	while((argc != 0) and (argv[0][0] == '-') and (argv[0][1] != 0) and (argv[0][2] == 0)){
+		switch(argv[0][1]){
+			case 'c':
+				concurrency = strtoul(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 'n':
+				n_requests = strtoul(*(++argv), nullptr, 10);
+				--argc;
+				break;
+			case 'i':
+				is_inline = true;
+				break;
+			default:
+				any_errors = true;
+				break;
+		}
+		++argv;
+		--argc;
+	}
+	if (unlikely(any_errors or (argc != 2) or (concurrency == 0) or (n_requests == 0))){
+		fprintf(stderr,
+			"USAGE: [[OPTIONS]] [/path/to/socket] [/path/to/file.rmd]\n"
+			"	Has the daemon listening on the socket (md_to_html -D) convert the file repeatedly, from several connections at once, and reports the latency of the requests\n"
+			"OPTIONS:\n"
+			"	-c [N]\n"
+			"		Connections, each sending its next request once the last is answered (default 8)\n"
+			"	-n [N]\n"
+			"		Requests in total (default 1000)\n"
+			"	-i\n"
+			"		Send the markdown itself, rather than its path\n"
+		);
+		return 1;
+	}
+	const char* const socket_path = argv[0];
+	char path[PATH_MAX];
+	std::string markdown;
+	if (unlikely((realpath(argv[1], path) == nullptr) or (is_inline and not read_file(path, markdown)))){
+		fprintf(stderr, "ERROR: Cannot read %s\n", argv[1]);
+		return 1;
+	}
+
+	std::atomic<unsigned> next_request(0);
+	std::atomic<bool> is_failed(false);
+	std::vector<std::vector<double>> latencies_us(concurrency);
+	const auto started_at = std::chrono::steady_clock::now();
+	std::vector<std::thread> clients;
+	for (unsigned i = 0;  i < concurrency;  ++i){
+		clients.emplace_back([&, i](){
+			const int fd = connect_to_daemon(socket_path);
+			if (unlikely(fd == -1)){
+				is_failed = true;
+				return;
+			}
+			std::unique_ptr<SocketReader> reader(new SocketReader(fd));
+			std::string body;
+			while(next_request.fetch_add(1, std::memory_order_relaxed) < n_requests){
+				const auto sent_at = std::chrono::steady_clock::now();
+				const bool is_sent = is_inline ? send_markdown_request(fd, "-", markdown) : send_path_request(fd, "-", path);
+				bool is_ok = false;
+				if (unlikely(not (is_sent and read_response(*reader, is_ok, body) and is_ok))){
+					fprintf(stderr, "ERROR: Request failed: %s\n", body.c_str());
+					is_failed = true;
+					break;
+				}
+				latencies_us[i].push_back(std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now() - sent_at).count());
+			}
+			close(fd);
+		});
+	}
+	for (std::thread& client : clients)
+		client.join();
+	const double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_at).count();
+	if (unlikely(is_failed))
+		return 1;
+
+	std::vector<double> sorted;
+	for (const std::vector<double>& l : latencies_us)
+		sorted.insert(sorted.end(), l.begin(), l.end());
+	std::sort(sorted.begin(), sorted.end());
+	printf("%u requests of %s, %u at a time: %.0f requests/s\n", n_requests, is_inline ? "inline markdown" : "a path", concurrency, n_requests / elapsed_s);
+	printf("%10s %10s %10s %10s\n", "p50 us", "p90 us", "p99 us", "max us");
+	printf("%10.0f %10.0f %10.0f %10.0f\n", percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99), sorted.back());
+	return 0;
+}
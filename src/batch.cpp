@@ -0,0 +1,220 @@
+#include "batch.h"
+#include "md_to_html.h"
+#include "input.h"
+#include "output.h"
+#include "compress.h"
+#include "stats.h"
+
+#include <compsky/utils/ptrdiff.hpp>
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+char* read_batch_manifest(const int fd,  std::vector<BatchJob>& jobs){
+	// Returns the buffer which the jobs' paths point into, or nullptr if the manifest is malformed
+	std::size_t buf_sz = 4096;
+	std::size_t n_read = 0;
+	char* buf = reinterpret_cast<char*>(malloc(buf_sz));
+	while(buf != nullptr){
+		if (n_read == buf_sz){
+			buf_sz *= 2;
+			char* const new_buf = reinterpret_cast<char*>(realloc(buf, buf_sz));
+			if (unlikely(new_buf == nullptr))
+				free(buf);
+			buf = new_buf;
+			continue;
+		}
+		const ssize_t n = read(fd, buf + n_read, buf_sz - n_read);
+		if (n > 0){
+			n_read += n;
+		} else if ((n == -1) and (errno == EINTR)){
+			continue;
+		} else {
+			if (unlikely(n == -1)){
+				fprintf(stderr, "ERROR: Cannot read manifest: %s\n", strerror(errno));
+				free(buf);
+				return nullptr;
+			}
+			break;
+		}
+	}
+	if (unlikely(buf == nullptr)){
+		fprintf(stderr, "ERROR: Cannot allocate memory for manifest\n");
+		return nullptr;
+	}
+	// NOTE: The loop above ends with n_read < buf_sz, so there is room to terminate an unterminated last line
+	buf[n_read] = '\n';
+	char* const end = buf + n_read + 1;
+	char* line = buf;
+	unsigned line_n = 1;
+	while(line < end){
+		char* const eol = reinterpret_cast<char*>(memchr(line, '\n', compsky::utils::ptrdiff(end,line)));
+		if (eol != line){
+			char* const tab = reinterpret_cast<char*>(memchr(line, '\t', compsky::utils::ptrdiff(eol,line)));
+			if (unlikely((tab == nullptr) or (tab == line) or (tab+1 == eol))){
+				fprintf(stderr, "ERROR: Manifest line %u is not an input and output path separated by a tab: %.*s\n", line_n, (int)compsky::utils::ptrdiff(eol,line), line);
+				free(buf);
+				return nullptr;
+			}
+			*tab = 0;
+			jobs.push_back({line, tab+1, 0});
+		}
+		*eol = 0;
+		line = eol + 1;
+		++line_n;
+	}
+	return buf;
+}
+
+
+struct WorkerQueue {
+	// The owner takes from the front, where the largest of its jobs are; idle workers steal from the back
+	std::mutex mutex;
+	std::vector<BatchJob*> jobs;
+	std::size_t front;
+	std::size_t back;
+
+	WorkerQueue()
+	: front(0)
+	, back(0)
+	{}
+
+	BatchJob* pop_front(){
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return (this->front == this->back) ? nullptr : this->jobs[this->front++];
+	}
+	BatchJob* steal_back(){
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return (this->front == this->back) ? nullptr : this->jobs[--this->back];
+	}
+};
+
+bool report_conversion_error(const char* const input_path,  const ConversionError& error){
+	if (likely(not error))
+		return false;
+	fprintf(stderr, "ERROR: %s in %s: %s\n", error.name(), input_path, error.detail.c_str());
+	return true;
+}
+
+bool convert_batch_job(const ConversionOptions& options,  const BatchJob& job,  HtmlOutput& html_output){
+	conversion_stats = options.stats; // So that reading the input is timed too
+	const int out_fd = open(job.output_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (unlikely(out_fd == -1)){
+		fprintf(stderr, "ERROR: Cannot open %s: %s\n", job.output_path, strerror(errno));
+		return false;
+	}
+	MarkdownInput markdown_input(job.input_path, false);
+	html_output.fd = out_fd;
+	html_output.is_write_failed = false;
+	if (html_output.compression != nullptr)
+		html_output.compression->begin(job.output_path);
+	const bool is_error = report_conversion_error(job.input_path, md_to_html(options, markdown_input, html_output));
+	if (html_output.compression != nullptr)
+		html_output.compression->end();
+	close(out_fd);
+	return not (is_error or html_output.is_write_failed);
+}
+
+static
+bool convert_read_ahead_batch_job(const ConversionOptions& options,  const BatchJob& job,  const std::size_t job_indx,  char* const input_buf,  const std::size_t input_sz,  BatchIo& batch_io,  const unsigned worker_indx,  CompressionPipeline* const compression){
+	// The input was read ahead by batch_io, and the output is held in memory, to be written by batch_io while the worker converts the next
+	conversion_stats = options.stats;
+	HtmlOutput* const html_output = batch_io.take_output(worker_indx);
+	if (unlikely(html_output == nullptr)){
+		batch_io.release_input(job_indx);
+		return false;
+	}
+	bool is_error;
+	{
+		MarkdownInput markdown_input(job.input_path, input_buf, input_sz);
+		is_error = report_conversion_error(job.input_path, md_to_html(options, markdown_input, *html_output));
+	}
+	batch_io.release_input(job_indx);
+	if (unlikely(is_error)){
+		batch_io.return_output(worker_indx, html_output);
+		return false;
+	}
+	if (compression != nullptr){
+		const std::string_view html = html_output->held();
+		compression->begin(job.output_path);
+		compression->add(html.data(), html.size());
+		compression->end();
+	}
+	batch_io.write(worker_indx, html_output, job.output_path);
+	return true;
+}
+
+bool convert_batch(const ConversionOptions& options,  const CompressionOptions& compression_options,  const BatchIoBackend io_backend,  std::vector<BatchJob>& jobs){
+	// Jobs are dealt out largest first, round robin, to one queue per worker. Each worker's output buffer is reused for all of its documents.
+	// Each worker has its own compressing thread, so that it compresses a document while the worker goes on to the next.
+	// Unless io_backend is batch_io_sync, the inputs are read ahead of the workers, and the outputs written behind them, by BatchIo
+	for (BatchJob& job : jobs){
+		struct stat st;
+		job.input_sz = (stat(job.input_path, &st) == 0) ? st.st_size : 0;
+	}
+	std::sort(jobs.begin(), jobs.end(), [](const BatchJob& a,  const BatchJob& b){
+		return (a.input_sz > b.input_sz);
+	});
+	const unsigned n_workers = std::max(1u, std::min(std::thread::hardware_concurrency(), static_cast<unsigned>(jobs.size())));
+	std::unique_ptr<WorkerQueue[]> queues(new WorkerQueue[n_workers]);
+	for (std::size_t i = 0;  i < jobs.size();  ++i){
+		queues[i % n_workers].jobs.push_back(&jobs[i]);
+	}
+	for (unsigned i = 0;  i < n_workers;  ++i){
+		queues[i].back = queues[i].jobs.size();
+	}
+	std::unique_ptr<BatchIo> batch_io;
+	if (io_backend != batch_io_sync)
+		batch_io.reset(new BatchIo(io_backend, jobs, n_workers));
+	std::atomic<bool> any_errors(false);
+	std::vector<std::thread> workers;
+	for (unsigned worker_indx = 0;  worker_indx < n_workers;  ++worker_indx){
+		workers.emplace_back([&options, &compression_options, &jobs, &queues, &batch_io, &any_errors, n_workers, worker_indx](){
+			HtmlOutput html_output(-1);
+			std::unique_ptr<CompressionPipeline> compression;
+			if (compression_options.any()){
+				compression.reset(new CompressionPipeline(compression_options));
+				html_output.compression = compression.get();
+			}
+			if (unlikely(html_output.is_null() or ((compression != nullptr) and compression->is_null()))){
+				any_errors = true;
+				return;
+			}
+			while(true){
+				// No jobs are added once the workers start, so if there is nothing to steal, there is nothing left to do
+				BatchJob* job = queues[worker_indx].pop_front();
+				for (unsigned i = 1;  (job == nullptr) and (i < n_workers);  ++i){
+					job = queues[(worker_indx + i) % n_workers].steal_back();
+				}
+				if (job == nullptr)
+					break;
+				const std::size_t job_indx = static_cast<std::size_t>(job - jobs.data());
+				char* input_buf;
+				std::size_t input_sz;
+				const bool is_ok = ((batch_io != nullptr) and batch_io->take_input(job_indx, input_buf, input_sz))
+					? convert_read_ahead_batch_job(options, *job, job_indx, input_buf, input_sz, *batch_io, worker_indx, compression.get())
+					: convert_batch_job(options, *job, html_output);
+				if (unlikely(not is_ok))
+					any_errors = true;
+			}
+			if ((compression != nullptr) and unlikely(not compression->wait()))
+				any_errors = true;
+		});
+	}
+	for (std::thread& worker : workers)
+		worker.join();
+	if ((batch_io != nullptr) and unlikely(not batch_io->wait()))
+		any_errors = true;
+	return not any_errors;
+}
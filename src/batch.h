@@ -0,0 +1,23 @@
+#pragma once
+
+#include "batch_io.h"
+
+#include <cstddef>
+#include <vector>
+
+
+struct BatchJob {
+	const char* input_path;
+	const char* output_path;
+	std::size_t input_sz; // For scheduling the largest documents first
+};
+
+struct HtmlOutput;
+struct ConversionOptions;
+struct ConversionError;
+struct CompressionOptions;
+
+char* read_batch_manifest(const int fd,  std::vector<BatchJob>& jobs);
+bool report_conversion_error(const char* const input_path,  const ConversionError& error); // Returns whether there was an error
+bool convert_batch_job(const ConversionOptions& options,  const BatchJob& job,  HtmlOutput& html_output); // Also compressed, if html_output.compression is set
+bool convert_batch(const ConversionOptions& options,  const CompressionOptions& compression_options,  const BatchIoBackend io_backend,  std::vector<BatchJob>& jobs);
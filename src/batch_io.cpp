@@ -0,0 +1,425 @@
+#include "batch_io.h"
+#include "batch.h"
+#include "input.h"
+#include "output.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+constexpr std::size_t MAX_TRANSFER_SZ = 1024*1024*1024; // Of a single read or write, as its result must fit in an int
+
+
+bool parse_batch_io_backend(const char* const str,  BatchIoBackend& backend){
+	if (strcmp(str, "sync") == 0)
+		backend = batch_io_sync;
+	else if (strcmp(str, "threads") == 0)
+		backend = batch_io_threads;
+	else if (strcmp(str, "uring") == 0)
+		backend = batch_io_uring;
+	else
+		return false;
+	return true;
+}
+
+
+BatchIo::Ring::~Ring(){
+	if (this->sqes != nullptr)
+		munmap(this->sqes, this->sqes_sz);
+	if ((this->cq_ring != nullptr) and (this->cq_ring != this->sq_ring))
+		munmap(this->cq_ring, this->cq_ring_sz);
+	if (this->sq_ring != nullptr)
+		munmap(this->sq_ring, this->sq_ring_sz);
+	if (this->fd != -1)
+		close(this->fd);
+}
+
+static
+void* map_ring(const int fd,  const std::size_t sz,  const off_t offset){
+	void* const ptr = mmap(nullptr, sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, offset);
+	return (ptr == MAP_FAILED) ? nullptr : ptr;
+}
+
+bool BatchIo::Ring::init(const unsigned depth){
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	this->fd = syscall(__NR_io_uring_setup, depth, &params);
+	if (this->fd == -1)
+		return false;
+	this->sq_ring_sz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	this->cq_ring_sz = params.cq_off.cqes   + params.cq_entries * sizeof(io_uring_cqe);
+	this->sqes_sz    = params.sq_entries * sizeof(io_uring_sqe);
+	const bool is_single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP);
+	if (is_single_mmap)
+		this->sq_ring_sz = this->cq_ring_sz = std::max(this->sq_ring_sz, this->cq_ring_sz);
+	this->sq_ring = map_ring(this->fd, this->sq_ring_sz, IORING_OFF_SQ_RING);
+	if (unlikely(this->sq_ring == nullptr))
+		return false;
+	this->cq_ring = is_single_mmap ? this->sq_ring : map_ring(this->fd, this->cq_ring_sz, IORING_OFF_CQ_RING);
+	if (unlikely(this->cq_ring == nullptr))
+		return false;
+	this->sqes = map_ring(this->fd, this->sqes_sz, IORING_OFF_SQES);
+	if (unlikely(this->sqes == nullptr))
+		return false;
+	char* const sq = reinterpret_cast<char*>(this->sq_ring);
+	char* const cq = reinterpret_cast<char*>(this->cq_ring);
+	this->sq_tail  = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	this->sq_mask  = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	this->sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	this->cq_head  = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	this->cq_tail  = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	this->cq_mask  = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	this->cqes = cq + params.cq_off.cqes;
+
+	// io_uring predates some of the operations used, and may be restricted
+	constexpr unsigned n_probed_ops = 256;
+	std::unique_ptr<char[]> probe_buf(new char[sizeof(io_uring_probe) + n_probed_ops*sizeof(io_uring_probe_op)]());
+	io_uring_probe* const probe = reinterpret_cast<io_uring_probe*>(probe_buf.get());
+	if (syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_PROBE, probe, n_probed_ops) == -1)
+		return false;
+	for (const unsigned op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE}){
+		if ((op > probe->last_op) or not (probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+			return false;
+	}
+	return true;
+}
+
+void BatchIo::Ring::prepare(Op& op){
+	// NOTE: There is always room in the submission queue, as no more ops are in flight than it has entries, each with at most one system call queued
+	const unsigned tail = *this->sq_tail;
+	const unsigned indx = tail & *this->sq_mask;
+	io_uring_sqe* const sqe = reinterpret_cast<io_uring_sqe*>(this->sqes) + indx;
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	sqe->user_data = reinterpret_cast<uintptr_t>(&op);
+	switch(op.stage){
+		case Op::opening:
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = reinterpret_cast<uintptr_t>(op.path);
+			sqe->len = 0644;
+			sqe->open_flags = (op.kind == Op::read_input) ? (O_RDONLY|O_CLOEXEC) : (O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC);
+			break;
+		case Op::transferring:
+			sqe->opcode = (op.kind == Op::read_input) ? IORING_OP_READ : IORING_OP_WRITE;
+			sqe->fd = op.fd;
+			sqe->addr = reinterpret_cast<uintptr_t>(op.data + op.n_done);
+			sqe->len = std::min(op.sz - op.n_done, MAX_TRANSFER_SZ);
+			sqe->off = op.n_done;
+			break;
+		case Op::closing:
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = op.fd;
+			break;
+	}
+	this->sq_array[indx] = indx;
+	__atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++this->n_unsubmitted;
+}
+
+bool BatchIo::Ring::submit_and_wait(){
+	while(true){
+		const int n_submitted = syscall(__NR_io_uring_enter, this->fd, this->n_unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+		if (likely(n_submitted != -1)){
+			this->n_unsubmitted -= n_submitted;
+			return true;
+		}
+		if ((errno != EINTR) and (errno != EAGAIN) and (errno != EBUSY))
+			return false;
+	}
+}
+
+
+BatchIo::BatchIo(const BatchIoBackend _backend,  const std::vector<BatchJob>& _jobs,  const unsigned n_workers)
+: backend(_backend)
+, jobs(_jobs)
+, inputs(new Input[_jobs.size()])
+, next_read_indx(0)
+, n_read_ahead(0)
+, read_ahead_sz(0)
+, free_outputs(n_workers)
+, n_outputs(n_workers, 0)
+, is_stopping(false)
+, any_errors(false)
+{
+	for (std::size_t i = 0;  i < _jobs.size();  ++i){
+		this->inputs[i] = {nullptr, 0, 0, Input::unread};
+	}
+	if ((this->backend == batch_io_uring) and not this->ring.init(BATCH_IO_URING_DEPTH))
+		this->backend = batch_io_threads;
+	if (this->backend == batch_io_uring){
+		this->threads.emplace_back(&BatchIo::run_uring, this);
+	} else {
+		for (unsigned i = 0;  i < BATCH_IO_N_THREADS;  ++i)
+			this->threads.emplace_back(&BatchIo::run_threads, this);
+	}
+}
+
+BatchIo::~BatchIo(){
+	if (not this->threads.empty())
+		this->wait();
+	for (std::size_t i = 0;  i < this->jobs.size();  ++i){
+		free(this->inputs[i].buf); // Of any a worker did not take, having failed
+	}
+}
+
+bool BatchIo::take_input(const std::size_t job_indx,  char*& buf,  std::size_t& sz){
+	std::unique_lock<std::mutex> lock(this->mutex);
+	Input& input = this->inputs[job_indx];
+	if (input.state == Input::unread){
+		input.state = Input::taken;
+		return false;
+	}
+	while(input.state == Input::reading)
+		this->is_done.wait(lock);
+	if (input.buf == nullptr){
+		// Could not be read, which the worker reports as it reads it itself
+		this->release(input);
+		return false;
+	}
+	buf = input.buf;
+	sz  = input.sz;
+	return true;
+}
+
+void BatchIo::release_input(const std::size_t job_indx){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->release(this->inputs[job_indx]);
+}
+
+void BatchIo::release(Input& input){
+	free(input.buf);
+	input.buf = nullptr;
+	--this->n_read_ahead;
+	this->read_ahead_sz -= input.capacity;
+	this->is_work.notify_all();
+}
+
+HtmlOutput* BatchIo::take_output(const unsigned worker_indx){
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		std::vector<HtmlOutput*>& free_outputs = this->free_outputs[worker_indx];
+		while(free_outputs.empty() and (this->n_outputs[worker_indx] == BATCH_IO_OUTPUTS_PER_WORKER))
+			this->is_done.wait(lock);
+		if (not free_outputs.empty()){
+			HtmlOutput* const html_output = free_outputs.back();
+			free_outputs.pop_back();
+			return html_output;
+		}
+		++this->n_outputs[worker_indx];
+	}
+	std::unique_ptr<HtmlOutput> html_output(new HtmlOutput(-1));
+	if (unlikely(html_output->is_null()))
+		return nullptr;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->outputs.push_back(std::move(html_output));
+	return this->outputs.back().get();
+}
+
+void BatchIo::write(const unsigned worker_indx,  HtmlOutput* const html_output,  const char* const path){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->writes.push_back({Op::write_output, Op::opening, -1, 0, path, html_output->buf, html_output->n_held, 0, 0, html_output, worker_indx});
+	this->is_work.notify_one();
+}
+
+void BatchIo::return_output(const unsigned worker_indx,  HtmlOutput* const html_output){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->free_outputs[worker_indx].push_back(html_output);
+}
+
+bool BatchIo::wait(){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->is_stopping = true;
+	}
+	this->is_work.notify_all();
+	for (std::thread& thread : this->threads)
+		thread.join();
+	this->threads.clear();
+	return not this->any_errors;
+}
+
+bool BatchIo::next_op(Op& op){
+	if (not this->writes.empty()){
+		// Before reading ahead, as the worker may be waiting for the output
+		op = this->writes.front();
+		this->writes.pop_front();
+		return true;
+	}
+	while((not this->is_stopping) and (this->next_read_indx < this->jobs.size())){
+		const std::size_t job_indx = this->next_read_indx;
+		const BatchJob& job = this->jobs[job_indx];
+		Input& input = this->inputs[job_indx];
+		if ((input.state != Input::unread) or (job.input_sz == 0) or (job.input_sz > BATCH_IO_MAX_INPUT_SZ)){
+			// Taken by a worker already, or left to it - as an input of size 0 may be one which could not be stat'ed
+			++this->next_read_indx;
+			continue;
+		}
+		const std::size_t capacity = job.input_sz + BATCH_IO_READ_SLACK_SZ;
+		if ((this->n_read_ahead != 0) and ((this->n_read_ahead == BATCH_IO_MAX_READ_AHEAD) or (this->read_ahead_sz + capacity > BATCH_IO_MAX_READ_AHEAD_SZ)))
+			return false;
+		++this->next_read_indx;
+		input.buf = reinterpret_cast<char*>(malloc(INPUT_LOOKBACK_SZ + capacity + 1));
+		if (unlikely(input.buf == nullptr))
+			continue;
+		memset(input.buf, 0, INPUT_LOOKBACK_SZ);
+		input.capacity = capacity;
+		input.state = Input::reading;
+		++this->n_read_ahead;
+		this->read_ahead_sz += capacity;
+		op = {Op::read_input, Op::opening, -1, 0, job.input_path, input.buf + INPUT_LOOKBACK_SZ, capacity, 0, job_indx, nullptr, 0};
+		return true;
+	}
+	return false;
+}
+
+void BatchIo::complete(Op& op){
+	if (op.kind == Op::read_input){
+		Input& input = this->inputs[op.job_indx];
+		if ((op.error != 0) or (op.n_done == op.sz)){
+			// Left to the worker - including an input which has grown since it was stat'ed, filling the buffer
+			free(input.buf);
+			input.buf = nullptr;
+		}
+		input.sz = op.n_done;
+		input.state = Input::read;
+	} else {
+		if (unlikely(op.error != 0)){
+			fprintf(stderr, "ERROR: Cannot write %s: %s\n", op.path, strerror(op.error));
+			this->any_errors = true;
+		}
+		this->free_outputs[op.worker_indx].push_back(op.html_output);
+	}
+	this->is_done.notify_all();
+}
+
+bool BatchIo::advance(Op& op,  const int result){
+	if ((result == -EINTR) and (op.stage != Op::closing))
+		return false;
+	switch(op.stage){
+		case Op::opening:
+			if (unlikely(result < 0)){
+				op.error = -result;
+				return true;
+			}
+			op.fd = result;
+			op.stage = (op.sz == 0) ? Op::closing : Op::transferring;
+			return false;
+		case Op::transferring:
+			if (unlikely(result < 0)){
+				op.error = -result;
+				op.stage = Op::closing;
+				return false;
+			}
+			if (unlikely((result == 0) and (op.kind == Op::write_output)))
+				op.error = EIO;
+			op.n_done += result;
+			if ((result == 0) or (op.n_done == op.sz))
+				op.stage = Op::closing; // At the end of the input, or of the output
+			return false;
+		case Op::closing:
+			if ((result < 0) and (op.kind == Op::write_output) and (op.error == 0))
+				op.error = -result;
+			return true;
+	}
+	return true;
+}
+
+void BatchIo::run_threads(){
+	Op op;
+	while(true){
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			while(not this->next_op(op)){
+				if (this->is_stopping)
+					return;
+				this->is_work.wait(lock);
+			}
+		}
+		while(true){
+			int result = 0;
+			switch(op.stage){
+				case Op::opening:
+					result = (op.kind == Op::read_input) ? open(op.path, O_RDONLY|O_CLOEXEC) : open(op.path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+					break;
+				case Op::transferring: {
+					const std::size_t n = std::min(op.sz - op.n_done, MAX_TRANSFER_SZ);
+					result = (op.kind == Op::read_input) ? read(op.fd, op.data + op.n_done, n) : ::write(op.fd, op.data + op.n_done, n);
+					break;
+				}
+				case Op::closing:
+					result = close(op.fd);
+					break;
+			}
+			if (result == -1)
+				result = -errno;
+			if (this->advance(op, result))
+				break;
+		}
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->complete(op);
+	}
+}
+
+void BatchIo::run_uring(){
+	// Each op has one system call in flight at a time, the next of which is submitted as soon as it completes
+	// NOTE: While waiting for completions, writes queued by the workers are not submitted until the next completes, which is soon, as there are only file operations in flight
+	std::unique_ptr<Op[]> ops(new Op[BATCH_IO_URING_DEPTH]);
+	std::vector<Op*> free_ops;
+	std::vector<Op*> done_ops;
+	for (unsigned i = 0;  i < BATCH_IO_URING_DEPTH;  ++i)
+		free_ops.push_back(&ops[i]);
+	while(true){
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			for (Op* const op : done_ops){
+				this->complete(*op);
+				free_ops.push_back(op);
+			}
+			done_ops.clear();
+			while((not free_ops.empty()) and this->next_op(*free_ops.back())){
+				this->ring.prepare(*free_ops.back());
+				free_ops.pop_back();
+			}
+			if (free_ops.size() == BATCH_IO_URING_DEPTH){
+				if (this->is_stopping)
+					return;
+				this->is_work.wait(lock);
+				continue;
+			}
+		}
+		if (unlikely(not this->ring.submit_and_wait())){
+			// The ops in flight are failed, and the rest are done as by the thread backend
+			fprintf(stderr, "ERROR: io_uring_enter: %s\n", strerror(errno));
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (unsigned i = 0;  i < BATCH_IO_URING_DEPTH;  ++i){
+				if (std::find(free_ops.begin(), free_ops.end(), &ops[i]) != free_ops.end())
+					continue;
+				ops[i].error = EIO;
+				this->complete(ops[i]);
+			}
+			break;
+		}
+		unsigned head = *this->ring.cq_head;
+		const unsigned tail = __atomic_load_n(this->ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (;  head != tail;  ++head){
+			const io_uring_cqe& cqe = reinterpret_cast<const io_uring_cqe*>(this->ring.cqes)[head & *this->ring.cq_mask];
+			Op& op = *reinterpret_cast<Op*>(static_cast<uintptr_t>(cqe.user_data));
+			if (this->advance(op, cqe.res))
+				done_ops.push_back(&op);
+			else
+				this->ring.prepare(op);
+		}
+		__atomic_store_n(this->ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+	this->run_threads();
+}
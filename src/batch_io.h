@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+constexpr std::size_t BATCH_IO_MAX_READ_AHEAD_SZ = 1024*1024*256; // Of the inputs read but not yet converted. Beyond this - or BATCH_IO_MAX_READ_AHEAD inputs - reading ahead waits for the workers to catch up.
+constexpr std::size_t BATCH_IO_MAX_READ_AHEAD = 256;
+constexpr std::size_t BATCH_IO_MAX_INPUT_SZ = 1024*1024*64; // Larger inputs are not read ahead: they are converted as without BatchIo, mapped in windows and written as they are converted, so that neither they nor their output is held in memory in its entirety
+constexpr std::size_t BATCH_IO_READ_SLACK_SZ = 4096; // Read beyond the size stat'ed, to see that the input has not grown since
+constexpr unsigned BATCH_IO_URING_DEPTH = 64; // Files being read or written at once through io_uring
+constexpr unsigned BATCH_IO_N_THREADS = 4; // Of the thread backend, each reading or writing one file at a time
+constexpr unsigned BATCH_IO_OUTPUTS_PER_WORKER = 4; // Output buffers. A worker with this many being written waits for one of them before converting its next document.
+
+
+enum BatchIoBackend : unsigned char {
+	batch_io_sync, // Each worker reads its inputs and writes its outputs itself, blocking on each
+	batch_io_threads,
+	batch_io_uring // Falls back to batch_io_threads if the kernel lacks io_uring, or the operations used
+};
+
+bool parse_batch_io_backend(const char* const str,  BatchIoBackend& backend); // "sync", "threads" or "uring"
+
+struct BatchJob;
+struct HtmlOutput;
+
+
+struct BatchIo {
+	// Reads the inputs of a batch ahead of the workers, in the order they convert them, and writes each output once it is converted, so that converting overlaps with opening, reading, writing and closing files
+	// The I/O is submitted through io_uring from a single thread, or otherwise done by BATCH_IO_N_THREADS threads of blocking calls
+	struct Input {
+		enum State : unsigned char {
+			unread,
+			reading,
+			read,
+			taken // By a worker before it was read ahead, so that the worker reads it itself
+		};
+		char* buf; // INPUT_LOOKBACK_SZ zeroes, then the file, then room for the sentinel. nullptr if it was not read ahead, or could not be.
+		std::size_t sz; // Of the file, as read
+		std::size_t capacity; // What is read, at most
+		State state;
+	};
+	struct Op {
+		// A file being read or written, opened then transferred then closed
+		enum Kind : unsigned char {
+			read_input,
+			write_output
+		};
+		enum Stage : unsigned char {
+			opening,
+			transferring,
+			closing
+		};
+		Kind kind;
+		Stage stage;
+		int fd;
+		int error; // errno of the first failure, otherwise 0
+		const char* path;
+		char* data;
+		std::size_t sz; // Of data
+		std::size_t n_done;
+		std::size_t job_indx; // Of a read_input
+		HtmlOutput* html_output; // Of a write_output
+		unsigned worker_indx; // Of a write_output
+	};
+	struct Ring {
+		// io_uring, through its system calls, as liburing is not a dependency
+		int fd;
+		unsigned* sq_tail;
+		unsigned* sq_mask;
+		unsigned* sq_array;
+		unsigned* cq_head;
+		unsigned* cq_tail;
+		unsigned* cq_mask;
+		void* sqes; // io_uring_sqe[]
+		void* cqes; // io_uring_cqe[]
+		void* sq_ring;
+		void* cq_ring; // sq_ring, if the kernel maps both at once
+		std::size_t sq_ring_sz;
+		std::size_t cq_ring_sz;
+		std::size_t sqes_sz;
+		unsigned n_unsubmitted;
+
+		Ring()
+		: fd(-1)
+		, sqes(nullptr)
+		, sq_ring(nullptr)
+		, cq_ring(nullptr)
+		, n_unsubmitted(0)
+		{}
+		~Ring();
+
+		bool init(const unsigned depth); // Whether io_uring is available, with every operation BatchIo uses
+		void prepare(Op& op); // Queues the system call of op's stage
+		bool submit_and_wait(); // Submits what is queued, and waits for at least one completion. Returns false if io_uring fails.
+	};
+
+	BatchIoBackend backend; // batch_io_uring or batch_io_threads
+	const std::vector<BatchJob>& jobs;
+	std::unique_ptr<Input[]> inputs; // Of each job
+	std::size_t next_read_indx; // Of the next job to consider reading ahead
+	std::size_t n_read_ahead; // Inputs being read or read, and not yet released by their worker
+	std::size_t read_ahead_sz;
+	std::deque<Op> writes; // Not yet begun
+	std::vector<std::unique_ptr<HtmlOutput>> outputs; // Of all workers
+	std::vector<std::vector<HtmlOutput*>> free_outputs; // Of each worker
+	std::vector<unsigned> n_outputs; // Of each worker
+	std::mutex mutex;
+	std::condition_variable is_work; // For the I/O thread(s)
+	std::condition_variable is_done; // For the workers: an input has been read, or an output written
+	bool is_stopping;
+	std::atomic<bool> any_errors;
+	Ring ring;
+	std::vector<std::thread> threads;
+
+	BatchIo(const BatchIoBackend _backend,  const std::vector<BatchJob>& _jobs,  const unsigned n_workers); // _jobs are read ahead in their order
+	~BatchIo();
+
+	// Called by the workers
+	bool take_input(const std::size_t job_indx,  char*& buf,  std::size_t& sz); // Waits until it is read, if it is being read. Returns false if it was not read ahead, for the worker to convert as without BatchIo.
+	void release_input(const std::size_t job_indx); // Once it is converted
+	HtmlOutput* take_output(const unsigned worker_indx); // An HtmlOutput(-1) to convert into. nullptr if one cannot be allocated.
+	void write(const unsigned worker_indx,  HtmlOutput* const html_output,  const char* const path); // Writes what it holds to path, then returns it to the worker
+	void return_output(const unsigned worker_indx,  HtmlOutput* const html_output); // Unwritten
+	bool wait(); // Once the workers are done: waits until everything is written, and stops the I/O thread(s). Returns whether it was all written.
+
+	// Under the mutex
+	bool next_op(Op& op); // A write, or otherwise an input to read ahead. false if there is neither for now.
+	void complete(Op& op);
+	void release(Input& input);
+
+	// Run by the I/O thread(s)
+	void run_threads();
+	void run_uring();
+	bool advance(Op& op,  const int result); // Given the result of the system call of op's stage - or -errno - moves op on to its next system call. Returns whether op is done instead.
+};
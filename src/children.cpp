@@ -0,0 +1,229 @@
+#include "children.h"
+#include "input.h"
+#include "output.h"
+#include "stats.h"
+
+#include <compsky/utils/ptrdiff.hpp>
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <sys/stat.h>
+
+
+static
+bool is_same_file(const ChildCache::Entry& entry,  const struct stat& st){
+	return (entry.sz == st.st_size) and (entry.mtime.tv_sec == st.st_mtim.tv_sec) and (entry.mtime.tv_nsec == st.st_mtim.tv_nsec);
+}
+
+static
+bool is_current(const ChildCache::Entry& entry){
+	// Whether neither it nor any of its descendants has been modified since it was converted
+	struct stat st;
+	if ((stat(entry.path.c_str(), &st) != 0) or not is_same_file(entry, st))
+		return false;
+	for (const ChildCache::Entry* const child : entry.children)
+		if ((child == nullptr) or not is_current(*child))
+			return false; // nullptr for a child which was not cached, so could not be checked
+	return true;
+}
+
+
+ChildCache::ChildCache(const unsigned _max_threads)
+: n_bytes(0)
+, n_threads(0)
+, max_threads(_max_threads)
+{}
+
+const ChildCache::Entry* ChildCache::find(const std::string& path){
+	const Entry* entry;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		const auto it = this->current.find(path);
+		if (it == this->current.end())
+			return nullptr;
+		entry = it->second;
+	}
+	return is_current(*entry) ? entry : nullptr;
+}
+
+const ChildCache::Entry* ChildCache::add(std::unique_ptr<Entry>& entry){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	const auto it = this->current.find(entry->path);
+	if ((it != this->current.end()) and (it->second->sz == entry->sz) and (it->second->mtime.tv_sec == entry->mtime.tv_sec) and (it->second->mtime.tv_nsec == entry->mtime.tv_nsec))
+		return it->second;
+	if (this->n_bytes + entry->html.size() > CHILD_CACHE_MAX_SZ)
+		return nullptr;
+	this->n_bytes += entry->html.size();
+	const Entry* const cached = entry.get();
+	this->entries.push_back(std::move(entry));
+	if (it != this->current.end())
+		this->current.erase(it);
+	this->current.emplace(cached->path, cached);
+	return cached;
+}
+
+
+static
+bool resolve_child_path(const char* const including_path,  const std::string_view relative_path,  std::string& path){
+	// Relative to the directory of the including document - or of the working directory, for one read from stdin
+	std::string joined;
+	const char* const slash = strrchr(including_path, '/');
+	if ((relative_path.substr(0,1) != "/") and (slash != nullptr))
+		joined.assign(including_path, compsky::utils::ptrdiff(slash+1, including_path));
+	joined += relative_path;
+	char resolved[PATH_MAX];
+	if (realpath(joined.c_str(), resolved) == nullptr)
+		return false;
+	path = resolved;
+	return true;
+}
+
+static
+bool is_cycle(const ConversionOptions& options,  const MarkdownInput& markdown_input,  const std::string& path){
+	// A top-level document is not in the chain, so is compared with directly
+	for (const ChildInclusion* itr = options.child_inclusion;  itr != nullptr;  itr = itr->parent)
+		if (path == itr->path)
+			return true;
+	char resolved[PATH_MAX];
+	return (options.child_inclusion == nullptr) and (realpath(markdown_input.filepath, resolved) != nullptr) and (path == resolved);
+}
+
+static
+void set_cycle_error(const ConversionOptions& options,  const std::string& path,  ConversionError& error){
+	// e.g. "a.Rmd includes b.Rmd includes a.Rmd", of the chain from the child which includes path
+	std::vector<const char*> chain;
+	for (const ChildInclusion* itr = options.child_inclusion;  itr != nullptr;  itr = itr->parent){
+		chain.push_back(itr->path);
+		if (path == itr->path)
+			break;
+	}
+	if (chain.empty())
+		chain.push_back(path.c_str()); // The top-level document includes itself
+	error.kind = ConversionError::child_cycle;
+	error.detail.clear();
+	for (auto itr = chain.rbegin();  itr != chain.rend();  ++itr){
+		error.detail += *itr;
+		error.detail += " includes ";
+	}
+	error.detail += path;
+}
+
+static
+std::unique_ptr<ChildCache::Entry> convert_child(const ConversionOptions& options,  const std::string& path,  ConversionError& error){
+	// Its modification time is taken before it is read, so that if it is modified meanwhile, it is not current when next found
+	std::unique_ptr<ChildCache::Entry> entry(new ChildCache::Entry{path, std::string(), {0, 0}, -1, {}});
+	struct stat st;
+	if (likely(stat(path.c_str(), &st) == 0)){
+		entry->mtime = st.st_mtim;
+		entry->sz = st.st_size;
+	}
+	const ChildInclusion inclusion = {entry->path.c_str(), options.child_inclusion, &entry->children};
+	ConversionOptions child_options = options;
+	child_options.child_inclusion = &inclusion;
+	MarkdownInput markdown_input(entry->path.c_str(), true);
+	HtmlOutput html_output(-1, CHILD_OUTPUT_BUF_SZ);
+	if (unlikely(html_output.is_null())){
+		error.kind = ConversionError::cannot_read_child;
+		error.detail = "Cannot allocate output";
+		return entry;
+	}
+	error = md_to_html_fragment(child_options, markdown_input, html_output);
+	if (likely(not error))
+		entry->html.assign(html_output.held());
+	return entry;
+}
+
+
+bool include_child(const ConversionOptions& options,  const MarkdownInput& markdown_input,  HtmlOutput& html_output,  char*& dest_itr,  const std::string_view relative_path,  ConversionError& error){
+	std::string path;
+	if (unlikely(not resolve_child_path(markdown_input.filepath, relative_path, path))){
+		error.kind = ConversionError::cannot_read_child;
+		error.detail.assign(relative_path);
+		return false;
+	}
+	if (unlikely(is_cycle(options, markdown_input, path))){
+		set_cycle_error(options, path, error);
+		return false;
+	}
+	if (unlikely(conversion_stats != nullptr))
+		conversion_stats->n_children.fetch_add(1, std::memory_order_relaxed);
+	const ChildCache::Entry* entry = (options.child_cache == nullptr) ? nullptr : options.child_cache->find(path);
+	std::unique_ptr<ChildCache::Entry> uncached;
+	if (entry != nullptr){
+		if (unlikely(conversion_stats != nullptr))
+			conversion_stats->n_child_cache_hits.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		uncached = convert_child(options, path, error);
+		if (unlikely(error)){
+			// Not cached, so that it is reported by every document including it. A cycle's detail already names each document.
+			if (error.kind != ConversionError::child_cycle)
+				error.detail = path + ": " + error.detail;
+			return false;
+		}
+		if (options.child_cache != nullptr)
+			entry = options.child_cache->add(uncached);
+	}
+	if (options.child_inclusion != nullptr)
+		options.child_inclusion->children->push_back(entry);
+	if (entry != nullptr){
+		html_output.append(dest_itr, entry->html.data(), entry->html.size());
+	} else {
+		// Copied, as it is freed before it would be written from where it is
+		html_output.reserve(dest_itr, uncached->html.size());
+		memcpy(dest_itr, uncached->html.data(), uncached->html.size());
+		dest_itr += uncached->html.size();
+	}
+	return true;
+}
+
+void convert_children_ahead(const ConversionOptions& options,  const MarkdownInput& markdown_input){
+	// Errors are left to be reported where the child is included, as those children are not cached
+	ChildCache* const cache = options.child_cache;
+	if ((cache == nullptr) or (cache->max_threads == 0))
+		return;
+	std::vector<std::string> paths;
+	const char* itr = markdown_input.window_begin;
+	while(true){
+		const char* const chunk = reinterpret_cast<const char*>(memmem(itr, compsky::utils::ptrdiff(markdown_input.window_end,itr), CHILD_CHUNK_OPENING.data(), CHILD_CHUNK_OPENING.size()));
+		if (chunk == nullptr)
+			break;
+		itr = chunk + CHILD_CHUNK_OPENING.size();
+		const char* const path_end = reinterpret_cast<const char*>(memchr(itr, '\'', compsky::utils::ptrdiff(markdown_input.window_end,itr)));
+		if ((path_end == nullptr) or (memchr(itr, '\n', compsky::utils::ptrdiff(path_end,itr)) != nullptr))
+			continue;
+		std::string path;
+		if (resolve_child_path(markdown_input.filepath, std::string_view(itr, compsky::utils::ptrdiff(path_end,itr)), path) and (std::find(paths.begin(), paths.end(), path) == paths.end()) and not is_cycle(options, markdown_input, path) and (cache->find(path) == nullptr))
+			paths.push_back(std::move(path));
+	}
+	if (paths.size() < 2)
+		return; // Converting it where it is included costs the same
+	std::atomic<std::size_t> next_path_indx(0);
+	const auto convert_paths = [&options, &paths, &next_path_indx, cache](){
+		conversion_stats = options.stats;
+		while(true){
+			const std::size_t i = next_path_indx.fetch_add(1, std::memory_order_relaxed);
+			if (i >= paths.size())
+				return;
+			ConversionError error;
+			std::unique_ptr<ChildCache::Entry> entry = convert_child(options, paths[i], error);
+			if (likely(not error))
+				cache->add(entry);
+		}
+	};
+	// The threads are shared by every document being converted - including the children being converted ahead, which may have children of their own - so that they do not multiply
+	std::vector<std::thread> threads;
+	while(threads.size()+1 < paths.size()){
+		if (cache->n_threads.fetch_add(1, std::memory_order_relaxed) >= cache->max_threads){
+			cache->n_threads.fetch_sub(1, std::memory_order_relaxed);
+			break;
+		}
+		threads.emplace_back(convert_paths);
+	}
+	convert_paths();
+	for (std::thread& thread : threads)
+		thread.join();
+	cache->n_threads.fetch_sub(threads.size(), std::memory_order_relaxed);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "md_to_html.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <time.h>
+#include <sys/types.h>
+
+
+constexpr std::size_t CHILD_CACHE_MAX_SZ = 1024*1024*256; // Of the HTML of children held. Beyond this, those not yet cached are converted every time they are included.
+constexpr std::size_t CHILD_OUTPUT_BUF_SZ = 1024*256; // The output buffer of each child starts this small, as a book can have hundreds of them
+constexpr std::string_view CHILD_CHUNK_OPENING = "```{r child = '"; // Then the path, relative to the directory of the including document, then "'}", then the chunk's closing "```" on the next line
+
+
+struct ChildCache {
+	// The HTML of each child document, by its real path, so that a child included several times - by one document, or by several in batch mode - is converted once. Shared by concurrent conversions.
+	// Entries are never removed, as the output of a document being converted may refer to them. A child which has since been modified - or any of whose own children has - is cached anew. A child which cannot be converted is not cached, so that it is reported by every document including it.
+	struct Entry {
+		std::string path;
+		std::string html;
+		struct timespec mtime;
+		off_t sz;
+		std::vector<const Entry*> children; // Those it includes. nullptr for any which was not cached, so that it is never current.
+	};
+	std::mutex mutex;
+	std::unordered_map<std::string_view, const Entry*> current; // Keyed by their paths
+	std::vector<std::unique_ptr<Entry>> entries;
+	std::size_t n_bytes;
+	std::atomic<unsigned> n_threads; // Converting children ahead of the documents including them
+	const unsigned max_threads;
+
+	explicit ChildCache(const unsigned _max_threads);
+
+	const Entry* find(const std::string& path); // nullptr unless it is cached, and is current
+	const Entry* add(std::unique_ptr<Entry>& entry); // nullptr if the cache is full, otherwise the cached entry of its path - which is another thread's if that thread added it meanwhile
+};
+
+
+struct ChildInclusion {
+	// A child document being converted, as a link in the chain of documents including it, so that a cycle of inclusions is detected
+	const char* path; // Real
+	const ChildInclusion* parent; // nullptr if it is included by the top-level document
+	std::vector<const ChildCache::Entry*>* children; // Of its cache entry, to which those it includes are added
+};
+
+
+bool include_child(const ConversionOptions& options,  const MarkdownInput& markdown_input,  HtmlOutput& html_output,  char*& dest_itr,  const std::string_view relative_path,  ConversionError& error); // Writes the HTML of a child document, converting it unless it is cached. Returns false, setting error, if it cannot be.
+void convert_children_ahead(const ConversionOptions& options,  const MarkdownInput& markdown_input); // Converts the children which the window of markdown_input includes - and which are not yet cached - concurrently, on up to ChildCache::max_threads threads, so that they are cached by the time they are included
@@ -0,0 +1,108 @@
+#include "daemon.h"
+
+#include <compsky/macros/likely.hpp>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+
+static
+bool read_stdin(std::string& markdown){
+	char buf[1024*64];
+	while(true){
+		const ssize_t n = read(0, buf, sizeof(buf));
+		if (n > 0)
+			markdown.append(buf, n);
+		else if (n == 0)
+			return true;
+		else if (errno != EINTR)
+			return false;
+	}
+}
+
+int main(int argc,  const char* const* argv){
+	std::string request_options;
+	bool any_errors = false;
+	++argv;
+	--argc;
+	while((argc != 0) and (argv[0][0] == '-') and (argv[0][1] != 0) and (argv[0][2] == 0)){
+		switch(argv[0][1]){
+			case 'b':
+				if (not request_options.empty())
+					request_options += ',';
+				request_options += "b=";
+				request_options += *(++argv);
+				--argc;
+				break;
+			case 'c':
+				if (not request_options.empty())
+					request_options += ',';
+				request_options += 'c';
+				break;
+			default:
+				any_errors = true;
+				break;
+		}
+		++argv;
+		--argc;
+	}
+	if (unlikely(any_errors or (argc < 1) or (argc > 2))){
+		constexpr const char* errmsg =
+			"USAGE: [[OPTIONS]] [/path/to/socket] [/path/to/file.rmd]?\n"
+			"	Has the daemon listening on the socket (md_to_html -D) convert the file, and writes the HTML to stdout\n"
+			"	Without a file, or if it is -, the markdown is read from stdin and sent to the daemon\n"
+			"OPTIONS:\n"
+			"	-b BLOCKQUOTE_TAGNAME\n"
+			"	-c\n"
+			"		As for md_to_html\n"
+		;
+		write(2, errmsg, strlen(errmsg));
+		return 1;
+	}
+	const char* const request_options_str = request_options.empty() ? "-" : request_options.c_str();
+	const int fd = connect_to_daemon(argv[0]);
+	if (unlikely(fd == -1))
+		return 1;
+	bool is_sent;
+	if ((argc == 1) or (strcmp(argv[1], "-") == 0)){
+		std::string markdown;
+		if (unlikely(not read_stdin(markdown))){
+			fprintf(stderr, "ERROR: Cannot read stdin\n");
+			return 1;
+		}
+		is_sent = send_markdown_request(fd, request_options_str, markdown);
+	} else {
+		// The daemon may have a different working directory
+		char path[PATH_MAX];
+		if (unlikely(realpath(argv[1], path) == nullptr)){
+			fprintf(stderr, "ERROR: Cannot resolve %s\n", argv[1]);
+			return 1;
+		}
+		is_sent = send_path_request(fd, request_options_str, path);
+	}
+	std::unique_ptr<SocketReader> reader(new SocketReader(fd));
+	bool is_ok = false;
+	std::string body;
+	if (unlikely(not (is_sent and read_response(*reader, is_ok, body)))){
+		fprintf(stderr, "ERROR: No response from the daemon\n");
+		return 1;
+	}
+	close(fd);
+	if (unlikely(not is_ok)){
+		fprintf(stderr, "ERROR: %s\n", body.c_str());
+		return 1;
+	}
+	for (std::size_t n_written = 0;  n_written < body.size();  ){
+		const ssize_t n = write(1, body.data() + n_written, body.size() - n_written);
+		if (n > 0)
+			n_written += n;
+		else if (errno != EINTR)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,256 @@
+#include "compress.h"
+
+#include <compsky/macros/likely.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+bool CompressionOptions::parse(const char* str){
+	while(true){
+		bool* is_enabled;
+		int* level;
+		if (strncmp(str, "gz", 2) == 0){
+			is_enabled = &this->is_gzip;
+			level = &this->gzip_level;
+			str += 2;
+		} else if (strncmp(str, "zst", 3) == 0){
+#ifndef MD_TO_HTML_ZSTD
+			fprintf(stderr, "ERROR: Built without zstd\n");
+			return false;
+#endif
+			is_enabled = &this->is_zstd;
+			level = &this->zstd_level;
+			str += 3;
+		} else {
+			return false;
+		}
+		*is_enabled = true;
+		if (*str == ':'){
+			char* level_end;
+			*level = strtol(str+1, &level_end, 10);
+			if (unlikely(level_end == str+1))
+				return false;
+			str = level_end;
+		}
+		if ((level == &this->gzip_level) and unlikely((*level < Z_DEFAULT_COMPRESSION) or (*level > Z_BEST_COMPRESSION))){
+			fprintf(stderr, "ERROR: gzip level must be 0 to 9\n");
+			return false;
+		}
+		if (*str == 0)
+			return true;
+		if (*str != ',')
+			return false;
+		++str;
+	}
+}
+
+
+CompressionPipeline::CompressionPipeline(const CompressionOptions& _options)
+: options(_options)
+, n_queued_chunks(0)
+, is_stopping(false)
+, any_errors(false)
+, gzip_fd(-1)
+, zstd_fd(-1)
+, gzip_stream{}
+#ifdef MD_TO_HTML_ZSTD
+, zstd_ctx(nullptr)
+#endif
+, out_buf(reinterpret_cast<char*>(malloc(COMPRESSION_OUT_BUF_SZ)))
+{
+	// 16 added to the window bits gives a gzip header and trailer, rather than zlib's
+	if (this->options.is_gzip and unlikely(deflateInit2(&this->gzip_stream, this->options.gzip_level, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)){
+		free(this->out_buf);
+		this->out_buf = nullptr;
+	}
+#ifdef MD_TO_HTML_ZSTD
+	if (this->options.is_zstd){
+		this->zstd_ctx = ZSTD_createCCtx();
+		if (unlikely((this->zstd_ctx == nullptr) or ZSTD_isError(ZSTD_CCtx_setParameter(this->zstd_ctx, ZSTD_c_compressionLevel, this->options.zstd_level)))){
+			free(this->out_buf);
+			this->out_buf = nullptr;
+		}
+	}
+#endif
+	if (likely(this->out_buf != nullptr))
+		this->thread = std::thread(&CompressionPipeline::run, this);
+}
+
+CompressionPipeline::~CompressionPipeline(){
+	this->wait();
+	if (this->options.is_gzip)
+		deflateEnd(&this->gzip_stream);
+#ifdef MD_TO_HTML_ZSTD
+	ZSTD_freeCCtx(this->zstd_ctx);
+#endif
+	free(this->out_buf);
+}
+
+bool CompressionPipeline::wait(){
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->is_stopping = true;
+	}
+	this->is_nonempty.notify_one();
+	if (this->thread.joinable())
+		this->thread.join();
+	return not this->any_errors;
+}
+
+void CompressionPipeline::begin(const char* const output_path){
+	this->push(Message::open_document, output_path);
+}
+
+void CompressionPipeline::end(){
+	if (not this->chunk.empty())
+		this->push(Message::data);
+	this->push(Message::close_document);
+}
+
+void CompressionPipeline::push(const Message::Kind kind,  const char* const output_path){
+	std::unique_lock<std::mutex> lock(this->mutex);
+	if (kind == Message::data)
+		this->is_not_full.wait(lock, [this](){
+			return (this->n_queued_chunks < COMPRESSION_MAX_QUEUED);
+		});
+	Message& msg = this->queue.emplace_back();
+	msg.kind = kind;
+	if (kind == Message::data){
+		++this->n_queued_chunks;
+		msg.contents.swap(this->chunk);
+		if (not this->spare_chunks.empty()){
+			this->chunk.swap(this->spare_chunks.back());
+			this->spare_chunks.pop_back();
+		}
+	} else if (output_path != nullptr){
+		msg.contents = output_path;
+	}
+	lock.unlock();
+	this->is_nonempty.notify_one();
+}
+
+void CompressionPipeline::run(){
+	while(true){
+		Message msg;
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->is_nonempty.wait(lock, [this](){
+				return this->is_stopping or not this->queue.empty();
+			});
+			if (this->queue.empty())
+				return;
+			msg = std::move(this->queue.front());
+			this->queue.pop_front();
+		}
+		switch(msg.kind){
+			case Message::open_document:
+				this->open_outputs(msg.contents);
+				break;
+			case Message::data:
+				this->compress(msg.contents, false);
+				msg.contents.clear();
+				{
+					std::lock_guard<std::mutex> lock(this->mutex);
+					this->spare_chunks.push_back(std::move(msg.contents));
+					--this->n_queued_chunks;
+				}
+				this->is_not_full.notify_one();
+				break;
+			case Message::close_document:
+				this->compress(std::string(), true);
+				this->close_outputs();
+				break;
+		}
+	}
+}
+
+static
+int open_output(const std::string& path){
+	const int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (unlikely(fd == -1))
+		fprintf(stderr, "ERROR: Cannot open %s: %s\n", path.c_str(), strerror(errno));
+	return fd;
+}
+
+void CompressionPipeline::open_outputs(const std::string& output_path){
+	if (this->options.is_gzip){
+		this->gzip_path = output_path + ".gz";
+		this->gzip_fd = open_output(this->gzip_path);
+		deflateReset(&this->gzip_stream);
+	}
+#ifdef MD_TO_HTML_ZSTD
+	if (this->options.is_zstd){
+		this->zstd_path = output_path + ".zst";
+		this->zstd_fd = open_output(this->zstd_path);
+		ZSTD_CCtx_reset(this->zstd_ctx, ZSTD_reset_session_only);
+	}
+#endif
+	if (unlikely((this->options.is_gzip and (this->gzip_fd == -1)) or (this->options.is_zstd and (this->zstd_fd == -1))))
+		this->any_errors = true;
+}
+
+bool CompressionPipeline::write_out(const int fd,  const std::size_t n,  const std::string& path){
+	const char* itr = this->out_buf;
+	const char* const end = this->out_buf + n;
+	while(itr != end){
+		const ssize_t n_written = write(fd, itr, end - itr);
+		if (likely(n_written > 0)){
+			itr += n_written;
+		} else if (not ((n_written == -1) and (errno == EINTR))){
+			fprintf(stderr, "ERROR: Cannot write %s: %s\n", path.c_str(), strerror(errno));
+			this->any_errors = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+void CompressionPipeline::compress(const std::string& data,  const bool is_last){
+	if (this->gzip_fd != -1){
+		this->gzip_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+		this->gzip_stream.avail_in = data.size();
+		do {
+			this->gzip_stream.next_out = reinterpret_cast<Bytef*>(this->out_buf);
+			this->gzip_stream.avail_out = COMPRESSION_OUT_BUF_SZ;
+			deflate(&this->gzip_stream, is_last ? Z_FINISH : Z_NO_FLUSH);
+			if (unlikely(not this->write_out(this->gzip_fd, COMPRESSION_OUT_BUF_SZ - this->gzip_stream.avail_out, this->gzip_path))){
+				close(this->gzip_fd);
+				this->gzip_fd = -1;
+				break;
+			}
+		} while(this->gzip_stream.avail_out == 0);
+	}
+#ifdef MD_TO_HTML_ZSTD
+	if (this->zstd_fd != -1){
+		ZSTD_inBuffer in = {data.data(), data.size(), 0};
+		while(true){
+			ZSTD_outBuffer out = {this->out_buf, COMPRESSION_OUT_BUF_SZ, 0};
+			const std::size_t n_remaining = ZSTD_compressStream2(this->zstd_ctx, &out, &in, is_last ? ZSTD_e_end : ZSTD_e_continue);
+			if (unlikely(ZSTD_isError(n_remaining))){
+				fprintf(stderr, "ERROR: Cannot compress %s: %s\n", this->zstd_path.c_str(), ZSTD_getErrorName(n_remaining));
+				this->any_errors = true;
+			}
+			if (unlikely(ZSTD_isError(n_remaining) or not this->write_out(this->zstd_fd, out.pos, this->zstd_path))){
+				close(this->zstd_fd);
+				this->zstd_fd = -1;
+				break;
+			}
+			if (is_last ? (n_remaining == 0) : (in.pos == in.size))
+				break;
+		}
+	}
+#endif
+}
+
+void CompressionPipeline::close_outputs(){
+	if (this->gzip_fd != -1)
+		close(this->gzip_fd);
+	if (this->zstd_fd != -1)
+		close(this->zstd_fd);
+	this->gzip_fd = -1;
+	this->zstd_fd = -1;
+}
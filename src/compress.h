@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+#ifdef MD_TO_HTML_ZSTD
+# include <zstd.h>
+#endif
+
+
+constexpr std::size_t COMPRESSION_CHUNK_SZ = 1024*1024; // What is written is handed to the compressing thread in chunks of about this size
+constexpr std::size_t COMPRESSION_MAX_QUEUED = 8; // Chunks. Beyond this, the converting thread waits for the compressing thread, so that memory use is bounded when compressing is the slower.
+constexpr std::size_t COMPRESSION_OUT_BUF_SZ = 1024*256;
+
+
+struct CompressionOptions {
+	// Which compressed copies of the HTML are written next to it, e.g. foo.html.gz and foo.html.zst for foo.html
+	bool is_gzip;
+	bool is_zstd;
+	int gzip_level;
+	int zstd_level;
+
+	CompressionOptions()
+	: is_gzip(false)
+	, is_zstd(false)
+	, gzip_level(Z_DEFAULT_COMPRESSION)
+	, zstd_level(3)
+	{}
+
+	bool any() const {
+		return (this->is_gzip or this->is_zstd);
+	}
+	bool parse(const char* str); // A comma-separated list of gz or zst, each optionally followed by :LEVEL, e.g. "gz:9,zst:19"
+};
+
+
+struct CompressionPipeline {
+	// Compresses what an HtmlOutput writes on a thread of its own, so that compressing a document overlaps with converting it - and, in batch mode, with converting the next
+	struct Message {
+		enum Kind : unsigned char {
+			open_document,
+			data,
+			close_document
+		};
+		Kind kind;
+		std::string contents; // The output path of the HTML, or the data
+	};
+	const CompressionOptions options;
+	std::mutex mutex;
+	std::condition_variable is_nonempty;
+	std::condition_variable is_not_full;
+	std::deque<Message> queue;
+	std::vector<std::string> spare_chunks; // Returned by the compressing thread, so that their allocations are reused
+	std::size_t n_queued_chunks;
+	bool is_stopping;
+	std::atomic<bool> any_errors;
+	std::string chunk; // Being filled by the converting thread
+
+	// Only used by the compressing thread
+	std::string gzip_path;
+	std::string zstd_path;
+	int gzip_fd;
+	int zstd_fd;
+	z_stream gzip_stream;
+#ifdef MD_TO_HTML_ZSTD
+	ZSTD_CCtx* zstd_ctx;
+#endif
+	char* out_buf;
+
+	std::thread thread;
+
+	explicit CompressionPipeline(const CompressionOptions& _options);
+	~CompressionPipeline();
+
+	bool is_null() const {
+		return (this->out_buf == nullptr);
+	}
+
+	// Called by the converting thread
+	void begin(const char* const output_path);
+	void add(const char* data,  std::size_t n){
+		while(true){
+			const std::size_t n_taken = std::min(n, COMPRESSION_CHUNK_SZ - this->chunk.size());
+			this->chunk.append(data, n_taken);
+			if (this->chunk.size() < COMPRESSION_CHUNK_SZ)
+				return;
+			this->push(Message::data);
+			data += n_taken;
+			n -= n_taken;
+		}
+	}
+	void end(); // Does not wait for the document to be compressed: errors are reported by the compressing thread, and set any_errors
+	void push(const Message::Kind kind,  const char* const output_path = nullptr);
+	bool wait(); // Waits until everything queued has been compressed, and stops the compressing thread. Returns whether it was all written.
+
+	// Run by the compressing thread
+	void run();
+	void open_outputs(const std::string& output_path);
+	void compress(const std::string& data,  const bool is_last);
+	void close_outputs();
+	bool write_out(const int fd,  const std::size_t n,  const std::string& path);
+};
@@ -0,0 +1,271 @@
+#include "daemon.h"
+#include "md_to_html.h"
+#include "input.h"
+#include "output.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+extern bool IS_VERBOSE;
+
+
+struct ConnectionQueue {
+	// Connections with a request waiting. Each is taken by a worker for a single request, then watched again, so that an idle connection does not tie up a worker.
+	std::mutex mutex;
+	std::condition_variable is_nonempty;
+	std::deque<SocketReader*> connections;
+
+	void push(SocketReader* const connection){
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->connections.push_back(connection);
+		}
+		this->is_nonempty.notify_one();
+	}
+	SocketReader* pop(){
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->is_nonempty.wait(lock, [this](){
+			return not this->connections.empty();
+		});
+		SocketReader* const connection = this->connections.front();
+		this->connections.pop_front();
+		return connection;
+	}
+};
+
+struct DaemonWorker {
+	// Reused for every request the worker serves, so that once it has seen its largest document, a request allocates nothing
+	HtmlOutput html_output; // Held in memory, as the response begins with its size
+	char* markdown_buf; // INPUT_LOOKBACK_SZ zeroes, then the markdown of an inline request, then room for the sentinel
+	std::size_t markdown_buf_sz;
+
+	DaemonWorker()
+	: html_output(-1)
+	, markdown_buf(nullptr)
+	, markdown_buf_sz(0)
+	{}
+	~DaemonWorker(){
+		free(this->markdown_buf);
+	}
+
+	bool reserve_markdown(const std::size_t n){
+		if (INPUT_LOOKBACK_SZ + n + 1 <= this->markdown_buf_sz)
+			return true;
+		const std::size_t new_sz = std::max(2*this->markdown_buf_sz, INPUT_LOOKBACK_SZ + n + 1);
+		char* const new_buf = reinterpret_cast<char*>(realloc(this->markdown_buf, new_sz));
+		if (unlikely(new_buf == nullptr))
+			return false;
+		if (this->markdown_buf == nullptr)
+			memset(new_buf, 0, INPUT_LOOKBACK_SZ);
+		this->markdown_buf = new_buf;
+		this->markdown_buf_sz = new_sz;
+		return true;
+	}
+};
+
+
+static
+bool parse_request_options(char* itr,  ConversionOptions& options){
+	// Modifies the line in place, so that the blockquote tag name is NUL-terminated within it
+	if ((itr[0] == '-') and (itr[1] == 0))
+		return true;
+	while(true){
+		char* const comma = strchr(itr, ',');
+		if (comma != nullptr)
+			*comma = 0;
+		if ((itr[0] == 'c') and (itr[1] == 0))
+			options.include_comment_nodes = true;
+		else if ((itr[0] == 'n') and (itr[1] == 0))
+			options.is_numbering_headings = true;
+		else if ((itr[0] == 't') and (itr[1] == 0))
+			options.is_adding_toc = true;
+		else if ((itr[0] == 'm') and (itr[1] == '=') and (itr[2] >= '0') and (itr[2] <= '2') and (itr[3] == 0))
+			options.minify_level = itr[2] - '0';
+		else if ((itr[0] == 'b') and (itr[1] == '=') and (itr[2] != 0))
+			options.blockquote_tagname = itr + 2;
+		else
+			return false;
+		if (comma == nullptr)
+			return true;
+		itr = comma + 1;
+	}
+}
+
+static
+bool send_response(const int fd,  const bool is_ok,  const char* const prefix,  const std::string_view body){
+	// The line, an optional prefix of the body, and the body, in as few writes as possible
+	char line[64];
+	const std::size_t prefix_len = strlen(prefix);
+	struct iovec iov[3] = {
+		{line, static_cast<std::size_t>(snprintf(line, sizeof(line), "%s %lu\n", is_ok ? "ok" : "error", prefix_len + body.size()))},
+		{const_cast<char*>(prefix), prefix_len},
+		{const_cast<char*>(body.data()), body.size()}
+	};
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 3;
+	while(msg.msg_iovlen != 0){
+		ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+		if (unlikely(n == -1)){
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		while((msg.msg_iovlen != 0) and (static_cast<std::size_t>(n) >= msg.msg_iov->iov_len)){
+			n -= msg.msg_iov->iov_len;
+			++msg.msg_iov;
+			--msg.msg_iovlen;
+		}
+		if (msg.msg_iovlen != 0){
+			msg.msg_iov->iov_base = reinterpret_cast<char*>(msg.msg_iov->iov_base) + n;
+			msg.msg_iov->iov_len -= n;
+		}
+	}
+	return true;
+}
+
+static
+bool serve_request(const ConversionOptions& options,  DaemonWorker& worker,  SocketReader& reader){
+	// Returns whether the connection is still open
+	const int fd = reader.fd;
+	char* const line = reader.read_line();
+	if (line == nullptr)
+		return false;
+	// kind, options and argument, separated by single spaces. A path may itself contain spaces.
+	char* const options_str = strchr(line, ' ');
+	char* const arg = (options_str == nullptr) ? nullptr : strchr(options_str+1, ' ');
+	ConversionOptions request_options = options;
+	if (unlikely((arg == nullptr) or (arg[1] == 0))){
+		send_response(fd, false, "Malformed request: ", line);
+		return false;
+	}
+	*options_str = 0;
+	*arg = 0;
+	if (unlikely(not parse_request_options(options_str+1, request_options))){
+		send_response(fd, false, "Unknown options: ", options_str+1);
+		return false;
+	}
+	const auto started_at = std::chrono::steady_clock::now();
+	ConversionError error;
+	if (strcmp(line, "path") == 0){
+		MarkdownInput markdown_input(arg+1, false);
+		error = md_to_html(request_options, markdown_input, worker.html_output);
+	} else if (strcmp(line, "markdown") == 0){
+		char* n_bytes_end;
+		const std::size_t n_bytes = strtoul(arg+1, &n_bytes_end, 10);
+		if (unlikely((*n_bytes_end != 0) or not worker.reserve_markdown(n_bytes))){
+			send_response(fd, false, "Cannot accept markdown of size ", arg+1);
+			return false;
+		}
+		if (unlikely(not reader.read_exactly(worker.markdown_buf + INPUT_LOOKBACK_SZ, n_bytes)))
+			return false;
+		MarkdownInput markdown_input("(inline markdown)", worker.markdown_buf, n_bytes);
+		error = md_to_html(request_options, markdown_input, worker.html_output);
+	} else {
+		send_response(fd, false, "Unknown request: ", line);
+		return false;
+	}
+	if (IS_VERBOSE)
+		fprintf(stderr, "Converted %s %s in %ldus\n", line, arg+1, (long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started_at).count());
+	return (likely(not error)) ? send_response(fd, true, "", worker.html_output.held()) : send_response(fd, false, error.name(), ": " + error.detail);
+}
+
+
+bool serve_daemon(const ConversionOptions& options,  const char* const socket_path,  const unsigned n_workers){
+	// Converts each request on one of n_workers threads, each with its own buffers. The options - and so the replacement table - are shared by all.
+	// This thread accepts connections, and waits for requests on them: a connection is given to a worker when it has a request, and is only watched again once the worker has answered it.
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (unlikely(strlen(socket_path) >= sizeof(addr.sun_path))){
+		fprintf(stderr, "ERROR: Socket path is too long: %s\n", socket_path);
+		return false;
+	}
+	strcpy(addr.sun_path, socket_path);
+	const int listen_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (unlikely(listen_fd == -1)){
+		fprintf(stderr, "ERROR: Cannot create socket: %s\n", strerror(errno));
+		return false;
+	}
+	unlink(socket_path); // Left behind by a previous daemon
+	if (unlikely((bind(listen_fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) != 0) or (listen(listen_fd, DAEMON_LISTEN_BACKLOG) != 0))){
+		fprintf(stderr, "ERROR: Cannot listen on %s: %s\n", socket_path, strerror(errno));
+		close(listen_fd);
+		return false;
+	}
+	const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event listen_event = {};
+	listen_event.events = EPOLLIN;
+	listen_event.data.ptr = nullptr;
+	if (unlikely((epoll_fd == -1) or (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) != 0))){
+		fprintf(stderr, "ERROR: Cannot wait for connections: %s\n", strerror(errno));
+		close(listen_fd);
+		return false;
+	}
+	ConnectionQueue queue;
+	std::vector<std::thread> workers;
+	for (unsigned i = 0;  i < n_workers;  ++i){
+		workers.emplace_back([&options, &queue, epoll_fd](){
+			DaemonWorker worker;
+			if (unlikely(worker.html_output.is_null())){
+				fprintf(stderr, "WARNING: Cannot allocate the output buffer of a worker\n");
+				return;
+			}
+			while(true){
+				SocketReader* const connection = queue.pop();
+				bool is_open = serve_request(options, worker, *connection);
+				while(is_open and connection->has_buffered())
+					is_open = serve_request(options, worker, *connection); // Pipelined
+				struct epoll_event event = {};
+				event.events = EPOLLIN|EPOLLONESHOT;
+				event.data.ptr = connection;
+				if (unlikely(not (is_open and (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) == 0)))){
+					close(connection->fd);
+					delete connection;
+				}
+			}
+		});
+	}
+	struct epoll_event events[64];
+	while(true){
+		const int n_events = epoll_wait(epoll_fd, events, 64, -1);
+		for (int i = 0;  i < n_events;  ++i){
+			if (events[i].data.ptr != nullptr){
+				queue.push(reinterpret_cast<SocketReader*>(events[i].data.ptr));
+				continue;
+			}
+			const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (unlikely(fd == -1)){
+				if ((errno != EINTR) and (errno != ECONNABORTED) and (errno != EAGAIN)){
+					// e.g. out of file descriptors, until some connections are closed
+					fprintf(stderr, "WARNING: Cannot accept connection: %s\n", strerror(errno));
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				}
+				continue;
+			}
+			SocketReader* const connection = new SocketReader(fd);
+			struct epoll_event event = {};
+			event.events = EPOLLIN|EPOLLONESHOT;
+			event.data.ptr = connection;
+			if (unlikely(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)){
+				close(fd);
+				delete connection;
+			}
+		}
+	}
+}
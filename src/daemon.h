@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+
+// The protocol, over a Unix domain stream socket. Any number of requests can be sent on a connection; each is answered in turn.
+// A request is a line, followed - for inline markdown - by the markdown itself:
+//	path OPTIONS /path/to/file.rmd\n
+//	markdown OPTIONS N_BYTES\n[N_BYTES of markdown]
+// OPTIONS is "-", or a comma-separated list of: c (include comment nodes), n (number the headings), t (add a table of contents), m=LEVEL (minify, as md_to_html -m), b=TAGNAME (the blockquote tag name)
+// A response is a line, followed by its body:
+//	ok N_BYTES\n[N_BYTES of HTML]
+//	error N_BYTES\n[N_BYTES of message]
+// After a malformed request, the daemon closes the connection.
+
+constexpr std::size_t DAEMON_MAX_LINE_SZ = 4096+64; // A path, plus the rest of the line
+constexpr int DAEMON_LISTEN_BACKLOG = 128;
+
+
+struct SocketReader {
+	// Buffers what is read from a connection, so that a request's line and its markdown are not read a byte at a time
+	int fd;
+	std::size_t begin;
+	std::size_t end;
+	char buf[1024*64];
+
+	explicit SocketReader(const int _fd)
+	: fd(_fd)
+	, begin(0)
+	, end(0)
+	{}
+
+	bool has_buffered() const {
+		return (this->begin != this->end);
+	}
+	char* read_line(); // The line, without its newline, terminated by a NUL in place of it. Valid until the next read. nullptr at the end of the connection, or if the line is longer than DAEMON_MAX_LINE_SZ.
+	bool read_exactly(char* dest,  std::size_t n);
+};
+
+bool send_all(const int fd,  const char* data,  std::size_t n); // To a socket
+
+int connect_to_daemon(const char* const socket_path); // -1 on error
+bool send_path_request(const int fd,  const char* const request_options,  const char* const path);
+bool send_markdown_request(const int fd,  const char* const request_options,  const std::string_view markdown);
+bool read_response(SocketReader& reader,  bool& is_ok,  std::string& body); // Returns false if the connection failed, or the response was malformed
+
+struct ConversionOptions;
+
+bool serve_daemon(const ConversionOptions& options,  const char* const socket_path,  const unsigned n_workers); // Only returns if it cannot start listening
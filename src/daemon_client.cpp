@@ -0,0 +1,122 @@
+#include "daemon.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+char* SocketReader::read_line(){
+	while(true){
+		char* const line = this->buf + this->begin;
+		char* const eol = reinterpret_cast<char*>(memchr(line, '\n', this->end - this->begin));
+		if (eol != nullptr){
+			*eol = 0;
+			this->begin = eol + 1 - this->buf;
+			return line;
+		}
+		if (unlikely(this->end - this->begin >= DAEMON_MAX_LINE_SZ))
+			return nullptr;
+		if (this->end == sizeof(this->buf)){
+			memmove(this->buf, line, this->end - this->begin);
+			this->end -= this->begin;
+			this->begin = 0;
+		}
+		const ssize_t n = read(this->fd, this->buf + this->end, sizeof(this->buf) - this->end);
+		if (n > 0)
+			this->end += n;
+		else if (not ((n == -1) and (errno == EINTR)))
+			return nullptr;
+	}
+}
+
+bool SocketReader::read_exactly(char* dest,  std::size_t n){
+	// What is already buffered is copied, and the rest is read directly into dest
+	const std::size_t n_buffered = std::min(n, this->end - this->begin);
+	memcpy(dest, this->buf + this->begin, n_buffered);
+	this->begin += n_buffered;
+	dest += n_buffered;
+	n -= n_buffered;
+	while(n != 0){
+		const ssize_t n_read = read(this->fd, dest, n);
+		if (n_read > 0){
+			dest += n_read;
+			n -= n_read;
+		} else if (not ((n_read == -1) and (errno == EINTR))){
+			return false;
+		}
+	}
+	return true;
+}
+
+
+bool send_all(const int fd,  const char* data,  std::size_t n){
+	while(n != 0){
+		const ssize_t n_written = send(fd, data, n, MSG_NOSIGNAL);
+		if (likely(n_written > 0)){
+			data += n_written;
+			n -= n_written;
+		} else if (not ((n_written == -1) and (errno == EINTR))){
+			return false;
+		}
+	}
+	return true;
+}
+
+int connect_to_daemon(const char* const socket_path){
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (unlikely(strlen(socket_path) >= sizeof(addr.sun_path))){
+		fprintf(stderr, "ERROR: Socket path is too long: %s\n", socket_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+	const int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (unlikely(fd == -1))
+		return -1;
+	if (unlikely(connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) != 0)){
+		fprintf(stderr, "ERROR: Cannot connect to %s: %s\n", socket_path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool send_path_request(const int fd,  const char* const request_options,  const char* const path){
+	char line[DAEMON_MAX_LINE_SZ];
+	const int n = snprintf(line, sizeof(line), "path %s %s\n", request_options, path);
+	if (unlikely((n < 0) or (static_cast<std::size_t>(n) >= sizeof(line))))
+		return false;
+	return send_all(fd, line, n);
+}
+
+bool send_markdown_request(const int fd,  const char* const request_options,  const std::string_view markdown){
+	char line[DAEMON_MAX_LINE_SZ];
+	const int n = snprintf(line, sizeof(line), "markdown %s %lu\n", request_options, markdown.size());
+	if (unlikely((n < 0) or (static_cast<std::size_t>(n) >= sizeof(line))))
+		return false;
+	return send_all(fd, line, n) and send_all(fd, markdown.data(), markdown.size());
+}
+
+bool read_response(SocketReader& reader,  bool& is_ok,  std::string& body){
+	const char* const line = reader.read_line();
+	if (unlikely(line == nullptr))
+		return false;
+	const char* n_bytes_str;
+	if (strncmp(line, "ok ", 3) == 0){
+		is_ok = true;
+		n_bytes_str = line + 3;
+	} else if (strncmp(line, "error ", 6) == 0){
+		is_ok = false;
+		n_bytes_str = line + 6;
+	} else {
+		return false;
+	}
+	body.resize(strtoul(n_bytes_str, nullptr, 10));
+	return reader.read_exactly(body.data(), body.size());
+}
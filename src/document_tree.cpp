@@ -0,0 +1,413 @@
+#include "document_tree.h"
+#include "md_to_html.h"
+#include "input.h"
+#include "output.h"
+#include "stats.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+
+static
+bool is_void_element(const std::string_view name){
+	// Those which have no closing tag
+	switch(name.size()){
+		case 2:
+			return ((name == "br") or (name == "hr"));
+		case 3:
+			return ((name == "img") or (name == "col") or (name == "wbr"));
+		case 4:
+			return ((name == "meta") or (name == "link") or (name == "area") or (name == "base"));
+		case 5:
+			return ((name == "input") or (name == "embed") or (name == "param") or (name == "track"));
+		case 6:
+			return (name == "source");
+		default:
+			return false;
+	}
+}
+
+
+static
+bool is_name_char(const char c){
+	return (
+		((c >= 'a') and (c <= 'z')) or
+		((c >= 'A') and (c <= 'Z')) or
+		((c >= '0') and (c <= '9')) or
+		(c == '-') or
+		(c == '_') or
+		(c == ':')
+	);
+}
+
+static
+const char* find_tag_end(const char* itr,  const char* const end){
+	// Returns the position just after the '>' which ends the tag, skipping those within quoted attribute values, or nullptr if there is none
+	char quote = 0;
+	for (;  itr != end;  ++itr){
+		if (quote != 0){
+			if (*itr == quote)
+				quote = 0;
+		} else if ((*itr == '"') or (*itr == '\'')){
+			quote = *itr;
+		} else if (*itr == '>'){
+			return itr + 1;
+		}
+	}
+	return nullptr;
+}
+
+static
+const char* find_str(const char* const itr,  const char* const end,  const std::string_view str){
+	const void* const found = memmem(itr, end-itr, str.data(), str.size());
+	return (found == nullptr) ? nullptr : reinterpret_cast<const char*>(found);
+}
+
+
+std::string_view DocumentTree::name_of(const uint32_t node_indx) const {
+	const std::string_view tag = this->view(this->nodes[node_indx].open);
+	std::size_t name_end = 1;
+	while((name_end < tag.size()) and is_name_char(tag[name_end]))
+		++name_end;
+	return tag.substr(1, name_end-1);
+}
+
+bool DocumentTree::is_named(const uint32_t node_indx,  const std::string_view name) const {
+	const std::string_view tag = this->view(this->nodes[node_indx].open);
+	return ((tag.size() > name.size() + 1) and (tag.substr(1, name.size()) == name) and not is_name_char(tag[name.size() + 1]));
+}
+
+DocumentSpan DocumentTree::generate(const std::string_view str){
+	const DocumentSpan span = {static_cast<uint32_t>(this->generated.size()), static_cast<uint32_t>(str.size()), 1};
+	this->generated += str;
+	return span;
+}
+
+uint32_t DocumentTree::add_node(const DocumentNode::Kind kind,  const uint32_t parent,  const DocumentSpan open){
+	// Appended as the last child of parent, unless parent is NO_NODE
+	const uint32_t indx = this->nodes.size();
+	this->nodes.push_back({kind, 0, parent, NO_NODE, NO_NODE, NO_NODE, open, {0, 0, 0}});
+	if (parent != NO_NODE){
+		DocumentNode& parent_node = this->nodes[parent];
+		if (parent_node.last_child == NO_NODE)
+			parent_node.first_child = indx;
+		else
+			this->nodes[parent_node.last_child].next_sibling = indx;
+		parent_node.last_child = indx;
+	}
+	return indx;
+}
+
+void DocumentTree::prepend_child(const uint32_t parent,  const uint32_t child){
+	DocumentNode& parent_node = this->nodes[parent];
+	this->nodes[child].parent = parent;
+	this->nodes[child].next_sibling = parent_node.first_child;
+	parent_node.first_child = child;
+	if (parent_node.last_child == NO_NODE)
+		parent_node.last_child = child;
+}
+
+bool DocumentTree::parse(const std::string_view _html){
+	// A closing tag closes the innermost open element of its name, and so any left open within it. A closing tag which matches none is text.
+	if (unlikely(_html.size() >= (1u << 31)))
+		return false;
+	this->html = _html;
+	this->nodes.clear();
+	this->generated.clear();
+	this->nodes.reserve(2*std::count(this->html.begin(), this->html.end(), '<') + 2); // An upper bound: each tag adds at most itself and the text after it. Pages of it which are not used are not faulted in.
+	this->add_node(DocumentNode::root, NO_NODE, {0, 0, 0});
+	this->open_elements.assign(1, 0);
+	const char* const begin = this->html.data();
+	const char* const end = begin + this->html.size();
+	const auto span_of = [begin](const char* const from,  const char* const to){
+		return DocumentSpan{static_cast<uint32_t>(from-begin), static_cast<uint32_t>(to-from), 0};
+	};
+	const auto add_text = [this, begin, &span_of](const char* const from,  const char* const to){
+		// Merged with the preceding text node, if it ends where this begins
+		const uint32_t parent = this->open_elements.back();
+		const uint32_t last_child = this->nodes[parent].last_child;
+		if ((last_child != NO_NODE) and (this->nodes[last_child].kind == DocumentNode::text) and (not this->nodes[last_child].open.is_generated) and (this->nodes[last_child].open.offset + this->nodes[last_child].open.len == static_cast<uint32_t>(from-begin)))
+			this->nodes[last_child].open.len += to-from;
+		else
+			this->add_node(DocumentNode::text, parent, span_of(from, to));
+	};
+	const char* itr = begin;
+	while(itr != end){
+		if (*itr != '<'){
+			const char* const lt = reinterpret_cast<const char*>(memchr(itr, '<', end-itr));
+			const char* const text_end = (lt == nullptr) ? end : lt;
+			add_text(itr, text_end);
+			itr = text_end;
+			continue;
+		}
+		if ((itr[1] == '!') or (itr[1] == '?')){
+			const char* tag_end = ((itr[1] == '!') and (itr[2] == '-') and (itr[3] == '-')) ? find_str(itr+4, end, "-->") : reinterpret_cast<const char*>(memchr(itr, '>', end-itr));
+			if (tag_end == nullptr)
+				tag_end = end;
+			else
+				tag_end += (*tag_end == '-') ? 3 : 1;
+			this->add_node(DocumentNode::raw, this->open_elements.back(), span_of(itr, tag_end));
+			itr = tag_end;
+			continue;
+		}
+		if (itr[1] == '/'){
+			const char* name_end = itr + 2;
+			while((name_end != end) and is_name_char(*name_end))
+				++name_end;
+			const char* const tag_end = find_tag_end(name_end, end);
+			const std::string_view name(itr+2, name_end-itr-2);
+			std::size_t depth = this->open_elements.size();
+			if ((tag_end != nullptr) and not name.empty())
+				while((--depth != 0) and not this->is_named(this->open_elements[depth], name));
+			if ((tag_end == nullptr) or (depth == 0)){
+				add_text(itr, itr+1);
+				++itr;
+				continue;
+			}
+			this->nodes[this->open_elements[depth]].close = span_of(itr, tag_end);
+			this->open_elements.resize(depth);
+			itr = tag_end;
+			continue;
+		}
+		const char* name_end = itr + 1;
+		while((name_end != end) and is_name_char(*name_end))
+			++name_end;
+		const char* const tag_end = (name_end == itr+1) ? nullptr : find_tag_end(name_end, end);
+		if (tag_end == nullptr){
+			add_text(itr, itr+1);
+			++itr;
+			continue;
+		}
+		const std::string_view name(itr+1, name_end-itr-1);
+		const uint32_t element = this->add_node(DocumentNode::element, this->open_elements.back(), span_of(itr, tag_end));
+		if ((name.size() == 2) and ((name[0] == 'h') or (name[0] == 'H')) and (name[1] >= '1') and (name[1] <= '6'))
+			this->nodes[element].heading_level = name[1] - '0';
+		itr = tag_end;
+		if (tag_end[-2] == '/')
+			continue;
+		if ((name == "script") or (name == "style")){
+			// Their contents are not HTML
+			const std::string closing_tag = "</" + std::string(name);
+			const char* const contents_end = find_str(itr, end, closing_tag);
+			const char* const close_end = (contents_end == nullptr) ? nullptr : find_tag_end(contents_end, end);
+			if (close_end == nullptr){
+				this->add_node(DocumentNode::raw, element, span_of(itr, end));
+				itr = end;
+				continue;
+			}
+			if (contents_end != itr)
+				this->add_node(DocumentNode::raw, element, span_of(itr, contents_end));
+			this->nodes[element].close = span_of(contents_end, close_end);
+			itr = close_end;
+			continue;
+		}
+		if (not is_void_element(name))
+			this->open_elements.push_back(element);
+	}
+	this->open_elements.clear();
+	return true;
+}
+
+void DocumentTree::render(HtmlOutput& html_output,  char*& dest_itr) const {
+	// Depth first, without a stack: after a node's last child, its closing tag is written and the walk continues from its next sibling, or its parent's
+	uint32_t indx = this->nodes[0].first_child;
+	while(indx != NO_NODE){
+		const std::string_view open = this->view(this->nodes[indx].open);
+		html_output.append(dest_itr, open.data(), open.size());
+		if (this->nodes[indx].first_child != NO_NODE){
+			indx = this->nodes[indx].first_child;
+			continue;
+		}
+		while(indx != 0){
+			const std::string_view close = this->view(this->nodes[indx].close);
+			html_output.append(dest_itr, close.data(), close.size());
+			if (this->nodes[indx].next_sibling != NO_NODE){
+				indx = this->nodes[indx].next_sibling;
+				break;
+			}
+			indx = this->nodes[indx].parent;
+		}
+		if (indx == 0)
+			break;
+	}
+}
+
+void DocumentTree::append_text_content(const uint32_t node_indx,  std::string& str,  const bool is_including_generated) const {
+	uint32_t indx = this->nodes[node_indx].first_child;
+	while(indx != NO_NODE){
+		const DocumentNode& node = this->nodes[indx];
+		if ((node.kind == DocumentNode::text) and (is_including_generated or not node.open.is_generated))
+			str += this->view(node.open);
+		if ((node.kind == DocumentNode::element) and (node.first_child != NO_NODE)){
+			indx = node.first_child;
+			continue;
+		}
+		while((indx != node_indx) and (this->nodes[indx].next_sibling == NO_NODE))
+			indx = this->nodes[indx].parent;
+		indx = (indx == node_indx) ? NO_NODE : this->nodes[indx].next_sibling;
+	}
+}
+
+void DocumentTree::number_headings(){
+	unsigned top_level = 7;
+	for (const DocumentNode& node : this->nodes)
+		if ((node.heading_level != 0) and (node.heading_level < top_level))
+			top_level = node.heading_level;
+	unsigned counts[6] = {};
+	std::string number;
+	const uint32_t n_nodes = this->nodes.size(); // Not those added here
+	for (uint32_t i = 0;  i < n_nodes;  ++i){
+		const unsigned level = this->nodes[i].heading_level;
+		if (level == 0)
+			continue;
+		++counts[level-1];
+		for (unsigned j = level;  j < 6;  ++j)
+			counts[j] = 0;
+		number = "<span class=\"header-section-number\">";
+		for (unsigned j = top_level-1;  j < level;  ++j){
+			if (j != top_level-1)
+				number += '.';
+			number += std::to_string(counts[j]);
+		}
+		number += "</span> ";
+		this->prepend_child(i, this->add_node(DocumentNode::text, NO_NODE, this->generate(number)));
+	}
+}
+
+static
+void append_slug(const std::string_view text,  std::string& slug){
+	// Letters and digits, lowercased, with the runs of anything else between them replaced by a '-'. Non-ASCII bytes are kept, as they are valid in an id. Entities, such as &amp;, are dropped.
+	bool is_after_separator = false;
+	for (std::size_t i = 0;  i < text.size();  ++i){
+		char c = text[i];
+		if (c == '&'){
+			const std::size_t semicolon = text.find(';', i);
+			if (semicolon != std::string_view::npos){
+				i = semicolon;
+				is_after_separator = true;
+				continue;
+			}
+		}
+		if ((c >= 'A') and (c <= 'Z'))
+			c += 'a' - 'A';
+		if (((c >= 'a') and (c <= 'z')) or ((c >= '0') and (c <= '9')) or (static_cast<unsigned char>(c) >= 0x80)){
+			if (is_after_separator and not slug.empty())
+				slug += '-';
+			slug += c;
+			is_after_separator = false;
+		} else {
+			is_after_separator = true;
+		}
+	}
+}
+
+void DocumentTree::add_table_of_contents(){
+	uint32_t body = NO_NODE;
+	for (uint32_t i = 0;  (i < this->nodes.size()) and (body == NO_NODE);  ++i)
+		if ((this->nodes[i].kind == DocumentNode::element) and (this->name_of(i) == "body"))
+			body = i;
+	if (body == NO_NODE)
+		return;
+	std::string toc = "<nav id=\"TOC\">\n";
+	std::vector<unsigned> levels; // Of the lists which are open, each with an <li> open
+	std::unordered_set<std::string> ids;
+	std::string text;
+	std::string id;
+	const uint32_t n_nodes = this->nodes.size();
+	for (uint32_t i = 0;  i < n_nodes;  ++i){
+		const unsigned level = this->nodes[i].heading_level;
+		if (level == 0)
+			continue;
+		const std::string_view open_tag = this->view(this->nodes[i].open);
+		const std::size_t id_pos = open_tag.find(" id=\"");
+		id.clear();
+		if (id_pos != std::string_view::npos){
+			id = open_tag.substr(id_pos + 5, open_tag.find('"', id_pos + 5) - id_pos - 5);
+		} else {
+			text.clear();
+			this->append_text_content(i, text, false);
+			append_slug(text, id);
+			if (id.empty())
+				id = "section";
+			if (ids.count(id) != 0){
+				const std::size_t id_len = id.size();
+				for (unsigned n = 1;  ids.count(id) != 0;  ++n){
+					id.resize(id_len);
+					id += '-';
+					id += std::to_string(n);
+				}
+			}
+			this->nodes[i].open = this->generate(std::string(open_tag.substr(0, open_tag.size()-1)) + " id=\"" + id + "\">");
+		}
+		ids.insert(id);
+		while((levels.size() > 1) and (level < levels.back())){
+			toc += "</li>\n</ul>\n";
+			levels.pop_back();
+		}
+		if (levels.empty()){
+			toc += "<ul>\n";
+			levels.push_back(level);
+		} else if (level > levels.back()){
+			toc += "\n<ul>\n";
+			levels.push_back(level);
+		} else {
+			toc += "</li>\n";
+			levels.back() = level;
+		}
+		text.clear();
+		this->append_text_content(i, text, true);
+		toc += "<li><a href=\"#";
+		toc += id;
+		toc += "\">";
+		toc += text;
+		toc += "</a>";
+	}
+	if (levels.empty())
+		return;
+	for (std::size_t i = 0;  i < levels.size();  ++i)
+		toc += "</li>\n</ul>\n";
+	toc += "</nav>\n";
+	this->prepend_child(body, this->add_node(DocumentNode::raw, NO_NODE, this->generate(toc)));
+}
+
+
+ConversionError md_to_html_via_tree(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output){
+	// Nothing is written if an error is returned
+	ConversionOptions direct_options = options;
+	direct_options.is_via_tree = false;
+	direct_options.is_numbering_headings = false;
+	direct_options.is_adding_toc = false;
+	direct_options.minify_level = 0; // The tree is parsed from what md_to_html writes, and minified as it is rendered
+	// Sized from a mapped input, so that a large document's output is not copied each time it outgrows the buffer. Untouched pages of it cost nothing.
+	// Huge pages only for a large document, as each is zeroed in its entirety when first touched
+	std::size_t held_sz = std::max(4*OUTPUT_SLACK_SZ, markdown_input.mapped_sz + markdown_input.mapped_sz/4 + OUTPUT_SLACK_SZ);
+	if (held_sz >= OUTPUT_BUF_SZ)
+		held_sz = (held_sz + HUGE_PAGE_SZ - 1) & ~(HUGE_PAGE_SZ - 1);
+	HtmlOutput held_output(-1, held_sz);
+	if (unlikely(held_output.is_null()))
+		return md_to_html(direct_options, markdown_input, html_output);
+	const ConversionError error = md_to_html(direct_options, markdown_input, held_output);
+	if (unlikely(error))
+		return error;
+	if (unlikely(conversion_stats != nullptr))
+		conversion_stats->n_output_bytes.fetch_sub(held_output.n_held, std::memory_order_relaxed); // They are counted when written to html_output
+	html_output.minifier.level = options.minify_level;
+	char* dest_itr = html_output.begin();
+	{
+		PhaseTimer timer(&ConversionStats::tree_ns, &ConversionStats::tree_counters);
+		DocumentTree tree;
+		if (likely(tree.parse(held_output.held()))){
+			if (options.is_numbering_headings)
+				tree.number_headings();
+			if (options.is_adding_toc)
+				tree.add_table_of_contents();
+			tree.render(html_output, dest_itr);
+		} else {
+			html_output.append(dest_itr, held_output.held().data(), held_output.n_held);
+		}
+	}
+	html_output.finish(dest_itr);
+	return error;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+struct HtmlOutput;
+struct MarkdownInput;
+struct ConversionOptions;
+struct ConversionError;
+
+
+constexpr uint32_t NO_NODE = UINT32_MAX;
+
+
+struct DocumentSpan {
+	// Of the converted HTML, or - for what transforms add - of DocumentTree::generated
+	uint32_t offset;
+	uint32_t len : 31;
+	uint32_t is_generated : 1;
+};
+
+struct DocumentNode {
+	enum Kind : unsigned char {
+		root,
+		element,
+		text,
+		raw // A comment, doctype, or the contents of a <script> or <style>
+	};
+	Kind kind;
+	unsigned char heading_level; // 1 to 6 for <h1> to <h6>, otherwise 0
+	uint32_t parent;
+	uint32_t first_child;
+	uint32_t last_child;
+	uint32_t next_sibling;
+	DocumentSpan open; // The opening tag, or the text
+	DocumentSpan close; // The closing tag, if any
+};
+
+struct DocumentTree {
+	// The converted HTML as a tree, so that it can be transformed without converting the markdown again, and then rendered
+	// The nodes are a single array, linking to each other by index, and their text is spans of the HTML rather than copies of it. So rendering an unchanged tree gives back exactly the HTML it was parsed from.
+	std::string_view html;
+	std::vector<DocumentNode> nodes; // nodes[0] is the root
+	std::string generated;
+	std::vector<uint32_t> open_elements; // Only while parsing
+
+	bool parse(const std::string_view _html); // Returns false if the HTML is too large to be spanned
+	void render(HtmlOutput& html_output,  char*& dest_itr) const;
+
+	std::string_view view(const DocumentSpan span) const {
+		return std::string_view(((span.is_generated) ? this->generated.data() : this->html.data()) + span.offset, span.len);
+	}
+	std::string_view name_of(const uint32_t node_indx) const; // Of an element
+	bool is_named(const uint32_t node_indx,  const std::string_view name) const; // Cheaper than comparing name_of
+	DocumentSpan generate(const std::string_view str);
+	uint32_t add_node(const DocumentNode::Kind kind,  const uint32_t parent,  const DocumentSpan open);
+	void prepend_child(const uint32_t parent,  const uint32_t child);
+	void append_text_content(const uint32_t node_indx,  std::string& str,  const bool is_including_generated) const; // Of its descendants, as HTML
+
+	// Transforms
+	void number_headings(); // Prefixes each heading with its section number, e.g. 2.1, counting from the highest level used
+	void add_table_of_contents(); // Gives each heading an id, and adds a nested list of links to them at the start of the <body>
+};
+
+ConversionError md_to_html_via_tree(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output); // md_to_html, with the output held in memory and parsed into a DocumentTree, transformed as options say, and rendered to html_output
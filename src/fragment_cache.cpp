@@ -0,0 +1,193 @@
+#include "fragment_cache.h"
+#include "children.h"
+#include "md_to_html.h"
+#include "output.h"
+#include "replacements.h"
+
+#include <compsky/utils/ptrdiff.hpp>
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+constexpr uint64_t FRAGMENT_CACHE_VERSION = 1; // Increment whenever a change to md_to_html changes its output
+constexpr std::size_t FRAGMENT_NAME_LEN = 16; // Hex digits of the key
+
+
+static
+uint64_t mix(uint64_t h,  const uint64_t w){
+	h = (h ^ w) * 0x9e3779b97f4a7c15u;
+	return h ^ (h >> 29);
+}
+
+static
+uint64_t hash_bytes(uint64_t h,  const char* itr,  const char* const end){
+	// Eight bytes at a time, as the whole document is hashed on every run
+	h = mix(h, compsky::utils::ptrdiff(end,itr));
+	for (;  compsky::utils::ptrdiff(end,itr) >= 8;  itr += 8){
+		uint64_t w;
+		memcpy(&w, itr, 8);
+		h = mix(h, w);
+	}
+	uint64_t w = 0;
+	memcpy(&w, itr, compsky::utils::ptrdiff(end,itr));
+	return mix(h, w);
+}
+
+static
+void fragment_path(char(&path)[4096],  const char* const dirpath,  const uint64_t key){
+	snprintf(path, sizeof(path), "%s/%016lx", dirpath, key);
+}
+
+static
+bool is_fragment_name(const char* const name){
+	if (strlen(name) != FRAGMENT_NAME_LEN)
+		return false;
+	for (std::size_t i = 0;  i < FRAGMENT_NAME_LEN;  ++i)
+		if (not (((name[i] >= '0') and (name[i] <= '9')) or ((name[i] >= 'a') and (name[i] <= 'f'))))
+			return false;
+	return true;
+}
+
+
+FragmentCache::FragmentCache(const char* const _dirpath,  const ConversionOptions& options)
+: dirpath(_dirpath)
+, options_hash(FRAGMENT_CACHE_VERSION)
+, n_hits(0)
+, n_misses(0)
+, n_stored(0)
+{
+	// The -R files are identified by their size and modification time rather than hashed, as they are only read when used
+	if (unlikely((mkdir(_dirpath, 0755) != 0) and (errno != EEXIST)))
+		fprintf(stderr, "WARNING: Cannot create %s: %s\n", _dirpath, strerror(errno));
+	this->options_hash = hash_bytes(this->options_hash, options.blockquote_tagname, options.blockquote_tagname + strlen(options.blockquote_tagname));
+	this->options_hash = mix(this->options_hash, options.include_comment_nodes);
+	if (options.replacements == nullptr)
+		return;
+	for (const Filename& filename : options.replacements->filenames){
+		struct stat st;
+		if (unlikely(stat(filename.filepath, &st) != 0))
+			st = {};
+		this->options_hash = hash_bytes(this->options_hash, filename.name.data(), filename.name.data() + filename.name.size());
+		this->options_hash = mix(this->options_hash, st.st_size);
+		this->options_hash = mix(this->options_hash, st.st_mtim.tv_sec);
+		this->options_hash = mix(this->options_hash, st.st_mtim.tv_nsec);
+	}
+}
+
+uint64_t FragmentCache::key(const char* const begin,  const char* const end,  const MarkdownState& assumed_state,  const bool is_first_chunk) const {
+	// Chunks after the first begin after a blank line, and md_to_html looks a few bytes behind its position, so those bytes are included
+	// Of the assumed state, only the tag names given display rules by earlier <style> elements vary
+	if (memmem(begin, compsky::utils::ptrdiff(end,begin), CHILD_CHUNK_OPENING.data(), CHILD_CHUNK_OPENING.size()) != nullptr)
+		return 0;
+	uint64_t h = mix(this->options_hash, is_first_chunk);
+	uint64_t tag_names_hash = 0;
+	for (const TagNames::Entry& entry : assumed_state.tag_names.entries)
+		if (entry.flags & (tag_noninline | tag_inline))
+			tag_names_hash += mix(hash_tag_name(entry.name, 0), entry.flags & (tag_noninline | tag_inline));
+	h = mix(h, tag_names_hash);
+	return hash_bytes(h, is_first_chunk ? begin : begin - 8, end);
+}
+
+bool FragmentCache::load(const uint64_t key,  HtmlOutput& html_output,  char*& dest_itr){
+	// Appends the fragment, if cached, and marks it as recently used
+	char path[4096];
+	fragment_path(path, this->dirpath, key);
+	const int fd = open(path, O_RDONLY);
+	struct stat st;
+	if ((fd == -1) or (fstat(fd, &st) != 0)){
+		if (fd != -1)
+			close(fd);
+		this->n_misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	html_output.reserve(dest_itr, st.st_size);
+	std::size_t n_read = 0;
+	while(n_read < static_cast<std::size_t>(st.st_size)){
+		const ssize_t n = read(fd, dest_itr + n_read, st.st_size - n_read);
+		if (n > 0)
+			n_read += n;
+		else if (not ((n == -1) and (errno == EINTR)))
+			break;
+	}
+	futimens(fd, nullptr);
+	close(fd);
+	if (unlikely(n_read != static_cast<std::size_t>(st.st_size))){
+		fprintf(stderr, "WARNING: Cannot read %s\n", path);
+		this->n_misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	dest_itr += n_read;
+	this->n_hits.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void FragmentCache::store(const uint64_t key,  const char* const data,  const std::size_t n){
+	// Written to a temporary file which is renamed into place, so that other processes sharing the directory never see a partial fragment
+	char path[4096];
+	char tmp_path[4096+32];
+	fragment_path(path, this->dirpath, key);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%u.tmp", path, getpid(), this->n_stored.fetch_add(1, std::memory_order_relaxed));
+	const int fd = open(tmp_path, O_WRONLY|O_CREAT|O_EXCL, 0644);
+	if (unlikely(fd == -1)){
+		fprintf(stderr, "WARNING: Cannot write %s: %s\n", tmp_path, strerror(errno));
+		return;
+	}
+	std::size_t n_written = 0;
+	while(n_written < n){
+		const ssize_t m = write(fd, data + n_written, n - n_written);
+		if (m > 0)
+			n_written += m;
+		else if (not ((m == -1) and (errno == EINTR)))
+			break;
+	}
+	close(fd);
+	if (unlikely((n_written != n) or (rename(tmp_path, path) != 0))){
+		fprintf(stderr, "WARNING: Cannot write %s: %s\n", path, strerror(errno));
+		unlink(tmp_path);
+	}
+}
+
+void FragmentCache::evict(const std::size_t max_sz){
+	// Deletes the least recently used fragments until the directory holds no more than max_sz bytes of them
+	struct Fragment {
+		struct timespec used_at;
+		std::size_t sz;
+		char name[FRAGMENT_NAME_LEN+1];
+	};
+	DIR* const dir = opendir(this->dirpath);
+	if (unlikely(dir == nullptr))
+		return;
+	std::vector<Fragment> fragments;
+	std::size_t total_sz = 0;
+	struct dirent* ent;
+	while((ent = readdir(dir))){
+		struct stat st;
+		if ((not is_fragment_name(ent->d_name)) or (fstatat(dirfd(dir), ent->d_name, &st, 0) != 0))
+			continue;
+		Fragment& fragment = fragments.emplace_back();
+		fragment.used_at = st.st_mtim;
+		fragment.sz = st.st_size;
+		memcpy(fragment.name, ent->d_name, FRAGMENT_NAME_LEN+1);
+		total_sz += st.st_size;
+	}
+	if (total_sz > max_sz){
+		std::sort(fragments.begin(), fragments.end(), [](const Fragment& a,  const Fragment& b){
+			return (a.used_at.tv_sec < b.used_at.tv_sec) or ((a.used_at.tv_sec == b.used_at.tv_sec) and (a.used_at.tv_nsec < b.used_at.tv_nsec));
+		});
+		for (const Fragment& fragment : fragments){
+			if (total_sz <= max_sz)
+				break;
+			if (likely(unlinkat(dirfd(dir), fragment.name, 0) == 0))
+				total_sz -= fragment.sz;
+		}
+	}
+	closedir(dir);
+}
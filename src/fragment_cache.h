@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+constexpr std::size_t FRAGMENT_CACHE_MIN_CHUNK_SZ = 1024*16; // Top-level blocks are grouped into chunks of at least this size, so that each cached fragment is worth a file
+constexpr uint32_t FRAGMENT_CACHE_BOUNDARY_MASK = 63; // A chunk only ends at a blank line whose preceding bytes hash to 0 under this mask, so that an edit moves no chunk boundaries but those near it
+constexpr std::size_t FRAGMENT_CACHE_CHUNK_OUTPUT_SZ = 1024*256; // The output buffer of each chunk starts this small, as there are many chunks, most of whose output is cached
+constexpr std::size_t FRAGMENT_CACHE_MAX_SZ = 1024*1024*512; // The cache directory is pruned to this many bytes, least recently used first
+
+
+struct MarkdownState;
+struct HtmlOutput;
+struct ConversionOptions;
+
+struct FragmentCache {
+	// Stores the HTML of chunks of a document in a directory, one file per chunk, named by a hash of the chunk's source, of the state it is converted from, and of the options
+	const char* const dirpath;
+	uint64_t options_hash; // Of -b, -c, and the names, sizes and modification times of the -R files
+	std::atomic<unsigned> n_hits;
+	std::atomic<unsigned> n_misses;
+	std::atomic<unsigned> n_stored;
+
+	FragmentCache(const char* const _dirpath,  const ConversionOptions& options);
+
+	uint64_t key(const char* const begin,  const char* const end,  const MarkdownState& assumed_state,  const bool is_first_chunk) const; // 0 for a chunk which includes a child document, which is not cached, as its output depends on the child's files too
+	bool load(const uint64_t key,  HtmlOutput& html_output,  char*& dest_itr);
+	void store(const uint64_t key,  const char* const data,  const std::size_t n);
+	void evict(const std::size_t max_sz);
+};
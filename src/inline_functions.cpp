@@ -1,54 +1,171 @@
 #include "inline_functions.h"
 
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <charconv>
 #include <string>
 #include <string_view>
 
-std::string concat_string_views(std::string_view s1, std::string_view s2)
-{
-std::string result;
-result.reserve(s1.size() + s2.size());
-result += s1;
-result += s2;
-return result;
-}
-
-std::string parse_inline_function_command(const std::string& command)
-{
-// extract function name and arguments
-size_t pos = command.find('(');
-std::string function_name = command.substr(0, pos);
-std::string args_str = command.substr(pos + 1, command.size() - pos - 2); // exclude parentheses
-
-// parse function arguments
-std::vector<std::string> args;
-size_t arg_start = 0;
-bool in_string = false;
-for (size_t i = 0; i < args_str.size(); ++i)
-{
-char c = args_str[i];
-if (c == '"')
-{
-in_string = !in_string;
-}
-else if (c == ',' && !in_string)
-{
-args.push_back(args_str.substr(arg_start, i - arg_start));
-arg_start = i + 1;
-}
-}
-args.push_back(args_str.substr(arg_start)); // add final argument
-
-// call function based on name
-if (function_name == "concat_string_views")
-{
-if (args.size() != 2)
-{
-return "Error: concat_string_views expects 2 arguments";
-}
-return concat_string_views(args[0], args[1]);
-}
-else
-{
-return "Error: unknown function " + function_name;
+
+static
+bool concat_string_views(const std::string_view* const args,  const unsigned,  std::string& result){
+	result += args[0];
+	result += args[1];
+	return true;
+}
+
+static
+bool nchar(const std::string_view* const args,  const unsigned,  std::string& result){
+	// Of characters, not bytes: UTF-8 continuation bytes are not counted
+	std::size_t n = 0;
+	for (const char c : args[0])
+		n += ((c & 0xc0) != 0x80);
+	result += std::to_string(n);
+	return true;
+}
+
+static
+bool paste(const std::string_view* const args,  const unsigned n_args,  std::string& result){
+	for (unsigned i = 0;  i < n_args;  ++i){
+		if (i != 0)
+			result += ' ';
+		result += args[i];
+	}
+	return true;
+}
+
+static
+bool paste0(const std::string_view* const args,  const unsigned n_args,  std::string& result){
+	for (unsigned i = 0;  i < n_args;  ++i)
+		result += args[i];
+	return true;
+}
+
+static
+bool strrep(const std::string_view* const args,  const unsigned,  std::string& result){
+	unsigned times;
+	const auto parsed = std::from_chars(args[1].data(), args[1].data()+args[1].size(), times);
+	if (unlikely((parsed.ec != std::errc()) or (parsed.ptr != args[1].data()+args[1].size()) or (args[0].size()*times > INLINE_FUNCTION_CACHE_MAX_SZ)))
+		return false;
+	result.reserve(result.size() + args[0].size()*times);
+	for (unsigned i = 0;  i < times;  ++i)
+		result += args[0];
+	return true;
+}
+
+static
+bool tolower(const std::string_view* const args,  const unsigned,  std::string& result){
+	// Only ASCII letters are converted
+	for (const char c : args[0])
+		result += ((c >= 'A') and (c <= 'Z')) ? (c - 'A' + 'a') : c;
+	return true;
+}
+
+static
+bool toupper(const std::string_view* const args,  const unsigned,  std::string& result){
+	for (const char c : args[0])
+		result += ((c >= 'a') and (c <= 'z')) ? (c - 'a' + 'A') : c;
+	return true;
 }
+
+
+constexpr InlineFunction inline_functions[] = {
+	// Sorted by name, to be binary searched
+	{"concat_string_views", 2, 2, concat_string_views},
+	{"nchar", 1, 1, nchar},
+	{"paste", 1, INLINE_FUNCTION_MAX_ARGS, paste},
+	{"paste0", 1, INLINE_FUNCTION_MAX_ARGS, paste0},
+	{"strrep", 2, 2, strrep},
+	{"tolower", 1, 1, tolower},
+	{"toupper", 1, 1, toupper}
+};
+static_assert(std::is_sorted(std::begin(inline_functions), std::end(inline_functions), [](const InlineFunction& a,  const InlineFunction& b){ return (a.name < b.name); }));
+
+const InlineFunction* find_inline_function(const std::string_view name){
+	const InlineFunction* const itr = std::lower_bound(std::begin(inline_functions), std::end(inline_functions), name, [](const InlineFunction& f,  const std::string_view _name){ return (f.name < _name); });
+	return ((itr != std::end(inline_functions)) and (itr->name == name)) ? itr : nullptr;
+}
+
+
+static
+bool is_number(const std::string_view token){
+	// Only integers, which R prints as they are written
+	if ((token.size() == 0) or (token.size() > 15))
+		return false;
+	const std::size_t digits_begin = (token[0] == '-');
+	if ((digits_begin == token.size()) or ((token[digits_begin] == '0') and (digits_begin+1 != token.size())))
+		return false;
+	for (std::size_t i = digits_begin;  i < token.size();  ++i)
+		if ((token[i] < '0') or (token[i] > '9'))
+			return false;
+	return true;
+}
+
+bool parse_inline_function_call(const std::string_view command,  InlineFunctionCall& call){
+	std::size_t i = command.find('(');
+	if ((i == std::string_view::npos) or (command.back() != ')'))
+		return false;
+	std::size_t name_end = i;
+	while((name_end != 0) and (command[name_end-1] == ' '))
+		--name_end;
+	call.function = find_inline_function(command.substr(0, name_end));
+	if (call.function == nullptr)
+		return false;
+	call.n_args = 0;
+	const std::size_t args_end = command.size() - 1;
+	++i;
+	while((i != args_end) and (command[i] == ' '))
+		++i;
+	while(i != args_end){
+		if (call.n_args == INLINE_FUNCTION_MAX_ARGS)
+			return false;
+		std::string_view& arg = call.args[call.n_args++];
+		if ((command[i] == '"') or (command[i] == '\'')){
+			const std::size_t literal_end = command.find(command[i], i+1);
+			if ((literal_end == std::string_view::npos) or (literal_end >= args_end))
+				return false;
+			arg = command.substr(i+1, literal_end-i-1);
+			if (arg.find('\\') != std::string_view::npos)
+				return false; // Escapes would need the argument to be copied
+			i = literal_end + 1;
+		} else {
+			const std::size_t token_end = std::min(command.find_first_of(" ,", i), args_end);
+			arg = command.substr(i, token_end-i);
+			if (not is_number(arg))
+				return false; // e.g. a variable, which only R could evaluate
+			i = token_end;
+		}
+		while((i != args_end) and (command[i] == ' '))
+			++i;
+		if (i == args_end)
+			break;
+		if (command[i] != ',')
+			return false;
+		++i;
+		while((i != args_end) and (command[i] == ' '))
+			++i;
+		if (i == args_end)
+			return false; // A trailing comma
+	}
+	return (call.n_args >= call.function->min_args) and (call.n_args <= call.function->max_args);
+}
+
+
+const std::string* InlineFunctionCache::find(const Key& key){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	const auto it = this->entries.find(key);
+	return (it == this->entries.end()) ? nullptr : &it->second->result;
+}
+
+const std::string* InlineFunctionCache::add(const Key& key,  const std::string& result){
+	std::unique_ptr<Entry> entry(new Entry{std::string(key.call), result});
+	const Key cached_key = {entry->call, key.hash};
+	const std::size_t sz = key.call.size() + result.size();
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->n_bytes + sz > INLINE_FUNCTION_CACHE_MAX_SZ)
+		return nullptr;
+	const auto inserted = this->entries.emplace(cached_key, std::move(entry)); // Unless another thread has added it meanwhile
+	if (inserted.second)
+		this->n_bytes += sz;
+	return &inserted.first->second->result;
 }
@@ -1,8 +1,69 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
-#include <vector>
+#include <unordered_map>
 
-std::string concat_string_views(std::string_view s1, std::string_view s2);
-std::string parse_inline_function_command(const std::string& command);
+
+constexpr unsigned INLINE_FUNCTION_MAX_ARGS = 8;
+constexpr std::size_t INLINE_FUNCTION_CACHE_MAX_SZ = 1024*1024*16; // Of results held. Beyond this, those not yet cached are computed every time.
+
+
+struct InlineFunction {
+	// A function which inline R - "`r name(args)`" - may call, computed by the converter itself
+	std::string_view name;
+	unsigned min_args;
+	unsigned max_args;
+	bool(*call)(const std::string_view* const args,  const unsigned n_args,  std::string& result); // Appends to result. false if the arguments are invalid, e.g. a number which is not one.
+};
+
+const InlineFunction* find_inline_function(const std::string_view name); // nullptr if none is registered by that name
+
+
+struct InlineFunctionCall {
+	const InlineFunction* function;
+	std::string_view args[INLINE_FUNCTION_MAX_ARGS]; // Views into the document, without the quotes of string literals
+	unsigned n_args;
+};
+
+bool parse_inline_function_call(const std::string_view command,  InlineFunctionCall& call); // e.g. `paste0("a", 'b', 2)`. false unless it is a single call of a registered function, with as many arguments as it takes, each a string literal without escapes, or a number.
+
+
+struct InlineFunctionCache {
+	// The results of the inline function calls seen so far, so that a call repeated - in one document, or in many, as in batch mode - is computed once. Shared by concurrent conversions.
+	// Keyed by the source of the call, so that one which is cached is not even parsed
+	struct Entry {
+		std::string call;
+		std::string result;
+	};
+	struct Key {
+		// The hash is computed before the mutex is locked
+		std::string_view call;
+		std::size_t hash;
+		bool operator==(const Key& othr) const {
+			return (this->call == othr.call);
+		}
+	};
+	struct KeyHash {
+		std::size_t operator()(const Key& key) const {
+			return key.hash;
+		}
+	};
+	std::mutex mutex;
+	std::unordered_map<Key, std::unique_ptr<Entry>, KeyHash> entries; // Keyed by views of their calls
+	std::size_t n_bytes;
+
+	InlineFunctionCache()
+	: n_bytes(0)
+	{}
+
+	static Key key_of(const std::string_view call){
+		return Key{call, std::hash<std::string_view>()(call)};
+	}
+	const std::string* find(const Key& key); // nullptr if not cached
+	const std::string* add(const Key& key,  const std::string& result); // nullptr if the cache is full, otherwise the cached copy
+};
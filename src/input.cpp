@@ -0,0 +1,216 @@
+#include "input.h"
+#include "stats.h"
+
+#include <compsky/utils/ptrdiff.hpp>
+#include <compsky/macros/likely.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+const char* BlockScanner::begin(const char* const doc_start,  const char* const data_end){
+	// Returns where to start scanning, having accounted for the blocks md_to_html recognises at the very start of the document
+	const std::size_t sz = compsky::utils::ptrdiff(data_end, doc_start);
+	if ((sz >= 4) and (doc_start[0]=='-') and (doc_start[1]=='-') and (doc_start[2]=='-') and (doc_start[3]=='\n')){
+		this->state = in_rmd_header;
+		return (sz >= 7) ? doc_start+7 : data_end;
+	}
+	if ((sz >= 3) and (doc_start[0]=='`') and (doc_start[1]=='`') and (doc_start[2]=='`')){
+		this->state = in_knitr_block;
+		this->n_to_skip = 9;
+		return doc_start+3;
+	}
+	return doc_start;
+}
+
+const char* BlockScanner::scan(const char* itr,  const char* const end){
+	// Returns the position just after the last block boundary within [itr,end), or nullptr if there is none
+	// NOTE: Looks behind itr, so there must be at least 8 readable bytes before the data
+	const char* boundary = nullptr;
+	for (;  itr < end;  ++itr){
+		if (this->step(itr))
+			boundary = itr + 1;
+	}
+	return boundary;
+}
+
+
+MarkdownInput::MarkdownInput(const char* const _filepath,  const bool is_whole_document)
+: filepath(_filepath)
+, fd(((_filepath[0] == '-') and (_filepath[1] == 0)) ? 0 : open(_filepath, O_RDONLY))
+, buf(nullptr)
+, scan_itr(nullptr)
+, mapped_sz(0)
+, is_eof(false)
+, is_buf_borrowed(false)
+{
+	PhaseTimer timer(&ConversionStats::read_ns, &ConversionStats::read_counters);
+	if (unlikely(this->fd == -1))
+		return;
+	struct stat st;
+	if ((fstat(this->fd, &st) == 0) and S_ISREG(st.st_mode) and (st.st_size != 0)){
+		if (likely(this->map_file(st.st_size, is_whole_document)))
+			return;
+	}
+	this->buf = reinterpret_cast<char*>(malloc(INPUT_LOOKBACK_SZ + INPUT_WINDOW_SZ + 1));
+	if (unlikely(this->buf == nullptr))
+		return;
+	memset(this->buf, 0, INPUT_LOOKBACK_SZ);
+	this->buf_end = this->buf + INPUT_LOOKBACK_SZ + INPUT_WINDOW_SZ;
+	this->window_begin = this->buf + INPUT_LOOKBACK_SZ;
+	this->data_end = this->window_begin;
+	this->fill_window();
+}
+
+MarkdownInput::MarkdownInput(const char* const _name,  char* const _buf,  const std::size_t sz)
+: filepath(_name)
+, fd(-1)
+, buf(_buf)
+, buf_end(_buf + INPUT_LOOKBACK_SZ + sz)
+, window_begin(_buf + INPUT_LOOKBACK_SZ)
+, window_end(buf_end)
+, data_end(buf_end)
+, scan_itr(nullptr)
+, mapped_sz(0)
+, discarded_until(_buf)
+, overwritten_by_sentinel(0)
+, is_eof(true)
+, is_buf_borrowed(true)
+{
+	*this->window_end = 0;
+	count_input_bytes(sz);
+}
+
+MarkdownInput::~MarkdownInput(){
+	if (this->mapped_sz != 0)
+		munmap(this->buf, this->mapped_sz);
+	else if (not this->is_buf_borrowed)
+		free(this->buf);
+	if ((this->fd != -1) and (this->fd != 0))
+		close(this->fd);
+}
+
+bool MarkdownInput::map_file(const std::size_t file_sz,  const bool is_whole_document){
+	// Maps the file between two zero-filled regions: the one after it (with the zero-filled remainder of its last page) is the NUL sentinel, and the one before it is the lookback
+	const std::size_t page_sz = sysconf(_SC_PAGESIZE);
+	const std::size_t lookback_sz = (INPUT_LOOKBACK_SZ + page_sz - 1) & ~(page_sz - 1);
+	const std::size_t file_pages_sz = (file_sz + 1 + page_sz - 1) & ~(page_sz - 1);
+	void* const reserved = mmap(nullptr, lookback_sz + file_pages_sz, PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (unlikely(reserved == MAP_FAILED))
+		return false;
+	char* const file_start = reinterpret_cast<char*>(reserved) + lookback_sz;
+	const bool is_small = (file_sz <= INPUT_POPULATE_MAX_SZ);
+	const bool is_one_window = is_small or is_whole_document;
+	// Larger files are writable (privately) so that their windows can be terminated by a sentinel
+	if (unlikely(mmap(file_start, file_sz, is_one_window ? PROT_READ : PROT_READ|PROT_WRITE, is_small ? MAP_PRIVATE|MAP_FIXED|MAP_POPULATE : MAP_PRIVATE|MAP_FIXED, this->fd, 0) == MAP_FAILED)){
+		munmap(reserved, lookback_sz + file_pages_sz);
+		return false;
+	}
+	madvise(file_start, file_sz, is_one_window ? MADV_WILLNEED : MADV_SEQUENTIAL);
+	this->buf = reinterpret_cast<char*>(reserved);
+	this->mapped_sz = lookback_sz + file_pages_sz;
+	this->buf_end = this->buf + this->mapped_sz;
+	this->window_begin = file_start;
+	this->data_end = file_start + file_sz;
+	this->discarded_until = file_start;
+	this->is_eof = true;
+	count_input_bytes(file_sz);
+	if (is_one_window){
+		this->window_end = this->data_end;
+	} else {
+		if (unlikely(mprotect(reserved, this->mapped_sz, PROT_READ|PROT_WRITE) != 0))
+			fprintf(stderr, "WARNING: Cannot make the padding of %s writable: %s\n", this->filepath, strerror(errno));
+		this->fill_window();
+	}
+	return true;
+}
+
+void MarkdownInput::grow(){
+	const std::size_t new_sz = 2 * (compsky::utils::ptrdiff(this->buf_end, this->buf) + 1);
+	char* const new_buf = reinterpret_cast<char*>(realloc(this->buf, new_sz));
+	if (unlikely(new_buf == nullptr)){
+		fprintf(stderr, "ERROR: Cannot allocate %lu bytes for a block of %s\n", new_sz, this->filepath);
+		abort();
+	}
+	this->window_begin = new_buf + compsky::utils::ptrdiff(this->window_begin, this->buf);
+	this->data_end     = new_buf + compsky::utils::ptrdiff(this->data_end,     this->buf);
+	this->scan_itr     = new_buf + compsky::utils::ptrdiff(this->scan_itr,     this->buf);
+	this->buf = new_buf;
+	this->buf_end = new_buf + new_sz - 1;
+}
+
+void MarkdownInput::fill_window(){
+	// Reads until the buffer holds at least one complete block, growing the buffer if a single block does not fit in it
+	const char* boundary;
+	if (this->mapped_sz != 0){
+		// Already in memory: the window ends at the first boundary after INPUT_WINDOW_SZ bytes
+		if (unlikely(this->scan_itr == nullptr))
+			this->scan_itr = this->scanner.begin(this->window_begin, this->data_end);
+		boundary = nullptr;
+		while((boundary == nullptr) and (this->scan_itr < this->data_end)){
+			const char* const scan_until = (compsky::utils::ptrdiff(this->data_end, this->scan_itr) > INPUT_WINDOW_SZ) ? this->scan_itr + INPUT_WINDOW_SZ : this->data_end;
+			boundary = this->scanner.scan(this->scan_itr, scan_until);
+			this->scan_itr = scan_until;
+		}
+	} else while(true){
+		while((this->data_end != this->buf_end) and (not this->is_eof)){
+			const ssize_t n = read(this->fd, this->data_end, compsky::utils::ptrdiff(this->buf_end, this->data_end));
+			if (likely(n > 0)){
+				this->data_end += n;
+				count_input_bytes(n);
+			} else if ((n == -1) and (errno == EINTR)){
+				continue;
+			} else {
+				if (unlikely(n == -1))
+					fprintf(stderr, "WARNING: Error reading %s: %s\n", this->filepath, strerror(errno));
+				this->is_eof = true;
+			}
+		}
+		if (unlikely(this->scan_itr == nullptr))
+			this->scan_itr = this->scanner.begin(this->window_begin, this->data_end);
+		boundary = this->scanner.scan(this->scan_itr, this->data_end);
+		if (this->scan_itr < this->data_end)
+			this->scan_itr = this->data_end;
+		if ((boundary != nullptr) or this->is_eof)
+			break;
+		this->grow();
+	}
+	this->window_end = (boundary == nullptr) ? this->data_end : const_cast<char*>(boundary);
+	this->overwritten_by_sentinel = *this->window_end;
+	*this->window_end = 0;
+}
+
+void MarkdownInput::refill(const char*& markdown,  const char*& markdown_buf){
+	// Called when the converter reaches window_end. Keeps the last INPUT_LOOKBACK_SZ bytes, and moves the next window in after them.
+	PhaseTimer timer(&ConversionStats::read_ns, &ConversionStats::read_counters);
+	*this->window_end = this->overwritten_by_sentinel;
+	if (this->mapped_sz != 0){
+		// Drop the pages which have been converted. The lookback stays in place: it is just before the new window.
+		const std::size_t page_sz = sysconf(_SC_PAGESIZE);
+		char* const discard_until = reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(this->window_end - INPUT_LOOKBACK_SZ) & ~(page_sz - 1));
+		if (discard_until > this->discarded_until){
+			madvise(this->discarded_until, compsky::utils::ptrdiff(discard_until,this->discarded_until), MADV_DONTNEED);
+			this->discarded_until = discard_until;
+		}
+		this->window_begin = this->window_end;
+		this->fill_window();
+		markdown = this->window_begin;
+		markdown_buf = this->window_begin - INPUT_LOOKBACK_SZ;
+		return;
+	}
+	char* const retain_from = this->window_end - INPUT_LOOKBACK_SZ;
+	const std::size_t n_discarded = compsky::utils::ptrdiff(retain_from, this->buf);
+	memmove(this->buf, retain_from, compsky::utils::ptrdiff(this->data_end, retain_from));
+	this->data_end -= n_discarded;
+	this->scan_itr -= n_discarded;
+	this->window_begin = this->buf + INPUT_LOOKBACK_SZ;
+	this->fill_window();
+	markdown = this->window_begin;
+	markdown_buf = this->buf;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+
+constexpr std::size_t INPUT_WINDOW_SZ = 1024*1024*4;
+constexpr std::size_t INPUT_LOOKBACK_SZ = 256; // The converter peeks up to 24 bytes behind its position (the <style> display rules), and prints up to 190 bytes of context before it in error messages
+constexpr std::size_t INPUT_POPULATE_MAX_SZ = 1024*1024*64; // Larger files are not prefaulted when mapped, and are converted in windows like any other input - with the pages of each converted window dropped - so that the file is not held in memory in its entirety
+
+
+struct BlockScanner {
+	// Finds blank lines which end a top-level block - i.e. are not within a <script>, <style>, <!-- --> or ``` block - so that nothing the converter scans for lies beyond them
+	enum State : unsigned char {
+		outside,
+		in_rmd_header,
+		in_script,
+		in_style,
+		in_comment,
+		in_knitr_block
+	};
+	State state;
+	unsigned n_to_skip; // Mirrors the minimum lengths md_to_html assumes of comments and knitr blocks, so both agree on where they end
+
+	BlockScanner()
+	: state(outside)
+	, n_to_skip(0)
+	{}
+
+	const char* begin(const char* const doc_start,  const char* const data_end);
+	const char* scan(const char* itr,  const char* const end);
+
+	bool step(const char* const itr){
+		// Advances over the byte at itr. Returns whether it is the end of a blank line which ends a block.
+		if (this->n_to_skip != 0){
+			--this->n_to_skip;
+			return false;
+		}
+		const char c = *itr;
+		switch(this->state){
+			case outside:
+				switch(c){
+					case '\n':
+						return (itr[-1] == '\n');
+					case '>':
+					case ' ':
+						if (memcmp(itr-7, "<script", 7) == 0)
+							this->state = in_script;
+						else if (memcmp(itr-6, "<style", 6) == 0)
+							this->state = in_style;
+						break;
+					case '-':
+						if (memcmp(itr-3, "<!--", 4) == 0){
+							this->state = in_comment;
+							this->n_to_skip = 2;
+						}
+						break;
+					case '`':
+						if ((itr[-1] == '`') and (itr[-2] == '`') and (itr[-3] == '\n')){
+							this->state = in_knitr_block;
+							this->n_to_skip = 9;
+						}
+						break;
+				}
+				break;
+			case in_rmd_header:
+				if ((c == '\n') and (itr[-1] == '-') and (itr[-2] == '-') and (itr[-3] == '-'))
+					this->state = outside;
+				break;
+			case in_script:
+				if ((c == '>') and (memcmp(itr-8, "</script>", 9) == 0))
+					this->state = outside;
+				break;
+			case in_style:
+				if ((c == '>') and (memcmp(itr-7, "</style>", 8) == 0))
+					this->state = outside;
+				break;
+			case in_comment:
+				if ((c == '>') and (itr[-1] == '-') and (itr[-2] == '-'))
+					this->state = outside;
+				break;
+			case in_knitr_block:
+				if ((c == '`') and (itr[-1] == '`') and (itr[-2] == '`') and (itr[-3] == '\n'))
+					this->state = outside;
+				break;
+		}
+		return false;
+	}
+};
+
+
+struct MarkdownInput {
+	// Reads the document in windows which end at block boundaries, so that memory use does not scale with the document size - only with the size of its largest block
+	// Regular files are mapped rather than read; small ones as a single window
+	const char* const filepath;
+	int fd;
+	char* buf;
+	char* buf_end; // One byte before the end of the allocation, so there is always room for the sentinel
+	char* window_begin;
+	char* window_end; // *window_end == 0: the sentinel which the scanners in md_to_html rely on
+	char* data_end; // [window_end,data_end) has been read but belongs to an incomplete block
+	const char* scan_itr;
+	BlockScanner scanner;
+	std::size_t mapped_sz; // 0 unless the file is mapped, in which case buf is the start of the mapping
+	char* discarded_until;
+	char overwritten_by_sentinel;
+	bool is_eof;
+	bool is_buf_borrowed; // Owned by the caller, so not freed
+
+	MarkdownInput(const char* const _filepath,  const bool is_whole_document); // "-" reads from stdin. is_whole_document maps a regular file as a single window, however large.
+	MarkdownInput(const char* const _name,  char* const _buf,  const std::size_t sz); // A document already in memory, as a single window: the sz bytes after the first INPUT_LOOKBACK_SZ of _buf, which must be zeroes. The byte after them is overwritten by the sentinel.
+	~MarkdownInput();
+
+	bool is_null() const {
+		return (this->buf == nullptr);
+	}
+	bool has_more() const {
+		return (this->window_end != this->data_end) or (not this->is_eof);
+	}
+
+	bool map_file(const std::size_t file_sz,  const bool is_whole_document);
+	void refill(const char*& markdown,  const char*& markdown_buf);
+	void fill_window();
+	void grow();
+};
@@ -1,63 +1,140 @@
 #include "md_to_html.h"
+#include "input.h"
+#include "output.h"
+#include "replacements.h"
+#include "batch.h"
+#include "parallel.h"
+#include "watch.h"
+#include "fragment_cache.h"
+#include "daemon.h"
+#include "compress.h"
+#include "paginate.h"
+#include "stats.h"
+#include "style_rules.h"
+#include "children.h"
+#include "inline_functions.h"
 
 #include <compsky/utils/ptrdiff.hpp>
 #include <compsky/macros/likely.hpp>
+#include <algorithm>
 #include <string>
+#include <memory>
+#include <thread>
 #include <compsky/os/write.hpp> // for write
-#include <algorithm>
 
-extern const char* blockquote_tagname;
-bool PRINT_DEBUG = false;
 bool IS_VERBOSE = false;
-bool INCLUDE_COMMENT_NODES = false;
-extern std::vector<Filename> replacewith_filenames;
 
 int main(int argc,  const char* const* argv){
+	ConversionOptions options;
+	ReplacementTable replacements;
+	options.replacements = &replacements;
+	StyleCache style_cache; // Batch, watch and daemon mode convert many documents, which tend to share their stylesheets
+	options.style_cache = &style_cache;
+	ChildCache child_cache(std::max(1u, std::thread::hardware_concurrency()) - 1); // Also for a single document, which may include a child several times
+	options.child_cache = &child_cache;
+	InlineFunctionCache inline_function_cache; // Documents repeat the same computed snippets many times
+	options.inline_function_cache = &inline_function_cache;
 	bool any_errors = false;
+	bool is_preloading_replacements = false;
+	bool is_batch = false;
+	const char* manifest_path = nullptr;
+	unsigned n_threads = 1;
+	bool is_watching = false;
+	std::vector<const char*> replacement_dirpaths;
+	const char* fragment_cache_dirpath = nullptr;
+	int stats_fd = -1;
+	bool is_counting_hardware = false;
+	const char* daemon_socket_path = nullptr;
+	CompressionOptions compression_options;
+	BatchIoBackend batch_io_backend = batch_io_sync;
+	unsigned page_heading_level = 0;
 	++argv;
 	--argc;
-	if (argc != 0){
-	while((argv[0][0] == '-') and (argv[0][2] == 0)){
+	while((argc != 0) and (argv[0][0] == '-') and (argv[0][1] != 0) and (argv[0][2] == 0)){
 		switch(argv[0][1]){
 			case 'b':
-				blockquote_tagname = *(++argv);
+				options.blockquote_tagname = *(++argv);
 				--argc;
 				break;
 			case 'c':
-				INCLUDE_COMMENT_NODES = true;
+				options.include_comment_nodes = true;
 				break;
 			case 'd':
-				PRINT_DEBUG = true;
+				options.print_debug = true;
+				break;
+			case 'n':
+				options.is_numbering_headings = true;
+				break;
+			case 't':
+				options.is_adding_toc = true;
 				break;
 			case 'v':
 				IS_VERBOSE = true;
 				break;
-			case 'R': {
-				const char* const dirpath = *(++argv);
+			case 'p':
+				is_preloading_replacements = true;
+				break;
+			case 'j':
+				n_threads = atoi(*(++argv));
 				--argc;
-				std::size_t dirpath_len = strlen(dirpath);
-				char fullpath[4096];
-				memcpy(fullpath, dirpath, dirpath_len);
-				if (fullpath[dirpath_len-1] != '/'){
-					fullpath[dirpath_len] = '/';
-					++dirpath_len;
-				}
-				DIR* const dir = opendir(dirpath);
-				if (unlikely(dir == nullptr)){
+				if (n_threads == 0)
+					n_threads = std::thread::hardware_concurrency();
+				break;
+			case 'B':
+				is_batch = true;
+				break;
+			case 'M':
+				manifest_path = *(++argv);
+				--argc;
+				is_batch = true;
+				break;
+			case 'I':
+				if (unlikely(not parse_batch_io_backend(*(++argv), batch_io_backend)))
 					any_errors = true;
-				} else {
-					struct dirent* ent;
-					while((ent = readdir(dir))){
-						if (likely((ent->d_type == DT_REG) or (ent->d_type == DT_LNK))){
-							replacewith_filenames.emplace_back(fullpath, dirpath_len, ent->d_name);
-						}
-					}
-					std::sort(replacewith_filenames.begin(), replacewith_filenames.end(), [](const Filename& f1,  const Filename& f2){
-						return f1.name.size() > f2.name.size();
-					}); // Place largest names first - so R_E_P_L_A_C_E_xy comes before R_E_P_L_A_C_E_x
-				}
+				--argc;
+				break;
+			case 'R':
+				replacement_dirpaths.push_back(*(++argv));
+				--argc;
+				if (unlikely(not read_replacement_dir(replacement_dirpaths.back(), replacements.filenames)))
+					any_errors = true;
+				break;
+			case 'C':
+				fragment_cache_dirpath = *(++argv);
+				--argc;
+				break;
+			case 'w':
+				is_watching = true;
+				break;
+			case 'D':
+				daemon_socket_path = *(++argv);
+				--argc;
+				break;
+			case 'z':
+				if (unlikely(not compression_options.parse(*(++argv))))
+					any_errors = true;
+				--argc;
+				break;
+			case 'm':
+				options.minify_level = atoi(*(++argv));
+				--argc;
+				if (unlikely(options.minify_level > 2))
+					any_errors = true;
+				break;
+			case 'P':
+				page_heading_level = atoi(*(++argv));
+				--argc;
+				if (unlikely((page_heading_level == 0) or (page_heading_level > 6)))
+					any_errors = true;
+				break;
+			case 's':
+				stats_fd = atoi(*(++argv));
+				--argc;
+				options.stats = new ConversionStats();
+				break;
+			case 'H':
+				is_counting_hardware = true;
 				break;
-			}
 			default:
 				any_errors = true;
 				break;
@@ -65,26 +142,121 @@ int main(int argc,  const char* const* argv){
 		++argv;
 		--argc;
 	}
-	if (likely(not any_errors) and likely((argc >= 1) and (argc <= 2))){
-		int out_fd = 1;
-		if (argc == 2){
-			out_fd = open(argv[1], O_WRONLY|O_CREAT, 0644);
+	if (is_counting_hardware){
+		if (unlikely(options.stats == nullptr))
+			any_errors = true;
+		else
+			options.stats->is_counting_hardware = true;
+	}
+	if (likely(not any_errors)){
+		replacements.trie.build(replacements.filenames);
+		if (is_preloading_replacements)
+			preload_replacements(replacements.filenames);
+	}
+	if (likely(not any_errors) and (daemon_socket_path != nullptr)){
+		if (likely(argc == 0))
+			serve_daemon(options, daemon_socket_path, n_threads);
+		any_errors = true;
+	}
+	if (likely(not any_errors) and is_batch){
+		std::vector<BatchJob> jobs;
+		char* manifest = nullptr;
+		if (manifest_path != nullptr){
+			const int manifest_fd = open(manifest_path, O_RDONLY);
+			if (likely(manifest_fd != -1)){
+				manifest = read_batch_manifest(manifest_fd, jobs);
+				close(manifest_fd);
+			}
+			any_errors = (manifest == nullptr) or (argc != 0);
+		} else if (argc == 0){
+			manifest = read_batch_manifest(0, jobs);
+			any_errors = (manifest == nullptr);
+		} else if (argc % 2 == 0){
+			for (int i = 0;  i < argc;  i += 2){
+				jobs.push_back({argv[i], argv[i+1], 0});
+			}
+		} else {
+			any_errors = true;
 		}
-		char* const html_buf = reinterpret_cast<char*>(malloc(2*HALF_BUF_SZ));
-		if (likely(html_buf != nullptr)){
-			char* const html_end = md_to_html(argv[0], html_buf);
-			write(out_fd, html_buf, compsky::utils::ptrdiff(html_end,html_buf));
-			if (out_fd != 1)
-				close(out_fd);
-			for (const Filename& filename : replacewith_filenames){
-				filename.deconstruct();
+		if (likely(not any_errors)){
+			any_errors = not (is_watching ? watch_documents(options, compression_options, replacements, jobs, replacement_dirpaths) : convert_batch(options, compression_options, batch_io_backend, jobs));
+			for (const Filename& filename : replacements.filenames){
+				filename.deconstruct(IS_VERBOSE);
 			}
-			return 0;
+			free(manifest);
+			if (options.stats != nullptr)
+				options.stats->write_json(stats_fd);
+			return any_errors;
+		}
+	}
+	if (likely(not any_errors) and is_watching){
+		if (likely((argc == 2) and (strcmp(argv[0], "-") != 0))){
+			std::vector<BatchJob> jobs{{argv[0], argv[1], 0}};
+			watch_documents(options, compression_options, replacements, jobs, replacement_dirpaths);
 		}
+		any_errors = true;
 	}
+	if (unlikely(page_heading_level != 0) and unlikely((argc != 2) or (n_threads > 1) or (fragment_cache_dirpath != nullptr) or options.is_tree_needed())){
+		fprintf(stderr, "ERROR: -P requires the output path, and cannot be combined with -j, -C, -n or -t\n");
+		any_errors = true;
+	}
+	if (likely(not any_errors) and likely((argc == 2) or ((argc == 1) and not compression_options.any()))){
+		std::unique_ptr<Pagination> pagination;
+		if (page_heading_level != 0)
+			pagination.reset(new Pagination(argv[1], page_heading_level));
+		int out_fd = 1;
+		if (pagination != nullptr){
+			out_fd = pagination->open_page(pagination->page_path(1));
+		} else if (argc == 2){
+			out_fd = open(argv[1], O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		}
+		if (likely(out_fd != -1)){
+			std::unique_ptr<FragmentCache> fragment_cache;
+			if ((fragment_cache_dirpath != nullptr) and not options.print_debug)
+				fragment_cache.reset(new FragmentCache(fragment_cache_dirpath, options));
+			conversion_stats = options.stats; // So that reading the input is timed too
+			MarkdownInput markdown_input(argv[0], (n_threads > 1) or (fragment_cache != nullptr));
+			HtmlOutput html_output(out_fd);
+			html_output.pagination = pagination.get();
+			std::unique_ptr<CompressionPipeline> compression;
+			if (compression_options.any()){
+				compression.reset(new CompressionPipeline(compression_options));
+				html_output.compression = compression.get();
+			}
+			if (likely(not (html_output.is_null() or ((compression != nullptr) and compression->is_null())))){
+				if (compression != nullptr)
+					compression->begin((pagination != nullptr) ? pagination->page_path(1).c_str() : argv[1]);
+				bool is_error = report_conversion_error(argv[0], md_to_html_parallel(options, markdown_input, html_output, n_threads, fragment_cache.get()));
+				if ((pagination != nullptr) and likely(not is_error))
+					pagination->write_index(html_output);
+				if (compression != nullptr){
+					compression->end();
+					if (unlikely(not compression->wait()))
+						is_error = true;
+				}
+				if (fragment_cache != nullptr){
+					if (IS_VERBOSE)
+						fprintf(stderr, "Fragment cache: %u hits, %u misses\n", fragment_cache->n_hits.load(), fragment_cache->n_misses.load());
+					if (fragment_cache->n_stored != 0)
+						fragment_cache->evict(FRAGMENT_CACHE_MAX_SZ);
+				}
+				if (html_output.fd != 1)
+					close(html_output.fd); // The last page's, or the index's, if paginated
+				if (options.stats != nullptr)
+					options.stats->write_json(stats_fd);
+				for (const Filename& filename : replacements.filenames){
+					filename.deconstruct(IS_VERBOSE);
+				}
+				return (is_error or html_output.is_write_failed);
+			}
+		}
 	}
 	constexpr const char* errmsg =
 		"USAGE: [[OPTIONS]] [/path/to/file.rmd] [/path/to/outfile.html]?\n"
+		"	The input path may be - to read from stdin\n"
+		"   OR: [[OPTIONS]] -B [[/path/to/file.rmd /path/to/outfile.html]]\n"
+		"   OR: [[OPTIONS]] -M /path/to/manifest\n"
+		"   OR: [[OPTIONS]] -D /path/to/socket\n"
 		"OPTIONS:\n"
 		"	-b BLOCKQUOTE_TAGNAME\n"
 		"		Default is \"blockquote\"\n"
@@ -94,10 +266,57 @@ int main(int argc,  const char* const* argv){
 		"		Verbose\n"
 		"	-c\n"
 		"		Include <!-- comment nodes --> (default FALSE)\n"
+		"	-n\n"
+		"		Number the headings, e.g. 2.1, counting from the highest level used\n"
+		"	-t\n"
+		"		Add a table of contents to the start of the <body>, giving each heading an id unless it has one\n"
+		"		With -n or -t, the HTML is parsed into a tree to be transformed, so the whole output is held in memory\n"
 		"	-R [/path/to/directory]\n"
 		"		Directory containing files.\n"
 		"		For each file named {fname}, if a string \"R_E_P_L_A_C_E_{fname}\" is encountered, it is replaced by the file's contents.\n"
 		"		Can screw up things if done in strange places. <R_E_P_L_A_C_E_stuff> works but not <blahR_E_P_L_A_C_E_stuff>\n"
+		"		Files are only read when first used\n"
+		"	-p\n"
+		"		Preload the -R files in parallel, rather than reading each when it is first used\n"
+		"	-j [N_THREADS]\n"
+		"		Convert a single document on N_THREADS threads (0 for one per core), by splitting it between top-level blocks\n"
+		"		The output is the same, but is held in memory until the whole document is converted\n"
+		"	-B\n"
+		"		Batch mode: convert each pair of input and output files, on all cores, largest first\n"
+		"		If no pairs are given, they are read from stdin as with -M\n"
+		"	-M [/path/to/manifest]\n"
+		"		Batch mode, with the pairs read from a file: one per line, the input and output paths separated by a tab\n"
+		"	-I [BACKEND]\n"
+		"		How batch mode reads and writes files: sync (the default) has each worker read and write its own files\n"
+		"		uring reads the inputs ahead of the workers and writes the outputs behind them through io_uring, so that converting overlaps with the I/O - which pays off when the inputs are not in the page cache\n"
+		"		threads does the same on a few threads of blocking calls, as uring does if the kernel lacks io_uring\n"
+		"		Inputs over 64MiB are always read and written by their worker\n"
+		"	-C [/path/to/directory]\n"
+		"		Cache the HTML of chunks of the document in this directory, and reuse it for the chunks which are unchanged when next converted\n"
+		"		Only for a single document. The directory is pruned to 512MiB, least recently used first. -v reports the hits and misses.\n"
+		"	-w\n"
+		"		Watch mode: stay running, and reconvert a document whenever it, or an -R file it uses, changes\n"
+		"		Requires the output path(s); -R directories are watched for added and removed files too\n"
+		"	-D [/path/to/socket]\n"
+		"		Daemon mode: listen on this Unix domain socket, and convert the documents requested on it (see daemon.h for the protocol)\n"
+		"		Each request is converted by one of the -j workers, so the -R files are read once, and the buffers of each worker are reused\n"
+		"	-z [FORMATS]\n"
+		"		Also write the HTML compressed, next to each output file: FORMATS is gz, zst or gz,zst, each optionally with a level, e.g. gz:9,zst:19\n"
+		"		The output is compressed on another thread as it is written, rather than reread afterwards. Requires the output path(s); not in daemon mode.\n"
+		"	-m [LEVEL]\n"
+		"		Minify the HTML as it is written: 1 collapses runs of whitespace to one space or newline, and removes any next to block-level tags, except within <pre>, <textarea>, <script> and <style>\n"
+		"		2 also removes the comments and insignificant whitespace of <style> elements\n"
+		"	-P [HEADING_LEVEL]\n"
+		"		Paginate: split the output between files at each heading of this level or higher (1 to 6), e.g. 2 to start a page at each # or ## heading\n"
+		"		foo.html is written as foo-1.html, foo-2.html and so on, each with the <head> of the first plus the <style> elements before it, and links to the previous and next, and then foo.html as an index of them\n"
+		"		The document is still converted in a single pass, so this requires the output path, and cannot be combined with -j, -C, -n or -t\n"
+		"	-s [FD]\n"
+		"		Write a JSON report to this file descriptor when done, e.g. -s 3 3>stats.json\n"
+		"		It gives the time spent reading, parsing, in <style> elements, in replacements, minifying, writing and in the document tree of -n or -t, and counts the headings, links, emphases, list items, tags, replacements and warnings, and the <style> elements whose display rules were cached from an earlier one, the child documents included and those of them which were cached, and the inline function calls and those of them whose results were cached\n"
+		"		Nothing is timed or counted without it. Not written in watch mode.\n"
+		"	-H\n"
+		"		With -s, also count the CPU cycles, instructions, branch misses and cache misses of each phase, through perf_event_open, and report the instructions per cycle and the misses per KiB of input\n"
+		"		Each phase reads the counters as it begins and ends, which costs a system call each time. If they cannot be read - as in most virtual machines, or if perf_event_paranoid forbids it - they are reported as unavailable.\n"
 	;
 	write(2, errmsg, std::char_traits<char>::length(errmsg));
 	return 1;
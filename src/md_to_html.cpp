@@ -1,28 +1,117 @@
 #include "md_to_html.h"
+#include "children.h"
+#include "document_tree.h"
 #include "inline_functions.h"
+#include "input.h"
+#include "output.h"
+#include "paginate.h"
+#include "replacements.h"
+#include "scan.h"
+#include "stats.h"
+#include "style_rules.h"
+#include "tag_names.h"
 
-#include <compsky/os/read.hpp>
 #include <compsky/utils/ptrdiff.hpp>
 #include <compsky/macros/likely.hpp>
 #include <compsky/asciify/asciify.hpp>
 #include <vector>
+#include <deque>
+#include <cerrno>
+#include <cstdint>
+#include <sys/mman.h>
 #include "utils.hpp"
 
 
-extern bool IS_VERBOSE;
-extern bool INCLUDE_COMMENT_NODES;
+std::string_view Filename::contents() const {
+	// Safe to call from several threads: if more than one maps the file, all but the first unmap theirs
+	const char* data = this->contents_data.load(std::memory_order_acquire);
+	if (likely(data != nullptr))
+		return std::string_view(data, this->contents_sz.load(std::memory_order_relaxed));
+	const char* mapped = "";
+	std::size_t sz = 0;
+	const int fd = open(this->filepath, O_RDONLY);
+	struct stat st;
+	if (unlikely((fd == -1) or (fstat(fd, &st) != 0))){
+		fprintf(stderr, "WARNING: Cannot read %s: %s\n", this->filepath, strerror(errno));
+		count_warning();
+	} else if (st.st_size != 0){
+		void* const p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0);
+		if (unlikely(p == MAP_FAILED)){
+			fprintf(stderr, "WARNING: Cannot map %s: %s\n", this->filepath, strerror(errno));
+			count_warning();
+		} else {
+			mapped = reinterpret_cast<const char*>(p);
+			sz = st.st_size;
+		}
+	}
+	if (fd != -1)
+		close(fd);
+	this->contents_sz.store(sz, std::memory_order_relaxed);
+	if (unlikely(not this->contents_data.compare_exchange_strong(data, mapped, std::memory_order_release, std::memory_order_acquire))){
+		if (sz != 0)
+			munmap(const_cast<char*>(mapped), sz);
+		return std::string_view(data, this->contents_sz.load(std::memory_order_relaxed));
+	}
+	return std::string_view(mapped, sz);
+}
+
+void Filename::forget_contents(){
+	// So that the file is mapped again when next used. Not safe to call while any thread might be using the contents.
+	if (this->contents_sz.load() != 0)
+		munmap(const_cast<char*>(this->contents_data.load()), this->contents_sz.load());
+	this->contents_sz.store(0);
+	this->contents_data.store(nullptr);
+}
+
+void Filename::deconstruct(const bool is_reporting_unused) const {
+	if ((this->n_uses == 0) and is_reporting_unused){
+		const std::string_view contents = this->contents();
+		fprintf(stderr, "%u uses: R_E_P_L_A_C_E_%.*s\n\t%.*s\n", this->n_uses.load(), (int)name.size(), name.data(), (int)contents.size(), contents.data());
+	}
+	if (this->contents_sz.load() != 0)
+		munmap(const_cast<char*>(this->contents_data.load()), this->contents_sz.load());
+	free(const_cast<char*>(this->filepath));
+}
 
 
-void Filename::deconstruct() const {
-	if ((this->n_uses == 0) and (IS_VERBOSE))
-		fprintf(stderr, "%u uses: R_E_P_L_A_C_E_%.*s\n\t%.*s\n", this->n_uses, (int)name.size(), name.data(), (int)contents.size(), contents.data());
-	free(const_cast<char*>(this->contents.data()));
-	free(const_cast<char*>(this->name.data()));
+const char* ConversionError::name() const {
+	switch(this->kind){
+		case none:
+			return "No error";
+		case cannot_read_input:
+			return "Cannot read input";
+		case unexpected_closing_tag:
+			return "Unexpected closing tag";
+		case mismatched_closing_tag:
+			return "Mismatched closing tag";
+		case bad_escape:
+			return "Bad escape";
+		case bad_knitr_output:
+			return "Bad knitr output";
+		case unclosed_tag:
+			return "Unclosed tags";
+		case cannot_read_child:
+			return "Cannot read child document";
+		case child_cycle:
+			return "Child document includes itself";
+	}
+	return "Unknown error";
+}
+
+static
+void set_error(ConversionError& error,  const ConversionError::Kind kind,  const char* context,  std::size_t max_context_len){
+	// context is within the input, which is terminated by the sentinel. It may begin in the zeroes before the start of the document.
+	while((max_context_len != 0) and (*context == 0)){
+		++context;
+		--max_context_len;
+	}
+	error.kind = kind;
+	error.detail.assign(context, strnlen(context, max_context_len));
 }
 
 
-extern bool PRINT_DEBUG;
 constexpr std::size_t emphasis_max = 2;
+static_assert(emphasis_max == sizeof(InlineLookahead::emphasis_ends)/sizeof(InlineLookahead::Memo));
 constexpr const char* emphasis_open[2] = {
 	"<i>",
 	"<b>"
@@ -33,23 +122,63 @@ constexpr const char* emphasis_close[2] = {
 };
 constexpr bool using_knitr_output = true;
 constexpr std::string_view horizontal_rule = "<hr/>";
-const char* blockquote_tagname = "blockquote";
-std::vector<Filename> replacewith_filenames;
-
-bool replace_strings(char*& dest_itr,  char*& markdown){
-	if (unlikely(startswithreplace(markdown))){ // R_E_P_L_A_C_E_
-		for (Filename& filename : replacewith_filenames){
-			if (str_eq(markdown+14, filename.name)){
-				++filename.n_uses;
-				compsky::asciify::asciify(dest_itr, filename.contents);
-				markdown += 14 + filename.name.size() - 1;
-				return true;
-			}
+
+bool asciify_replacement(const ConversionOptions& options,  HtmlOutput& html_output,  char*& dest_itr,  const char*& str){
+	// str points to R_E_P_L_A_C_E_. If it is replaced, str is advanced to the last character of the replaced string.
+	PhaseTimer timer(&ConversionStats::replace_ns, &ConversionStats::replace_counters);
+	const int filename_indx = (options.replacements == nullptr) ? -1 : options.replacements->trie.longest_match(str+14);
+	if (unlikely(filename_indx == -1)){
+		fprintf(stderr, "WARNING: Not replaced: %.30s...\n", str);
+		count_warning();
+		return false;
+	}
+	const Filename& filename = options.replacements->filenames[filename_indx];
+	filename.n_uses.fetch_add(1, std::memory_order_relaxed);
+	if (unlikely(conversion_stats != nullptr))
+		conversion_stats->n_replacements.fetch_add(1, std::memory_order_relaxed);
+	const std::string_view contents = filename.contents();
+	html_output.append(dest_itr, contents.data(), contents.size());
+	str += 14 + filename.name.size() - 1;
+	return true;
+}
+
+void asciify_with_replacements(const ConversionOptions& options,  HtmlOutput& html_output,  char*& dest_itr,  const char* itr,  const char* const end){
+	// For spans of the input which are copied verbatim - or, if large, written from the input itself
+	while(itr < end){
+		const char* const R = reinterpret_cast<const char*>(memchr(itr, 'R', compsky::utils::ptrdiff(end,itr)));
+		if (likely(R == nullptr)){
+			html_output.append(dest_itr, itr, compsky::utils::ptrdiff(end,itr));
+			return;
 		}
-		[[unlikely]]
-		fprintf(stderr, "WARNING: Not replaced: %.30s...\n", markdown);
+		html_output.append(dest_itr, itr, compsky::utils::ptrdiff(R,itr));
+		itr = R;
+		if (not (unlikely(startswithreplace(itr)) and asciify_replacement(options, html_output, dest_itr, itr)))
+			compsky::asciify::asciify(dest_itr, 'R');
+		++itr;
 	}
-	return false;
+}
+
+
+static
+void start_page_at_heading(const ConversionOptions& options,  HtmlOutput& html_output,  char*& dest_itr,  const std::string_view title){
+	// Before the <h#> of a heading which may start a new page
+	Pagination& pagination = *html_output.pagination;
+	if (not pagination.is_page_headed){
+		pagination.page_titles.back() = title;
+		pagination.is_page_headed = true;
+		return;
+	}
+	pagination.write_nav(dest_itr, true);
+	compsky::asciify::asciify(dest_itr, "</body></html>");
+	html_output.finish(dest_itr);
+	pagination.page_titles.emplace_back(title);
+	pagination.switch_to(html_output, pagination.page_path(pagination.page_titles.size()));
+	html_output.append(dest_itr, pagination.head.data(), pagination.head.size());
+	const std::size_t span_min_sz = html_output.span_min_sz;
+	html_output.span_min_sz = SIZE_MAX; // As pagination.styles may grow before the spans are written
+	asciify_with_replacements(options, html_output, dest_itr, pagination.styles.data(), pagination.styles.data()+pagination.styles.size());
+	html_output.span_min_sz = span_min_sz;
+	compsky::asciify::asciify(dest_itr, "</head>\n<body>\n");
 }
 
 
@@ -70,76 +199,52 @@ void close_paragraph_if_nonempty_already_open(char*& dest_itr){
 
 void log(const char* const markdown_buf,  const char* const markdown_itr,  const char* const msg,  const char* const msg_var,  const int msg_var_len){
 	fprintf(stderr, "WARNING: %s at %lu: %.*s\n", msg, compsky::utils::ptrdiff(markdown_itr,markdown_buf), msg_var_len, msg_var);
+	count_warning();
 }
 
-bool is_opening_of_some_node(const char* markdown,  const std::vector<std::string_view>& tag_names){
-	if (markdown[0] == '<'){
-		for (const std::string_view& tagname : tag_names){
-			if (str_eq(markdown+1, tagname)){
-				const char endchar = markdown[1+tagname.size()];
-				if ((endchar=='>') or (endchar==' '))
-					return true;
-			}
+const char* skip_style_element(const ConversionOptions& options,  const char* itr,  TagNames& tag_names,  const bool is_reporting){
+	// itr is at the 's' of <style. Returns the position just after </style>, having added the tag names given display rules within it.
+	PhaseTimer timer(&ConversionStats::style_ns, &ConversionStats::style_counters);
+	const char* const tag_end = strchr(itr, '>');
+	const char* const css_begin = (tag_end == nullptr) ? itr + strlen(itr) : tag_end + 1;
+	const char* const closing_tag = strstr(css_begin, "</style>");
+	const char* const css_end = (closing_tag == nullptr) ? css_begin + strlen(css_begin) : closing_tag;
+	const std::string_view css(css_begin, compsky::utils::ptrdiff(css_end,css_begin));
+	const StyleCache::Key key = (options.style_cache == nullptr) ? StyleCache::Key{css, 0} : StyleCache::key_of(css);
+	const std::vector<DisplayRule>* rules = (options.style_cache == nullptr) ? nullptr : options.style_cache->find(key);
+	std::vector<DisplayRule> scanned_rules;
+	if (rules == nullptr){
+		scan_display_rules(css, scanned_rules, is_reporting);
+		rules = &scanned_rules;
+		if ((options.style_cache != nullptr) and is_reporting){
+			// Not when prescanning, so that the conversion itself reports any errors in it
+			const std::vector<DisplayRule>* const cached_rules = options.style_cache->add(key, scanned_rules);
+			if (cached_rules != nullptr)
+				rules = cached_rules;
 		}
+	} else if (unlikely(conversion_stats != nullptr)){
+		conversion_stats->n_style_cache_hits.fetch_add(1, std::memory_order_relaxed);
 	}
-	return false;
-}
-bool is_some_node(const std::string_view& tag_name,  const std::vector<std::string_view>& tag_names){
-	for (const std::string_view& tagname : tag_names){
-		if (str_eq(tag_name, tagname))
-			return true;
+	for (const DisplayRule& rule : *rules){
+		if (is_reporting and options.print_debug)
+			fprintf(stderr, "DISPLAY %s %.*s\n", (rule.flag == tag_inline) ? "inline" : "block", (int)rule.tag_name.size(), rule.tag_name.data());
+		tag_names.add(rule.tag_name, rule.flag);
 	}
-	return false;
+	return (closing_tag == nullptr) ? css_end : css_end + 8;
 }
 
-void add_tagnames_to_ls(const char* const itr,  std::vector<std::string_view>& tag_names){
-	const char* _enddd = itr;
-	const char* _start = itr-1;
-	while(*_start != '}'){
-		--_start;
+void preserve_tag_names(const MarkdownInput& markdown_input,  std::vector<std::string_view>& tag_names,  std::deque<std::string>& preserved_tag_names){
+	// Copies the tag names which are views into the input window, before the window is overwritten
+	for (std::string_view& tag_name : tag_names){
+		if ((tag_name.data() >= markdown_input.buf) and (tag_name.data() < markdown_input.buf_end)){
+			tag_name = preserved_tag_names.emplace_back(tag_name);
+		}
 	}
-	fprintf(stderr, "FOUND %.*s\n", (int)compsky::utils::ptrdiff(_enddd,_start), _start);
-	while(_start != _enddd){
-		++_start;
-		if (unlikely(startswithreplace(_start)))
-			_start += 14;
-		switch(*_start){
-			case ' ':
-			case '\n':
-			case '\t':
-			case ',':
-			case '{':
-				break;
-			case '/':
-				if (_start[1] == '*'){
-					while(  (_start[-1] != '*') or (_start[0] != '/')  )
-						++_start;
-				} else {
-					fprintf(stderr, "WARNING: Unexpected '/' in <style>display:block; thingie within: %.20s\n", _start-10);
-				}
-				break;
-			case '#':
-			case '.':
-				while((*_start != ',') and (_start != _enddd))
-					++_start;
-				--_start;
-				break;
-			case 'a' ... 'z': {
-				const char* _tagname_start = _start;
-				while(((*_start >= 'a') and (*_start <= 'z')) or (*_start == '-'))
-					++_start;
-				if (
-					(*_start == ',') or
-					((_start[0] == ' ') and (_start[1] == '{')) or
-					(_start[0] == '{')
-				){
-					fprintf(stderr, "ADDED %.*s\n", (int)compsky::utils::ptrdiff(_start,_tagname_start), _tagname_start);
-					tag_names.emplace_back(_tagname_start, compsky::utils::ptrdiff(_start,_tagname_start));
-				}
-				break;
-			}
-			default:
-				fprintf(stderr, "Encountered unexpected <style>display:block; thingie: %c within: %.20s\n", *_start, _start-10);
+}
+void preserve_tag_names(const MarkdownInput& markdown_input,  TagNames& tag_names,  std::deque<std::string>& preserved_tag_names){
+	for (TagNames::Entry& entry : tag_names.entries){
+		if ((entry.name.data() >= markdown_input.buf) and (entry.name.data() < markdown_input.buf_end)){
+			entry.name = preserved_tag_names.emplace_back(entry.name);
 		}
 	}
 }
@@ -151,19 +256,37 @@ void write_n_spaces(char*& dest_itr,  unsigned n){
 	}
 }
 
-char* md_to_html(const char* const filepath,  char* const dest_buf){
-	compsky::os::ReadOnlyFile f(filepath);
-	if (unlikely(f.is_null())){
-		log(nullptr, nullptr, "Cannot open file", filepath, strlen(filepath));
-		return dest_buf;
-	}
-	char* const markdown_buf = reinterpret_cast<char*>(malloc(f.size()+1));
-	f.read_into_buf(markdown_buf, f.size());
-	markdown_buf[f.size()] = 0;
-	
-	char* dest_itr = dest_buf + HALF_BUF_SZ;
-	const char* markdown = markdown_buf;
-	std::string_view titlestr;
+MarkdownState::MarkdownState(const ConversionOptions& options)
+: is_in_anchor_whose_title_ends_at(nullptr)
+, is_in_anchor_which_ends_at(nullptr)
+, n_open_paragraphs(0)
+, dom_tag_depth_for_opening_of_paragraph(0)
+, line_began_with_n_spaces(0)
+, is_in_blockquote(false)
+, done_left_quote_mark(false)
+{
+	tag_names.add(options.blockquote_tagname, tag_noninline);
+}
+
+bool MarkdownState::operator==(const MarkdownState& othr) const {
+	// Whether a block converted from othr would be converted the same from this. The warnings already given are irrelevant.
+	return (
+		(this->is_in_anchor_whose_title_ends_at == othr.is_in_anchor_whose_title_ends_at) and
+		(this->is_in_anchor_which_ends_at == othr.is_in_anchor_which_ends_at) and
+		(this->n_open_paragraphs == othr.n_open_paragraphs) and
+		(this->dom_tag_depth_for_opening_of_paragraph == othr.dom_tag_depth_for_opening_of_paragraph) and
+		(this->line_began_with_n_spaces == othr.line_began_with_n_spaces) and
+		(this->is_in_blockquote == othr.is_in_blockquote) and
+		(this->done_left_quote_mark == othr.done_left_quote_mark) and
+		(this->open_dom_tag_names == othr.open_dom_tag_names) and
+		(this->spaces_per_list_depth == othr.spaces_per_list_depth) and
+		(this->tag_names == othr.tag_names)
+	);
+}
+
+static
+const char* skip_front_matter(const char* markdown,  std::string_view& titlestr){
+	// Returns where the first block begins, after the "---" front matter if there is any, setting titlestr to its title if it has one
 	if ((markdown[0]=='-')and(markdown[1]=='-')and(markdown[2]=='-')and(markdown[3]=='\n')){
 		// Skip RMD information part
 		markdown += 8;
@@ -187,74 +310,133 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 			++markdown;
 		}
 	}
+	return markdown;
+}
+
+const char* md_to_html_begin(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output,  char*& dest_itr){
+	// Writes everything before the first block, and returns where the first block begins
+	std::string_view titlestr;
+	const char* const markdown = skip_front_matter(markdown_input.window_begin, titlestr);
 	compsky::asciify::asciify(dest_itr,
 		"<!DOCTYPE html>\n"
 		"<html>\n"
 		"<head>\n"
 		"<meta http-equiv=\"Content-Type\" content=\"text/html; charset=UTF-8\">\n"
 		"<meta charset=\"utf-8\">\n"
-		"<title>", titlestr, "</title>\n"
+		"<title>"
+	);
+	asciify_with_replacements(options, html_output, dest_itr, titlestr.data(), titlestr.data()+titlestr.size());
+	compsky::asciify::asciify(dest_itr,
+		"</title>\n"
 		"<meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">\n"
 		"<!-- tabsets --><!-- code folding -->\n"
 		"</head>\n"
 		"<body>\n"
 	);
-	bool is_in_blockquote = false;
-	unsigned n_open_paragraphs = 0;
-	unsigned dom_tag_depth_for_opening_of_paragraph = 0;
-	const char* is_in_anchor_whose_title_ends_at = nullptr;
-	const char* is_in_anchor_which_ends_at = nullptr;
-	std::vector<std::string_view> open_dom_tag_names;
-	unsigned line_began_with_n_spaces = 0;
-	std::vector<std::string_view> noninline_div_tag_names;
-	std::vector<std::string_view> inline_div_tag_names;
-	std::vector<std::string_view> warned_about_tag_names;
-	std::vector<unsigned> spaces_per_list_depth;
-	noninline_div_tag_names.reserve(23+10);
-	noninline_div_tag_names.emplace_back("br");
-	noninline_div_tag_names.emplace_back("hr");
-	noninline_div_tag_names.emplace_back("div");
-	noninline_div_tag_names.emplace_back("script");
-	noninline_div_tag_names.emplace_back("style");
-	noninline_div_tag_names.emplace_back("h1");
-	noninline_div_tag_names.emplace_back("h2");
-	noninline_div_tag_names.emplace_back("h3");
-	noninline_div_tag_names.emplace_back("h4");
-	noninline_div_tag_names.emplace_back("h5");
-	noninline_div_tag_names.emplace_back("h6");
-	noninline_div_tag_names.emplace_back("h7");
-	noninline_div_tag_names.emplace_back("h8");
-	noninline_div_tag_names.emplace_back("h9");
-	noninline_div_tag_names.emplace_back("h10");
-	noninline_div_tag_names.emplace_back(blockquote_tagname);
-	noninline_div_tag_names.emplace_back("ul");
-	noninline_div_tag_names.emplace_back("li");
-	noninline_div_tag_names.emplace_back("canvas");
-	noninline_div_tag_names.emplace_back("button");
-	noninline_div_tag_names.emplace_back("p");
-	noninline_div_tag_names.emplace_back("table");
-	noninline_div_tag_names.emplace_back("tr");
-	inline_div_tag_names.reserve(17+10);
-	inline_div_tag_names.emplace_back("svg");
-	inline_div_tag_names.emplace_back("circle");
-	inline_div_tag_names.emplace_back("path");
-	inline_div_tag_names.emplace_back("img");
-	inline_div_tag_names.emplace_back("td");
-	inline_div_tag_names.emplace_back("th");
-	inline_div_tag_names.emplace_back("time");
-	inline_div_tag_names.emplace_back("input");
-	inline_div_tag_names.emplace_back("highlighttagnamehere"); // TODO
-	inline_div_tag_names.emplace_back("a");
-	inline_div_tag_names.emplace_back("span");
-	inline_div_tag_names.emplace_back("q");
-	inline_div_tag_names.emplace_back("em");
-	inline_div_tag_names.emplace_back("i");
-	inline_div_tag_names.emplace_back("b");
-	inline_div_tag_names.emplace_back("strong");
-	inline_div_tag_names.emplace_back("label");
-	bool done_left_quote_mark = false;
+	return markdown;
+}
+
+static
+const char* include_child_chunk(const ConversionOptions& options,  const MarkdownInput& markdown_input,  HtmlOutput& html_output,  char*& dest_itr,  unsigned& n_open_paragraphs,  const char* const chunk,  ConversionError& error){
+	// chunk is at the start of a line. Returns the end of the chunk - after its closing "```" and its newline - or nullptr if it is not a child chunk. Sets error if it is one, but the child cannot be included.
+	// The child is a block of its own, so is not within the paragraph opened by the blank line before it
+	for (std::size_t i = 0;  i < CHILD_CHUNK_OPENING.size();  ++i)
+		if (chunk[i] != CHILD_CHUNK_OPENING[i])
+			return nullptr; // Before the sentinel, at the latest
+	const char* const filepath = chunk + CHILD_CHUNK_OPENING.size();
+	const char* const filepath_end = str_if_ends_with__before(filepath, '\'', '\n');
+	const char* const R_statement_end = str_if_ends_with3(filepath, '`','`','`');
+	if (unlikely((filepath_end == filepath-1) or (R_statement_end == filepath-1)))
+		return nullptr;
+	if (n_open_paragraphs != 0)
+		n_open_paragraphs -= rm_paragraph_if_just_opened(dest_itr);
+	include_child(options, markdown_input, html_output, dest_itr, std::string_view(filepath, compsky::utils::ptrdiff(filepath_end+1,filepath)), error);
+	const char* const end = R_statement_end+1+3;
+	return (*end == '\n') ? end+1 : end;
+}
+
+static
+const char* write_inline_function(const ConversionOptions& options,  HtmlOutput& html_output,  char*& dest_itr,  const char* const R_statement){
+	// R_statement is after "`r ". Returns the end of the inline R - after its closing '`' - having written the result in its place, or nullptr unless it is a call of an inline function.
+	const char* const R_statement_end = str_if_ends_with__before(R_statement, '`', '\n');
+	if (R_statement_end == R_statement-1)
+		return nullptr;
+	const std::string_view command(R_statement, compsky::utils::ptrdiff(R_statement_end+1,R_statement));
+	InlineFunctionCache* const cache = options.inline_function_cache;
+	InlineFunctionCache::Key key;
+	const std::string* result = nullptr;
+	if (cache != nullptr){
+		key = InlineFunctionCache::key_of(command);
+		result = cache->find(key);
+	}
+	std::string computed;
+	if (result == nullptr){
+		InlineFunctionCall call;
+		if (not parse_inline_function_call(command, call))
+			return nullptr; // e.g. one which only R could evaluate
+		if (unlikely(not call.function->call(call.args, call.n_args, computed)))
+			return nullptr;
+		result = (cache == nullptr) ? nullptr : cache->add(key, computed);
+		if (result == nullptr)
+			result = &computed;
+	} else if (unlikely(conversion_stats != nullptr)){
+		conversion_stats->n_inline_function_cache_hits.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (unlikely(conversion_stats != nullptr))
+		conversion_stats->n_inline_functions.fetch_add(1, std::memory_order_relaxed);
+	html_output.reserve(dest_itr, result->size());
+	memcpy(dest_itr, result->data(), result->size());
+	dest_itr += result->size();
+	return R_statement_end + 2;
+}
+
+template<bool is_collecting_stats>
+const char* convert_blocks(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output,  MarkdownState& state,  char*& dest_itr,  const char* markdown,  const char* markdown_buf,  const char* const stop_at){
+	// Instantiated separately for collecting stats, so that the loop is unchanged when they are not
+	// The scalars are copied into locals for the duration, so that writes through dest_itr do not force them to be reloaded
+	const char* const blockquote_tagname = options.blockquote_tagname;
+	const bool print_debug = options.print_debug;
+	bool is_in_blockquote = state.is_in_blockquote;
+	unsigned n_open_paragraphs = state.n_open_paragraphs;
+	unsigned dom_tag_depth_for_opening_of_paragraph = state.dom_tag_depth_for_opening_of_paragraph;
+	const char* is_in_anchor_whose_title_ends_at = state.is_in_anchor_whose_title_ends_at;
+	const char* is_in_anchor_which_ends_at = state.is_in_anchor_which_ends_at;
+	std::vector<std::string_view>& open_dom_tag_names = state.open_dom_tag_names;
+	unsigned line_began_with_n_spaces = state.line_began_with_n_spaces;
+	TagNames& tag_names = state.tag_names;
+	std::vector<unsigned>& spaces_per_list_depth = state.spaces_per_list_depth;
+	std::deque<std::string>& preserved_tag_names = state.preserved_tag_names;
+	bool done_left_quote_mark = state.done_left_quote_mark;
+	ConstructCounts counts = {};
+	InlineLookahead lookahead;
+	const char* window_end = (stop_at == nullptr) ? markdown_input.window_end : stop_at;
 	while (true){
-		if (PRINT_DEBUG){
+		if (unlikely(markdown == window_end)){
+			if (markdown == stop_at)
+				break;
+			if (markdown_input.has_more()){
+				preserve_tag_names(markdown_input, open_dom_tag_names, preserved_tag_names);
+				preserve_tag_names(markdown_input, tag_names, preserved_tag_names);
+				if (not html_output.spans.empty())
+					html_output.flush(dest_itr); // They may point into the window
+				markdown_input.refill(markdown, markdown_buf);
+				window_end = markdown_input.window_end;
+				lookahead.clear();
+			}
+		}
+		if (unlikely(dest_itr > html_output.flush_threshold))
+			html_output.flush(dest_itr);
+		if ((markdown[-1] != '\n') and likely(not print_debug)){
+			// Not at the start of a line, so there is no paragraph to open and a space is just a space: the run of plain text up to the next special byte is copied as is
+			const char* const plain_text_end = find_plain_text_end(markdown, window_end);
+			if (plain_text_end != markdown){
+				html_output.append(dest_itr, markdown, compsky::utils::ptrdiff(plain_text_end,markdown));
+				markdown = plain_text_end;
+				if (markdown == window_end)
+					continue;
+			}
+		}
+		if (print_debug){
 			printf("%s\n", char2humanvis(*markdown)); fflush(stdout);
 		}
 		++markdown;
@@ -262,7 +444,7 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 		bool should_break_out = false;
 		if (likely(markdown > markdown_buf+2)){
 			if (unlikely((markdown[-2] == '\n') and (markdown[-3] == '\n'))){
-				if (not is_opening_of_some_node(markdown-1, noninline_div_tag_names)){
+				if (not tag_names.is_opening_of_noninline(markdown-1)){
 					compsky::asciify::asciify(dest_itr, "<p>");
 					++n_open_paragraphs;
 					dom_tag_depth_for_opening_of_paragraph = open_dom_tag_names.size();
@@ -299,7 +481,7 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 						}
 						if (n_open_paragraphs != 0){
 							char* _itr = dest_itr;
-							while((*_itr == ' ') or (*_itr == '\n'))
+							while(((*_itr == ' ') or (*_itr == '\n')) and (_itr != html_output.buf))
 								--_itr;
 							if (
 								(_itr[-2] == '<') and
@@ -347,7 +529,13 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 					if (unlikely(title_end == itr-1)){
 						log(markdown_buf, itr, "Empty title", itr, 0);
 					} else {
-						compsky::asciify::asciify(dest_itr, "<h", num_hashes, ">", mkview(itr,title_end+1), "</h", num_hashes, ">");
+						if (unlikely(html_output.pagination != nullptr) and (num_hashes <= html_output.pagination->heading_level) and open_dom_tag_names.empty() and spaces_per_list_depth.empty() and not is_in_blockquote)
+							start_page_at_heading(options, html_output, dest_itr, std::string_view(itr, compsky::utils::ptrdiff(title_end+1,itr)));
+						compsky::asciify::asciify(dest_itr, "<h", num_hashes, ">");
+						if constexpr (is_collecting_stats)
+							++counts.n_headings;
+						asciify_with_replacements(options, html_output, dest_itr, itr, title_end+1);
+						compsky::asciify::asciify(dest_itr, "</h", num_hashes, ">");
 						markdown = title_end + 1;
 						copy_this_char_into_html = false;
 					}
@@ -380,20 +568,30 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 				}
 				break;
 			case '[': {
-				const char* const title_end = str_if_ends_with__before__pair_up_with(markdown, ']', '\n', '[');
+				const char* const closing_bracket = lookahead.find_closing_bracket(markdown-1);
+				const char* const title_end = (closing_bracket == nullptr) ? markdown-1 : closing_bracket-1;
 				if ((likely(title_end != markdown-1)) and (likely(title_end[2] == '('))){
-					const char* const link_end = str_if_ends_with__before__allowescapes(title_end+3, ')', '\n');
+					const char* const url_end = lookahead.find_link_url_end(title_end+3);
+					const char* const link_end = (url_end == nullptr) ? title_end+3-1 : url_end-1;
 					if (likely(link_end != title_end+3-1)){
 						if (likely(is_in_anchor_whose_title_ends_at == nullptr)){
-							compsky::asciify::asciify(dest_itr, "<a href=\"", mkview(title_end+3,link_end+1), "\">");
+							compsky::asciify::asciify(dest_itr, "<a href=\"");
+							asciify_with_replacements(options, html_output, dest_itr, title_end+3, link_end+1);
+							compsky::asciify::asciify(dest_itr, "\">");
 							is_in_anchor_whose_title_ends_at = title_end+2;
+							if constexpr (is_collecting_stats)
+								++counts.n_links;
 							is_in_anchor_which_ends_at = link_end + 2;
 							copy_this_char_into_html = false;
 						} else {
 							log(markdown_buf, markdown-1, "[link]() within [link]()", markdown-1, compsky::utils::ptrdiff(link_end+1,markdown-1));
 						}
-					} else if (str_if_ends_with__before(title_end+3, ')', '\n') != title_end+3-1){
-						fprintf(stderr, "WARNING: Possibly invalid [](link) URL syntax: %.200s\n", title_end);
+					} else {
+						const char* const stop = lookahead.find_stop(title_end+3, ')');
+						if ((*stop == ')') and (stop != title_end+3)){
+							fprintf(stderr, "WARNING: Possibly invalid [](link) URL syntax: %.200s\n", title_end);
+							count_warning();
+						}
 					}
 				}
 				break;
@@ -407,8 +605,8 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 						(itr[-3]!='-') or (itr[-2]!='-') or (itr[-1]!='>')
 					)
 						++itr;
-					if (INCLUDE_COMMENT_NODES)
-						compsky::asciify::asciify(dest_itr, mkview(markdown-1,itr)); // Yes, copy comment HTML into final output - helps detect errors in R
+					if (options.include_comment_nodes)
+						asciify_with_replacements(options, html_output, dest_itr, markdown-1, itr); // Yes, copy comment HTML into final output - helps detect errors in R
 					markdown = itr;
 					copy_this_char_into_html = false;
 				} else if (  (itr[0]=='s') and (itr[1]=='c') and (itr[2]=='r') and (itr[3]=='i') and (itr[4]=='p') and (itr[5]=='t') and ((itr[6]=='>') or (itr[6]==' '))  ){ // <script></script>
@@ -426,95 +624,16 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 					){
 						++itr;
 					}
-					compsky::asciify::asciify(dest_itr, mkview(markdown-1,itr));
+					asciify_with_replacements(options, html_output, dest_itr, markdown-1, itr);
 					markdown = itr;
 					copy_this_char_into_html = false;
 				} else if (  (itr[0]=='s') and (itr[1]=='t') and (itr[2]=='y') and (itr[3]=='l') and (itr[4]=='e') and ((itr[5]=='>') or (itr[5]==' '))  ){ // <style></style>
-					itr += 6+8;
-					while(
-						(itr[-8]!='<') or
-						(itr[-7]!='/') or
-						(itr[-6]!='s') or
-						(itr[-5]!='t') or
-						(itr[-4]!='y') or
-						(itr[-3]!='l') or
-						(itr[-2]!='e') or
-						(itr[-1]!='>')
-					){
-						if (unlikely(
-							(itr[-17]=='{') and
-							(itr[-16]=='\n') and
-							(itr[-15]=='\t') and
-							(itr[-14]=='d') and
-							(itr[-13]=='i') and
-							(itr[-12]=='s') and
-							(itr[-11]=='p') and
-							(itr[-10]=='l') and
-							(itr[-9 ]=='a') and
-							(itr[-8 ]=='y') and
-							(itr[-7 ]==':') and
-							(itr[-6 ]=='b') and
-							(itr[-5 ]=='l') and
-							(itr[-4 ]=='o') and
-							(itr[-3 ]=='c') and
-							(itr[-2 ]=='k') and
-							(itr[-1 ]==';')
-						)){ // display:block; // TODO: Improve? but why bother if it works for rpill
-							add_tagnames_to_ls(itr-17, noninline_div_tag_names);
-						}
-						if (unlikely(
-							(itr[-18]=='{') and
-							(itr[-17]=='\n') and
-							(itr[-16]=='\t') and
-							(itr[-15]=='d') and
-							(itr[-14]=='i') and
-							(itr[-13]=='s') and
-							(itr[-12]=='p') and
-							(itr[-11]=='l') and
-							(itr[-10]=='a') and
-							(itr[-9 ]=='y') and
-							(itr[-8 ]==':') and
-							(itr[-7 ]=='i') and
-							(itr[-6 ]=='n') and
-							(itr[-5 ]=='l') and
-							(itr[-4 ]=='i') and
-							(itr[-3 ]=='n') and
-							(itr[-2 ]=='e') and
-							(itr[-1 ]==';')
-						)){ // display:inline; // TODO: Improve? but why bother if it works for rpill
-							add_tagnames_to_ls(itr-18, inline_div_tag_names);
-						}
-						if (unlikely(
-							(itr[-24]=='{') and
-							(itr[-23]=='\n') and
-							(itr[-22]=='\t') and
-							(itr[-21]=='d') and
-							(itr[-20]=='i') and
-							(itr[-19]=='s') and
-							(itr[-18]=='p') and
-							(itr[-17]=='l') and
-							(itr[-16]=='a') and
-							(itr[-15]=='y') and
-							(itr[-14]==':') and
-							(itr[-13]=='i') and
-							(itr[-12]=='n') and
-							(itr[-11]=='l') and
-							(itr[-10]=='i') and
-							(itr[-9 ]=='n') and
-							(itr[-8 ]=='e') and
-							(itr[-7 ]=='-') and
-							(itr[-6 ]=='b') and
-							(itr[-5 ]=='l') and
-							(itr[-4 ]=='o') and
-							(itr[-3 ]=='c') and
-							(itr[-2 ]=='k') and
-							(itr[-1 ]==';')
-						)){ // display:inline-block; // TODO: Improve? but why bother if it works for rpill
-							add_tagnames_to_ls(itr-24, inline_div_tag_names);
-						}
-						++itr;
+					itr = skip_style_element(options, itr, tag_names, true);
+					if (unlikely(html_output.pagination != nullptr)){
+						html_output.pagination->styles.append(markdown-1, itr);
+						html_output.pagination->styles += '\n';
 					}
-					compsky::asciify::asciify(dest_itr, mkview(markdown-1,itr));
+					asciify_with_replacements(options, html_output, dest_itr, markdown-1, itr);
 					markdown = itr;
 					copy_this_char_into_html = false;
 				} else if (
@@ -532,33 +651,40 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 					if ((itr[-1] != '-') and ((*itr == '>') or (*itr == ' '))){
 						const std::size_t tagname_len = compsky::utils::ptrdiff(itr,tagname_start);
 						
-						if (*itr != '>'){
-							while((*itr != 0) and (*itr != '\n') and (*itr != '>'))
-								++itr;
-						}
+						if (*itr != '>')
+							itr = lookahead.find_stop(itr, '>');
 						if (likely(*itr == '>')){
 							if (itr[-1] != '/'){
 								if (not (
 									((tagname_start[0] == 'b') and (tagname_start[1] == 'r') and (tagname_len == 2))
 								)){
 									open_dom_tag_names.emplace_back(tagname_start, tagname_len);
+									if constexpr (is_collecting_stats)
+										++counts.n_tags_opened;
 								}
 							}
 							++itr;
 							
-							if (not (is_some_node(std::string_view(tagname_start,tagname_len), noninline_div_tag_names) or is_some_node(std::string_view(tagname_start,tagname_len), inline_div_tag_names))){
-								if (not is_some_node(std::string_view(tagname_start,tagname_len), warned_about_tag_names)){
+							const unsigned char tag_flags = tag_names.classify(std::string_view(tagname_start,tagname_len));
+							if ((tag_flags & (tag_noninline|tag_inline)) == 0){
+								if ((tag_flags & tag_warned_about) == 0){
 									fprintf(stderr, "WARNING: Node not given inline or block CSS rule: %.*s\n", (int)tagname_len, tagname_start);
-									warned_about_tag_names.emplace_back(tagname_start,tagname_len);
+									count_warning();
+									tag_names.add(std::string_view(tagname_start,tagname_len), tag_warned_about);
 								}
 							}
 							
-							compsky::asciify::asciify(dest_itr, mkview(markdown-1,itr));
+							asciify_with_replacements(options, html_output, dest_itr, markdown-1, itr);
 							markdown = itr;
 							copy_this_char_into_html = false;
 						}
 					}
 				} else if (*itr == '/'){
+					if (unlikely(open_dom_tag_names.size() == 0)){
+						set_error(state.error, ConversionError::unexpected_closing_tag, markdown-1, 200);
+						should_break_out = true;
+						break;
+					}
 					const std::string_view last_open_tagname = open_dom_tag_names[open_dom_tag_names.size()-1];
 					if (str_eq(itr+1, last_open_tagname) and (itr[1+last_open_tagname.size()] == '>')){
 						if (n_open_paragraphs != 0){
@@ -568,7 +694,9 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 							}
 						}
 						
-						compsky::asciify::asciify(dest_itr, '<', '/', last_open_tagname, '>');
+						compsky::asciify::asciify(dest_itr, '<', '/');
+						asciify_with_replacements(options, html_output, dest_itr, last_open_tagname.data(), last_open_tagname.data()+last_open_tagname.size());
+						compsky::asciify::asciify(dest_itr, '>');
 						markdown = itr+1 + last_open_tagname.size() + 1;
 						open_dom_tag_names.pop_back();
 						copy_this_char_into_html = false;
@@ -580,11 +708,13 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 							((itr[itr_sz+1] >= 'A') and (itr[itr_sz+1] <= 'Z'))
 						)
 							++itr_sz;
-						fprintf(stderr, "Expecting </%.*s> but received </%.*s>\n%.200s\n", (int)last_open_tagname.size(), last_open_tagname.data(), itr_sz, itr+1,  markdown-190); fflush(stdout);
-						abort();
+						state.error.kind = ConversionError::mismatched_closing_tag;
+						state.error.detail = "Expecting </" + std::string(last_open_tagname) + "> but received </" + std::string(itr+1, itr_sz) + ">";
+						should_break_out = true;
 					}
 				} else {
 					fprintf(stderr, "Treating < as NOT a tag: %.70s\n", markdown-35);
+					count_warning();
 				}
 				break;
 			}
@@ -607,12 +737,8 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 				break;
 			}
 			case '*': {
-				unsigned n_asterisks_l = 1;
-				const char* itr = markdown;
-				while(*itr == '*'){
-					++n_asterisks_l;
-					++itr;
-				}
+				const char* itr = lookahead.find_asterisk_run_end(markdown);
+				const unsigned n_asterisks_l = 1 + compsky::utils::ptrdiff(itr,markdown);
 				const char* const after_asterisks = itr;
 				if ((n_asterisks_l == 3) and was_newline_at(markdown_buf, markdown-2) and (*after_asterisks == '\n')){
 					n_open_paragraphs -= rm_paragraph_if_just_opened(dest_itr);
@@ -655,6 +781,7 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 							if (unlikely(not matched)){
 								is_invalid = true;
 								fprintf(stderr, "ERROR: Bad spacing in list at '%.3s': %.100s\n", markdown-1, markdown-50);
+								count_warning();
 							}
 						}
 					}
@@ -662,25 +789,20 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 						compsky::asciify::asciify(dest_itr, "\n");
 						write_n_spaces(dest_itr, line_began_with_n_spaces);
 						compsky::asciify::asciify(dest_itr, "<li>");
+						if constexpr (is_collecting_stats)
+							++counts.n_list_items;
 					}
 				} else {
 					if ((*after_asterisks != ' ') and (n_asterisks_l <= emphasis_max)){
 						const char* const start_of_emphasised_text = itr;
-						unsigned n_asterisks_r = 0;
-						while((*itr != 0) and (*itr != '\n')){
-							if (*itr != '*'){
-								n_asterisks_r = 0;
-							} else {
-								++n_asterisks_r;
-								if (n_asterisks_r == n_asterisks_l){
-									break;
-								}
-							}
-							++itr;
-						}
-						if (likely(n_asterisks_r == n_asterisks_l)){
+						itr = lookahead.find_emphasis_end(itr, n_asterisks_l);
+						if (likely(*itr == '*')){
 							// TODO: Deal with [links](https://...)
-							compsky::asciify::asciify(dest_itr, emphasis_open[n_asterisks_l-1], mkview(start_of_emphasised_text,itr+1-n_asterisks_r), emphasis_close[n_asterisks_l-1]);
+							compsky::asciify::asciify(dest_itr, emphasis_open[n_asterisks_l-1]);
+							if constexpr (is_collecting_stats)
+								++counts.n_emphases;
+							asciify_with_replacements(options, html_output, dest_itr, start_of_emphasised_text, itr+1-n_asterisks_l);
+							compsky::asciify::asciify(dest_itr, emphasis_close[n_asterisks_l-1]);
 							markdown = itr+1;
 							copy_this_char_into_html = false;
 						}
@@ -707,7 +829,12 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 				if (using_knitr_output){
 					// NOTE: There should be no ``` in the <script>
 					
-					if (was_newline_at(markdown_buf, markdown-2)){ // current character was the start of line
+					const char* const inline_R_end = ((markdown[0] == 'r') and (markdown[1] == ' ')) ? write_inline_function(options, html_output, dest_itr, markdown+2) : nullptr;
+					if (inline_R_end != nullptr){
+						// "`r f(args)`"   Inline R which only calls an inline function, whose result replaces it
+						markdown = inline_R_end;
+						copy_this_char_into_html = false;
+					} else if (was_newline_at(markdown_buf, markdown-2)){ // current character was the start of line
 						if ((markdown[0] == '`') and (markdown[1] == '`')){
 							bool is_badly_formatted_R_execstr = true;
 							if ((markdown[2] == 'r') and (markdown[3] == '\n')){
@@ -722,7 +849,9 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 								if ((markdown[6] == '[') and (markdown[7] == '1') and (markdown[8] == ']') and (markdown[9] == ' ') and (markdown[10] == '"')){
 									// "```\n## [1] \""   visible HTML output, as a string array of length 1
 									const char* itr = markdown+11;
-									while(*itr != '\n'){
+									while((*itr != '\n') and likely(not should_break_out)){
+										if (unlikely(dest_itr > html_output.flush_threshold))
+											html_output.flush(dest_itr);
 										switch(*itr){
 											case '\\':
 												++itr;
@@ -730,18 +859,24 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 													case '"':
 														break;
 													default:
-														log(markdown_buf, itr, "Unplanned escape char in knitr output", itr-10, 20);
-														abort();
+														set_error(state.error, ConversionError::bad_escape, itr-10, 20);
+														should_break_out = true;
 												}
 												break;
+											case 'R':
+												if (unlikely(startswithreplace(itr)) and asciify_replacement(options, html_output, dest_itr, itr))
+													break;
 											default:
 												compsky::asciify::asciify(dest_itr, *itr);
 										}
 										++itr;
 									}
-									if ((itr[1] != '`') or (itr[2] != '`') or (itr[3] != '`')){
-										log(markdown_buf, itr, "Bad R output", markdown+11-10, 30);
-										abort();
+									if (unlikely(should_break_out)){
+										is_badly_formatted_R_execstr = false; // Stopped at the bad escape
+									} else if ((itr[1] != '`') or (itr[2] != '`') or (itr[3] != '`')){
+										set_error(state.error, ConversionError::bad_knitr_output, markdown+11-10, 30);
+										should_break_out = true;
+										is_badly_formatted_R_execstr = false;
 									} else {
 										itr += 4;
 										if (dest_itr[-1] == '"')
@@ -757,6 +892,15 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 									markdown = itr+4;
 									is_badly_formatted_R_execstr = false;
 								}
+							} else if (markdown[2] == '{'){
+								// "```{r child = 'PATH'}\n```" The chunk which includes a child document
+								const char* const chunk_end = include_child_chunk(options, markdown_input, html_output, dest_itr, n_open_paragraphs, markdown-1, state.error);
+								if (chunk_end != nullptr){
+									if (unlikely(state.error))
+										should_break_out = true;
+									markdown = chunk_end;
+									is_badly_formatted_R_execstr = false;
+								}
 							}
 							if (unlikely(is_badly_formatted_R_execstr)){
 								log(markdown_buf, markdown, "Bad inline R", markdown-1, 100);
@@ -771,10 +915,9 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 				} else {
 					bool is_badly_formatted_R_execstr = true;
 					if ((markdown[0] == 'r') and (markdown[1] == ' ')){
-						const char* const R_statement_end = str_if_ends_with__before(markdown+2, '`', '\n');
-						if (likely(R_statement_end != markdown+2-1)){
-							printf("Inline R: %.*s\n", (int)compsky::utils::ptrdiff(R_statement_end,markdown+2-1), markdown+2); fflush(stdout);
-							markdown = R_statement_end + 2;
+						const char* const inline_R_end = write_inline_function(options, html_output, dest_itr, markdown+2);
+						if (likely(inline_R_end != nullptr)){
+							markdown = inline_R_end;
 							is_badly_formatted_R_execstr = false;
 						}
 					} else if ((markdown[0] == '`') and (markdown[1] == '`') and (markdown[2] == '{') and (markdown[3] == 'r')){
@@ -783,12 +926,12 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 							if (likely(R_statement_end != markdown+6-1)){
 								is_badly_formatted_R_execstr = false;
 							}
-						} else if ((markdown[4] == ' ') and (markdown[5] == 'c') and (markdown[6] == 'h') and (markdown[7] == 'i') and (markdown[8] == 'l') and (markdown[9] == 'd') and (markdown[10] == ' ') and (markdown[11] == '=') and (markdown[12] == ' ') and (markdown[13] == '\'')){
-							const char* const filepath_end = str_if_ends_with__before(markdown+14, '\'', '\n');
-							const char* const R_statement_end = str_if_ends_with3(markdown+14, '`','`','`');
-							if ((likely(filepath_end != markdown+14-1)) and (likely(R_statement_end != markdown+14-1))){
-								printf("CHILD %.*s\n", (int)compsky::utils::ptrdiff(filepath_end+1,markdown+14), markdown+14);
-								markdown = R_statement_end+3+2;
+						} else {
+							const char* const chunk_end = include_child_chunk(options, markdown_input, html_output, dest_itr, n_open_paragraphs, markdown-1, state.error);
+							if (chunk_end != nullptr){
+								if (unlikely(state.error))
+									should_break_out = true;
+								markdown = chunk_end;
 								is_badly_formatted_R_execstr = false;
 							}
 						}
@@ -800,6 +943,14 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 				}
 				break;
 			}
+			case 'R': {
+				const char* itr = markdown-1;
+				if (unlikely(startswithreplace(itr)) and asciify_replacement(options, html_output, dest_itr, itr)){
+					markdown = itr+1;
+					copy_this_char_into_html = false;
+				}
+				break;
+			}
 			case '\\': {
 				switch(*markdown){
 					case '\\':
@@ -810,11 +961,9 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 						break;
 					case '"':
 						break;
-					default: {
-						const char* itr = markdown;
-						log(markdown_buf, itr, "Bad escape", markdown-50, 101);
-						abort();
-					}
+					default:
+						set_error(state.error, ConversionError::bad_escape, markdown-50, 101);
+						should_break_out = true;
 				}
 				break;
 			}
@@ -826,15 +975,19 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 					line_began_with_n_spaces = 1 + compsky::utils::ptrdiff(itr,markdown);
 					if (*itr == '\n'){
 						fprintf(stderr, "WARNING: Empty line containing %u whitespaces\n", line_began_with_n_spaces);
+						count_warning();
 						line_began_with_n_spaces = 0;
 						markdown = itr;
 					} else {
 						if (spaces_per_list_depth.size() == 0){
-							if (itr[0] != '<')
+							if (itr[0] != '<'){
 								fprintf(stderr, "ERROR: Line starts with ' ' and not in <ul>: >>>%.100s<<<\n", markdown-1);
+								count_warning();
+							}
 						} else {
 							if (unlikely((itr[0] != '*') or (itr[1] != ' '))){
 								fprintf(stderr, "ERROR: Line starts with ' ' and is after <ul> but no '* ': >>>%.100s<<<\n", markdown-1);
+								count_warning();
 							} else {
 								// copy_this_char_into_html = true; because line_began_with_n_spaces already deals with this
 							}
@@ -850,25 +1003,91 @@ char* md_to_html(const char* const filepath,  char* const dest_buf){
 			compsky::asciify::asciify(dest_itr, current_c);
 		}
 	}
-	if (open_dom_tag_names.size() != 0){
-		for (unsigned i = 0;  i < open_dom_tag_names.size();  ++i){
-			const std::string_view s = open_dom_tag_names[open_dom_tag_names.size()-i-1];
-			fprintf(stderr, "Unclosed tag: %.*s\n", (int)s.size(), s.data());
-		}
-		fflush(stderr);
-		abort();
+	state.is_in_blockquote = is_in_blockquote;
+	state.n_open_paragraphs = n_open_paragraphs;
+	state.dom_tag_depth_for_opening_of_paragraph = dom_tag_depth_for_opening_of_paragraph;
+	state.is_in_anchor_whose_title_ends_at = is_in_anchor_whose_title_ends_at;
+	state.is_in_anchor_which_ends_at = is_in_anchor_which_ends_at;
+	state.line_began_with_n_spaces = line_began_with_n_spaces;
+	state.done_left_quote_mark = done_left_quote_mark;
+	if constexpr (is_collecting_stats)
+		conversion_stats->add(counts);
+	return markdown;
+}
+
+const char* md_to_html_blocks(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output,  MarkdownState& state,  char*& dest_itr,  const char* markdown,  const char* markdown_buf,  const char* const stop_at){
+	// Converts from markdown until stop_at, or until the end of the document if stop_at is nullptr. Returns where it stopped, which is short of either if state.error is set.
+	if (unlikely(conversion_stats != nullptr)){
+		PhaseTimer timer(&ConversionStats::parse_ns, &ConversionStats::parse_counters);
+		return convert_blocks<true>(options, markdown_input, html_output, state, dest_itr, markdown, markdown_buf, stop_at);
 	}
-	compsky::asciify::asciify(dest_itr, "</body></html>", '\0');
-	
-	{
-		char* dest_itr1 = dest_buf + HALF_BUF_SZ;
-		char* dest_itr2 = dest_buf;
-		while(*dest_itr1 != 0){
-			if (likely(not replace_strings(dest_itr2, dest_itr1))){
-				compsky::asciify::asciify(dest_itr2, *dest_itr1);
-			}
-			++dest_itr1;
-		}
-		return dest_itr2;
+	return convert_blocks<false>(options, markdown_input, html_output, state, dest_itr, markdown, markdown_buf, stop_at);
+}
+
+static
+bool set_error_if_unclosed(MarkdownState& state){
+	if (state.open_dom_tag_names.size() == 0)
+		return false;
+	state.error.kind = ConversionError::unclosed_tag;
+	for (unsigned i = 0;  i < state.open_dom_tag_names.size();  ++i){
+		if (i != 0)
+			state.error.detail += ' ';
+		state.error.detail += state.open_dom_tag_names[state.open_dom_tag_names.size()-i-1];
 	}
+	return true;
+}
+
+void md_to_html_end(MarkdownState& state,  char*& dest_itr){
+	if (set_error_if_unclosed(state))
+		return;
+	compsky::asciify::asciify(dest_itr, "</body></html>");
+}
+
+ConversionError md_to_html(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output){
+	// Nothing more is written if an error is returned, so the output is incomplete
+	if (options.is_tree_needed())
+		return md_to_html_via_tree(options, markdown_input, html_output);
+	conversion_stats = options.stats;
+	html_output.minifier.level = options.minify_level;
+	char* dest_itr = html_output.begin();
+	MarkdownState state(options);
+	if (unlikely(markdown_input.is_null())){
+		state.error.kind = ConversionError::cannot_read_input;
+		state.error.detail = markdown_input.filepath;
+		return state.error;
+	}
+	convert_children_ahead(options, markdown_input);
+	const std::size_t span_min_sz = html_output.span_min_sz;
+	if (html_output.pagination != nullptr)
+		html_output.span_min_sz = SIZE_MAX; // So that the <head> is all in the buffer, to be repeated on each page
+	const char* const markdown = md_to_html_begin(options, markdown_input, html_output, dest_itr);
+	html_output.span_min_sz = span_min_sz;
+	if (html_output.pagination != nullptr)
+		html_output.pagination->begin(html_output.buf, dest_itr);
+	md_to_html_blocks(options, markdown_input, html_output, state, dest_itr, markdown, markdown_input.window_begin, nullptr);
+	if (likely(not state.error) and (html_output.pagination != nullptr))
+		html_output.pagination->write_nav(dest_itr, false);
+	if (likely(not state.error))
+		md_to_html_end(state, dest_itr);
+	if (likely(not state.error))
+		html_output.finish(dest_itr);
+	return state.error;
+}
+
+ConversionError md_to_html_fragment(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output){
+	// Only the HTML of the document's blocks is written - without the <head>, or the front matter it is from - and the document must close every tag it opens
+	char* dest_itr = html_output.begin();
+	MarkdownState state(options);
+	if (unlikely(markdown_input.is_null())){
+		state.error.kind = ConversionError::cannot_read_input;
+		state.error.detail = markdown_input.filepath;
+		return state.error;
+	}
+	convert_children_ahead(options, markdown_input);
+	std::string_view titlestr;
+	const char* const markdown = skip_front_matter(markdown_input.window_begin, titlestr);
+	md_to_html_blocks(options, markdown_input, html_output, state, dest_itr, markdown, markdown_input.window_begin, nullptr);
+	if (likely(not state.error) and likely(not set_error_if_unclosed(state)))
+		html_output.finish(dest_itr);
+	return state.error;
 }
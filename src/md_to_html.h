@@ -1,13 +1,25 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
 #include <cstring>
+#include <atomic>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <compsky/os/metadata.hpp>
+#include "tag_names.h"
 
-constexpr std::size_t HALF_BUF_SZ = 1024*1024*50;
+struct MarkdownInput;
+struct HtmlOutput;
+struct ReplacementTable;
+struct ConversionStats;
+struct StyleCache;
+struct ChildCache;
+struct ChildInclusion;
+struct InlineFunctionCache;
 
 constexpr
 bool startswithreplace(const char* const str){
@@ -29,39 +41,128 @@ bool startswithreplace(const char* const str){
 	);
 }
 
-char* md_to_html(const char* const filepath,  char* const dest_buf);
+struct ConversionOptions {
+	// Everything md_to_html is configured by. It keeps no other state between calls, so any number of documents can be converted at once, on any threads, with the same options.
+	const char* blockquote_tagname;
+	const ReplacementTable* replacements; // The -R files. nullptr for none.
+	ConversionStats* stats; // nullptr unless timings and counts are wanted. Can be shared by concurrent conversions.
+	StyleCache* style_cache; // The display rules of the stylesheets seen so far, for documents which share them. nullptr for none. Can be shared by concurrent conversions.
+	ChildCache* child_cache; // The HTML of the child documents included so far. nullptr for none, so that a child is converted wherever it is included. Can be shared by concurrent conversions.
+	const ChildInclusion* child_inclusion; // If the document is a child of another, the chain of documents including it. nullptr otherwise.
+	InlineFunctionCache* inline_function_cache; // The results of the inline function calls seen so far. nullptr for none, so that each call is computed. Can be shared by concurrent conversions.
+	bool include_comment_nodes;
+	bool print_debug; // Prints each character to stdout as it is converted
+	bool is_via_tree; // Renders the HTML from a DocumentTree of it, holding the whole output in memory. Implied by the transforms below.
+	bool is_numbering_headings;
+	bool is_adding_toc;
+	unsigned char minify_level; // Of the HtmlMinifier which the output is minified by as it is written: 0 for none, 1 for whitespace, 2 for the whitespace and comments of <style> elements too
+
+	ConversionOptions()
+	: blockquote_tagname("blockquote")
+	, replacements(nullptr)
+	, stats(nullptr)
+	, style_cache(nullptr)
+	, child_cache(nullptr)
+	, child_inclusion(nullptr)
+	, inline_function_cache(nullptr)
+	, include_comment_nodes(false)
+	, print_debug(false)
+	, is_via_tree(false)
+	, is_numbering_headings(false)
+	, is_adding_toc(false)
+	, minify_level(0)
+	{}
+
+	bool is_tree_needed() const {
+		return (this->is_via_tree or this->is_numbering_headings or this->is_adding_toc);
+	}
+};
+
+struct ConversionError {
+	// Why md_to_html stopped short of the end of a document, having written only part of it
+	enum Kind : unsigned char {
+		none,
+		cannot_read_input,
+		unexpected_closing_tag,
+		mismatched_closing_tag,
+		bad_escape,
+		bad_knitr_output,
+		unclosed_tag,
+		cannot_read_child, // Which cannot be found
+		child_cycle // A child document which includes - or whose children include - a document including it
+	};
+	Kind kind;
+	std::string detail; // The source around the error, or the tags involved
+
+	ConversionError()
+	: kind(none)
+	{}
+
+	explicit operator bool() const {
+		return (this->kind != none);
+	}
+	const char* name() const;
+};
+
+struct MarkdownState {
+	// What md_to_html carries from one block to the next
+	std::vector<std::string_view> open_dom_tag_names;
+	TagNames tag_names; // Extended by the display rules of <style> elements
+	std::vector<unsigned> spaces_per_list_depth;
+	std::deque<std::string> preserved_tag_names;
+	const char* is_in_anchor_whose_title_ends_at;
+	const char* is_in_anchor_which_ends_at;
+	unsigned n_open_paragraphs;
+	unsigned dom_tag_depth_for_opening_of_paragraph;
+	unsigned line_began_with_n_spaces;
+	bool is_in_blockquote;
+	bool done_left_quote_mark;
+	ConversionError error; // Set when md_to_html_blocks stops short
+
+	explicit MarkdownState(const ConversionOptions& options);
+	bool operator==(const MarkdownState& othr) const;
+};
+
+const char* md_to_html_begin(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output,  char*& dest_itr);
+const char* md_to_html_blocks(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output,  MarkdownState& state,  char*& dest_itr,  const char* markdown,  const char* markdown_buf,  const char* const stop_at);
+void md_to_html_end(MarkdownState& state,  char*& dest_itr);
+ConversionError md_to_html(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output);
+ConversionError md_to_html_fragment(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output); // For a document included in another, such as a child document
+const char* skip_style_element(const ConversionOptions& options,  const char* itr,  TagNames& tag_names,  const bool is_reporting);
 
 struct Filename {
+	// Only the name is known up front: the contents are mapped on first use, so that the cost of a -R directory scales with the files actually used
 	std::string_view name;
-	std::string_view contents;
-	unsigned n_uses;
-	Filename(char(&filepath)[4096],  const unsigned dirpath_len,  const char* _name)
-	: n_uses(0)
+	const char* filepath;
+	// The rest are mutable so that a ReplacementTable can be shared, as const, by concurrent conversions
+	mutable std::atomic<const char*> contents_data; // nullptr until mapped
+	mutable std::atomic<std::size_t> contents_sz;
+	mutable std::atomic<unsigned> n_uses; // Incremented by every thread converting a document which uses it
+	Filename(char(&_filepath)[4096],  const unsigned dirpath_len,  const char* _name)
+	: contents_data(nullptr)
+	, contents_sz(0)
+	, n_uses(0)
 	{
 		std::size_t fname_len = strlen(_name);
-		memcpy(filepath+dirpath_len, _name, fname_len+1);
+		memcpy(_filepath+dirpath_len, _name, fname_len+1);
+		char* const _buf = reinterpret_cast<char*>(malloc(dirpath_len + fname_len + 1));
+		memcpy(_buf, _filepath, dirpath_len + fname_len + 1);
+		this->filepath = _buf;
+		_name = _buf + dirpath_len;
 		if (unlikely(not startswithreplace(_name))){
 			fprintf(stderr, "WARNING: File does not begin with R_E_P_L_A_C_E_: %.*s\n", (int)fname_len, _name);
 		} else {
 			_name += 14;
 			fname_len -= 14;
 		}
-		
-		char* const _buf1 = reinterpret_cast<char*>(malloc(fname_len));
-		memcpy(_buf1, _name, fname_len);
-		this->name = std::string_view(_buf1, fname_len);
-		
-		const std::size_t f_sz = compsky::os::get_file_sz<0>(filepath);
-		char* _buf = reinterpret_cast<char*>(malloc(f_sz));
-		const int fd = open(filepath, O_RDONLY);
-		read(fd, _buf, f_sz);
-		close(fd);
-		this->contents = std::string_view(_buf, f_sz);
+		this->name = std::string_view(_name, fname_len);
 	}
 	void deepcopy(const Filename& othr){
 		this->name = othr.name;
-		this->contents = othr.contents;
-		this->n_uses = othr.n_uses;
+		this->filepath = othr.filepath;
+		this->contents_data.store(othr.contents_data.load());
+		this->contents_sz.store(othr.contents_sz.load());
+		this->n_uses.store(othr.n_uses.load());
 	}
 	Filename& operator =(const Filename&& othr){
 		this->deepcopy(othr);
@@ -71,5 +172,7 @@ struct Filename {
 		this->deepcopy(othr);
 	}
 	~Filename(){}
-	void deconstruct() const;
+	std::string_view contents() const;
+	void forget_contents();
+	void deconstruct(const bool is_reporting_unused) const;
 };
@@ -0,0 +1,423 @@
+#include "minify.h"
+#include "stats.h"
+#include "tag_names.h"
+
+#include <compsky/macros/likely.hpp>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#if defined(__x86_64__)
+# include <immintrin.h>
+#endif
+
+
+enum MinifyCharKind : unsigned char {
+	plain_char,
+	space_char,
+	less_than_char
+};
+
+static
+constexpr std::array<unsigned char, 256> make_minify_char_kinds(){
+	std::array<unsigned char, 256> kinds{};
+	kinds[' '] = space_char;
+	kinds['\t'] = space_char;
+	kinds['\n'] = space_char;
+	kinds['\r'] = space_char;
+	kinds['<'] = less_than_char;
+	return kinds;
+}
+static constexpr std::array<unsigned char, 256> minify_char_kinds = make_minify_char_kinds();
+
+static
+unsigned char kind_of(const char c){
+	return minify_char_kinds[static_cast<unsigned char>(c)];
+}
+
+static
+const char* find_text_run_end_scalar(const char* itr,  const char* const end){
+	// Of the plain characters, and the single whitespace characters between them, which are written as they are
+	while(itr != end){
+		if (kind_of(*itr) == plain_char){
+			++itr;
+		} else if ((kind_of(*itr) == space_char) and (itr+1 != end) and (kind_of(itr[1]) == plain_char)){
+			itr += 2;
+		} else {
+			break;
+		}
+	}
+	return itr;
+}
+
+#if defined(__x86_64__)
+static
+const char* find_text_run_end(const char* itr,  const char* const end){
+	// Each vector is compared with itself shifted by one byte, to find the whitespace followed by whitespace or a '<'. Does not read past end.
+	const auto space_mask = [](const __m128i v){
+		__m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+		return m;
+	};
+	const auto nonplain_mask = [&space_mask](const __m128i v){
+		return static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(space_mask(v), _mm_cmpeq_epi8(v, _mm_set1_epi8('<')))));
+	};
+	while(end - itr > 16){
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr));
+		const unsigned spaces = _mm_movemask_epi8(space_mask(v));
+		const unsigned nonplain = nonplain_mask(v);
+		const unsigned next_nonplain = nonplain_mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(itr+1)));
+		const unsigned stops = (nonplain & ~spaces) | (spaces & next_nonplain);
+		if (stops != 0)
+			return itr + __builtin_ctz(stops);
+		itr += 16;
+	}
+	return find_text_run_end_scalar(itr, end);
+}
+#else
+static
+const char* find_text_run_end(const char* itr,  const char* const end){
+	return find_text_run_end_scalar(itr, end);
+}
+#endif
+
+static
+void copy_run(char*& dest_itr,  const char*& itr,  const char* const run_end){
+	// Nothing is copied until something has been removed
+	const std::size_t n = run_end - itr;
+	if (dest_itr != itr)
+		memmove(dest_itr, itr, n);
+	dest_itr += n;
+	itr = run_end;
+}
+
+static
+bool is_tag_name_char(const char c){
+	return (((c >= 'a') and (c <= 'z')) or ((c >= 'A') and (c <= 'Z')) or ((c >= '0') and (c <= '9')) or (c == '-'));
+}
+
+static
+const char* find_attribute_run_end(const char* itr,  const char* const end){
+	// Of an attribute name or unquoted value, written as it is
+	while((itr != end) and (kind_of(*itr) == plain_char) and (*itr != '>') and (*itr != '"') and (*itr != '\''))
+		++itr;
+	return itr;
+}
+
+static
+char to_lower(const char c){
+	return ((c >= 'A') and (c <= 'Z')) ? (c + ('a' - 'A')) : c;
+}
+
+// Whitespace next to these is not rendered, unless a stylesheet makes them inline. They are found by a perfect hash, as TagNames finds its built in tag names.
+static constexpr std::string_view block_tag_names[] = {
+	"address", "article", "aside", "blockquote", "body", "br", "caption", "col", "colgroup", "dd", "details", "dialog", "div", "dl", "dt", "fieldset", "figcaption", "figure", "footer", "form", "h1", "h2", "h3", "h4", "h5", "h6", "head", "header", "hr", "html", "legend", "li", "link", "main", "meta", "nav", "ol", "optgroup", "option", "p", "pre", "section", "summary", "table", "tbody", "td", "tfoot", "th", "thead", "title", "tr", "ul"
+};
+constexpr std::size_t BLOCK_TAG_TABLE_SZ = 512;
+
+static
+constexpr uint32_t find_block_tag_seed(){
+	for (uint32_t seed = 2166136261u;  ;  ++seed){
+		bool is_used[BLOCK_TAG_TABLE_SZ] = {};
+		bool is_perfect = true;
+		for (const std::string_view name : block_tag_names){
+			const uint32_t slot = hash_tag_name(name, seed) % BLOCK_TAG_TABLE_SZ;
+			if (is_used[slot]){
+				is_perfect = false;
+				break;
+			}
+			is_used[slot] = true;
+		}
+		if (is_perfect)
+			return seed;
+	}
+}
+static constexpr uint32_t block_tag_seed = find_block_tag_seed();
+
+static
+constexpr std::array<unsigned char,BLOCK_TAG_TABLE_SZ> make_block_tag_table(){
+	// Slot => index into block_tag_names, or 0xff
+	std::array<unsigned char,BLOCK_TAG_TABLE_SZ> table{};
+	for (unsigned char& indx : table)
+		indx = 0xff;
+	for (std::size_t i = 0;  i < std::size(block_tag_names);  ++i)
+		table[hash_tag_name(block_tag_names[i], block_tag_seed) % BLOCK_TAG_TABLE_SZ] = i;
+	return table;
+}
+static constexpr std::array<unsigned char,BLOCK_TAG_TABLE_SZ> block_tag_table = make_block_tag_table();
+
+static
+constexpr std::array<uint16_t,26> make_block_tag_lengths(){
+	// First letter => bitset of the lengths of the names beginning with it, so that most inline tag names - a, em, span - are ruled out without hashing them
+	std::array<uint16_t,26> lengths{};
+	for (const std::string_view name : block_tag_names)
+		lengths[name[0] - 'a'] |= (1 << name.size());
+	return lengths;
+}
+static constexpr std::array<uint16_t,26> block_tag_lengths = make_block_tag_lengths();
+
+static
+bool is_block_tag_name(const std::string_view name){
+	if ((name.size() == 0) or (name.size() > 15) or (name[0] < 'a') or (name[0] > 'z') or ((block_tag_lengths[name[0] - 'a'] & (1 << name.size())) == 0))
+		return false;
+	const unsigned char indx = block_tag_table[hash_tag_name(name, block_tag_seed) % BLOCK_TAG_TABLE_SZ];
+	return ((indx != 0xff) and (block_tag_names[indx] == name));
+}
+
+static
+bool is_block_tag_at(const char* itr,  const char* const limit){
+	// itr is at a '<'. False if the tag name is not wholly before limit.
+	++itr;
+	if ((itr != limit) and (*itr == '/'))
+		++itr;
+	char name[11];
+	std::size_t name_len = 0;
+	while((itr != limit) and is_tag_name_char(*itr)){
+		if (name_len == sizeof(name))
+			return false;
+		name[name_len++] = to_lower(*itr);
+		++itr;
+	}
+	return ((itr != limit) and (name_len != 0) and is_block_tag_name(std::string_view(name, name_len)));
+}
+
+static
+const char* find_space_run_end(const char* itr,  const char* const limit){
+	while((itr != limit) and (kind_of(*itr) == space_char))
+		++itr;
+	return itr;
+}
+
+static
+bool is_css_space_insignificant_before(const char c){
+	return ((c == '{') or (c == '}') or (c == ';') or (c == ',') or (c == '>') or (c == ')'));
+}
+
+static
+bool is_css_space_insignificant_after(const char c){
+	return ((c == '{') or (c == '}') or (c == ';') or (c == ',') or (c == '>') or (c == ':') or (c == '('));
+}
+
+
+void HtmlMinifier::reset(){
+	this->state = text;
+	this->is_after_space = false;
+	this->is_at_block_boundary = true;
+	this->is_closing_tag = false;
+	this->is_escaped = false;
+	this->quote = 0;
+	this->name_len = 0;
+	this->n_matched = 0;
+}
+
+void HtmlMinifier::end_tag(const bool is_block){
+	const std::string_view name(this->name, (this->name_len <= sizeof(this->name)) ? this->name_len : 0);
+	this->is_at_block_boundary = is_block;
+	this->state = text;
+	if (not this->is_closing_tag){
+		if ((name == "pre") or (name == "textarea") or (name == "script"))
+			this->state = raw;
+		else if (name == "style")
+			this->state = (this->level >= 2) ? css : raw;
+		this->n_matched = 0;
+		this->is_at_block_boundary |= (this->state == css);
+	}
+}
+
+char* HtmlMinifier::minify(char* const begin,  const char* const end,  const char* const limit,  const bool is_last){
+	// Writing never overtakes reading, as nothing is written but what has been read, less what is removed
+	// Whether a run of whitespace is significant is decided by looking past it, up to limit, rather than by writing a space and removing it once what follows shows it to be insignificant - which could not be done once the space was flushed. So the output does not depend on where the document is split between calls.
+	PhaseTimer timer(&ConversionStats::minify_ns, &ConversionStats::minify_counters);
+	const char* itr = begin;
+	char* dest_itr = begin;
+	while(itr != end){
+		const char c = *itr;
+		switch(this->state){
+			case text:
+				if (kind_of(c) == plain_char){
+					// The common case: a run of text, with single spaces or newlines between its words
+					copy_run(dest_itr, itr, find_text_run_end(itr+1, end));
+					this->is_after_space = false;
+					this->is_at_block_boundary = false;
+				} else if (kind_of(c) == space_char){
+					const char* const run_end = find_space_run_end(itr, limit);
+					if (not (this->is_after_space or this->is_at_block_boundary)){
+						const bool is_insignificant = (run_end == limit) ? is_last : ((kind_of(*run_end) == less_than_char) and is_block_tag_at(run_end, limit));
+						if (not is_insignificant)
+							*(dest_itr++) = (memchr(itr, '\n', run_end - itr) == nullptr) ? ' ' : '\n'; // So that lines stay short
+						this->is_after_space = true;
+					}
+					itr = (run_end < end) ? run_end : end;
+				} else {
+					// A tag without attributes, such as <p> or </em>, is written at once
+					const char* const name_begin = ((itr+1 != end) and (itr[1] == '/')) ? itr+2 : itr+1;
+					const char* name_end = name_begin;
+					while((name_end != end) and is_tag_name_char(*name_end))
+						++name_end;
+					if ((name_end != end) and (*name_end == '>') and (name_end != name_begin) and (*name_begin != '-') and (static_cast<std::size_t>(name_end - name_begin) <= sizeof(this->name))){
+						this->is_closing_tag = (name_begin != itr+1);
+						this->name_len = name_end - name_begin;
+						for (unsigned i = 0;  i < this->name_len;  ++i)
+							this->name[i] = to_lower(name_begin[i]);
+						copy_run(dest_itr, itr, name_end+1);
+						this->is_after_space = false;
+						this->end_tag(is_block_tag_name(std::string_view(this->name, this->name_len)));
+						break;
+					}
+					*(dest_itr++) = *(itr++);
+					this->state = tag_open;
+					this->is_after_space = false;
+					this->is_at_block_boundary = false;
+				}
+				break;
+			case tag_open:
+				if (is_tag_name_char(c) and (c != '-')){
+					this->state = tag_name;
+					this->is_closing_tag = false;
+					this->name_len = 0;
+				} else if (c == '/'){
+					*(dest_itr++) = *(itr++);
+					this->state = tag_name;
+					this->is_closing_tag = true;
+					this->name_len = 0;
+				} else if (c == '!'){
+					*(dest_itr++) = *(itr++);
+					this->state = declaration;
+					this->n_matched = 0;
+				} else {
+					this->state = text; // Not a tag, e.g. "a < b"
+				}
+				break;
+			case tag_name:
+				if (is_tag_name_char(c)){
+					if (this->name_len < sizeof(this->name))
+						this->name[this->name_len] = to_lower(c);
+					if (this->name_len != UINT8_MAX)
+						++this->name_len;
+					*(dest_itr++) = *(itr++);
+				} else {
+					this->state = tag;
+				}
+				break;
+			case tag:
+				if ((kind_of(c) == plain_char) and (c != '>') and (c != '"') and (c != '\'')){
+					copy_run(dest_itr, itr, find_attribute_run_end(itr+1, end));
+					this->is_after_space = false;
+					break;
+				}
+				if (kind_of(c) == space_char){
+					const char* const run_end = find_space_run_end(itr, limit);
+					if ((not this->is_after_space) and ((run_end == limit) or (*run_end != '>')))
+						*(dest_itr++) = ' ';
+					this->is_after_space = true;
+					itr = (run_end < end) ? run_end : end;
+					break;
+				}
+				*(dest_itr++) = *(itr++);
+				this->is_after_space = false;
+				if ((c == '"') or (c == '\'')){
+					this->quote = c;
+					this->state = tag_quoted;
+				} else if (c == '>'){
+					this->end_tag(is_block_tag_name(std::string_view(this->name, (this->name_len <= sizeof(this->name)) ? this->name_len : 0)));
+				}
+				break;
+			case tag_quoted: {
+				const char* const quote_end = reinterpret_cast<const char*>(memchr(itr, this->quote, end - itr));
+				copy_run(dest_itr, itr, (quote_end == nullptr) ? end : quote_end+1);
+				if (quote_end != nullptr)
+					this->state = tag;
+				break;
+			}
+			case declaration:
+				if ((c == '-') and (this->n_matched == 0)){
+					*(dest_itr++) = *(itr++);
+					this->n_matched = 1;
+				} else if ((c == '-') and (this->n_matched == 1)){
+					*(dest_itr++) = *(itr++);
+					this->state = comment;
+					this->n_matched = 0;
+				} else {
+					// Such as <!DOCTYPE html>
+					this->state = tag;
+					this->is_closing_tag = true;
+					this->name_len = 0;
+				}
+				break;
+			case comment:
+				*(dest_itr++) = *(itr++);
+				if (c == '-'){
+					if (this->n_matched != 2)
+						++this->n_matched;
+				} else {
+					if ((c == '>') and (this->n_matched == 2)){
+						this->state = text;
+						this->is_at_block_boundary = false;
+					}
+					this->n_matched = 0;
+				}
+				break;
+			default: {
+				// raw, css or css_quoted: ended by the first "</NAME", wherever it is, as in a browser
+				const char expected = (this->n_matched == 0) ? '<' : (this->n_matched == 1) ? '/' : this->name[this->n_matched-2];
+				if (to_lower(c) == expected)
+					++this->n_matched;
+				else
+					this->n_matched = (c == '<') ? 1 : 0;
+				if (this->state == raw){
+					*(dest_itr++) = *(itr++);
+					if (this->n_matched == 0){
+						const char* const less_than = reinterpret_cast<const char*>(memchr(itr, '<', end - itr));
+						copy_run(dest_itr, itr, (less_than == nullptr) ? end : less_than);
+					}
+				} else if (this->state == css_quoted){
+					*(dest_itr++) = *(itr++);
+					if (this->is_escaped)
+						this->is_escaped = false;
+					else if (c == '\\')
+						this->is_escaped = true;
+					else if ((c == this->quote) or (c == '\n'))
+						this->state = css;
+				} else if (kind_of(c) == space_char){
+					const char* const run_end = find_space_run_end(itr, limit);
+					if ((not (this->is_after_space or this->is_at_block_boundary)) and ((run_end == limit) or not is_css_space_insignificant_before(*run_end)))
+						*(dest_itr++) = ' ';
+					this->is_after_space = true;
+					itr = (run_end < end) ? run_end : end;
+				} else {
+					if ((c == '/') and (this->n_matched == 0) and (itr+1 != end) and (itr[1] == '*')){
+						// A comment is only removed if it ends before end, and does not contain what could end the element
+						const char* const comment_end = reinterpret_cast<const char*>(memmem(itr+2, end - (itr+2), "*/", 2));
+						if ((comment_end != nullptr) and (memchr(itr, '<', comment_end - itr) == nullptr)){
+							itr = comment_end + 2;
+							// It separates what is either side of it, as whitespace does
+							if ((not (this->is_after_space or this->is_at_block_boundary)) and ((itr == limit) or ((kind_of(*itr) != space_char) and not is_css_space_insignificant_before(*itr)))){
+								*(dest_itr++) = ' ';
+								this->is_after_space = true;
+							}
+							break;
+						}
+					}
+					*(dest_itr++) = *(itr++);
+					this->is_after_space = false;
+					this->is_at_block_boundary = is_css_space_insignificant_after(c);
+					if ((c == '"') or (c == '\'')){
+						this->quote = c;
+						this->is_escaped = false;
+						this->state = css_quoted;
+					}
+				}
+				if (this->n_matched == 2 + this->name_len){
+					// Continues as the closing tag
+					this->state = tag_name;
+					this->is_closing_tag = true;
+					this->is_after_space = false;
+					this->is_at_block_boundary = false;
+				}
+			}
+		}
+	}
+	return dest_itr;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+
+
+struct HtmlMinifier {
+	// Removes the insignificant whitespace of HTML, in place, as HtmlOutput writes it: a run of whitespace is collapsed to a single space or newline, and is removed altogether next to a block-level tag such as <p> or </li>, except within <pre>, <textarea>, <script> and <style>, and within quoted attributes
+	// At level 2, the whitespace and comments of <style> elements are removed too
+	// Its state is carried from one call to the next, as a document is written in parts
+	enum State : unsigned char {
+		text,
+		tag_open, // After a '<'
+		tag_name,
+		tag, // Its attributes
+		tag_quoted,
+		declaration, // After "<!", such as a comment or <!DOCTYPE
+		comment,
+		raw, // The contents of <pre>, <textarea> or <script> - or of <style> below level 2 - which are written as they are
+		css,
+		css_quoted
+	};
+	unsigned char level; // 0 for none, otherwise as above
+	State state;
+	bool is_after_space; // Whether the run of whitespace being read has been dealt with: written as a single space or newline, or left out
+	bool is_at_block_boundary; // Whether what was last written is a block-level tag, or nothing at all, so that whitespace there is insignificant
+	bool is_closing_tag;
+	bool is_escaped; // Of a css_quoted
+	char quote;
+	unsigned char name_len; // Of the current tag. If it exceeds the size of name, it is not a tag name of interest.
+	unsigned char n_matched; // Of the "</NAME" which ends a raw or css element, or of the "--" which begins or ends a comment
+	char name[11]; // Lowercase
+
+	HtmlMinifier()
+	: level(0)
+	{
+		this->reset();
+	}
+
+	void reset(); // For the start of a document
+	void end_tag(const bool is_block); // At the '>' of a tag whose name is name
+	char* minify(char* const begin,  const char* const end,  const char* const limit,  const bool is_last); // Minifies [begin,end) in place, returning the new end. [end,limit) is what follows it, if known, which is looked at but not changed. is_last if nothing follows it in the document.
+};
@@ -0,0 +1,246 @@
+#include "output.h"
+#include "compress.h"
+#include "stats.h"
+
+#include <compsky/utils/ptrdiff.hpp>
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+
+static
+char* mmap_small_pages(const std::size_t sz){
+	// For buffers which are mostly left untouched, where each huge page would be zeroed in its entirety
+	void* const p = mmap(nullptr, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	return (unlikely(p == MAP_FAILED)) ? nullptr : reinterpret_cast<char*>(p);
+}
+
+static
+char* mmap_huge_pages(const std::size_t sz){
+	// sz must be a multiple of HUGE_PAGE_SZ. Over-allocates so that the region can be trimmed to huge page alignment.
+	char* const reserved = reinterpret_cast<char*>(mmap(nullptr, sz + HUGE_PAGE_SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+	if (unlikely(reserved == MAP_FAILED))
+		return nullptr;
+	char* const aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(reserved) + HUGE_PAGE_SZ - 1) & ~(HUGE_PAGE_SZ - 1));
+	if (aligned != reserved)
+		munmap(reserved, compsky::utils::ptrdiff(aligned,reserved));
+	munmap(aligned + sz, HUGE_PAGE_SZ - compsky::utils::ptrdiff(aligned,reserved));
+	madvise(aligned, sz, MADV_HUGEPAGE);
+	return aligned;
+}
+
+
+HtmlOutput::HtmlOutput(const int _fd,  const std::size_t _buf_sz)
+: fd(_fd)
+, buf((_buf_sz % HUGE_PAGE_SZ == 0) ? mmap_huge_pages(_buf_sz) : mmap_small_pages(_buf_sz))
+, buf_sz(_buf_sz)
+, n_held(0)
+, n_deferred(0)
+, span_min_sz(OUTPUT_SPAN_MIN_SZ)
+, segment_begin(buf)
+, compression(nullptr)
+, pagination(nullptr)
+, is_write_failed(false)
+{
+	this->buf_end = this->buf + this->buf_sz;
+	this->flush_threshold = this->buf_end - OUTPUT_SLACK_SZ;
+}
+
+HtmlOutput::~HtmlOutput(){
+	if (likely(this->buf != nullptr))
+		munmap(this->buf, this->buf_sz);
+}
+
+char* HtmlOutput::begin(){
+	this->n_held = 0;
+	this->n_deferred = 0;
+	this->minifier.reset();
+	this->spans.clear();
+	this->segment_begin = this->buf;
+	return this->buf;
+}
+
+void HtmlOutput::add_span(char*& dest_itr,  const char* const data,  const std::size_t n){
+	// The last OUTPUT_RETAINED_SZ bytes of the span are still copied, as md_to_html may rewind over what it has just written
+	this->reserve(dest_itr, OUTPUT_RETAINED_SZ);
+	if (dest_itr != this->segment_begin)
+		this->spans.push_back({this->segment_begin, compsky::utils::ptrdiff(dest_itr,this->segment_begin)});
+	const std::size_t n_referenced = n - OUTPUT_RETAINED_SZ;
+	this->spans.push_back({const_cast<char*>(data), n_referenced});
+	if (unlikely(conversion_stats != nullptr))
+		conversion_stats->n_referenced_bytes.fetch_add(n_referenced, std::memory_order_relaxed);
+	this->segment_begin = dest_itr;
+	memcpy(dest_itr, data + n_referenced, OUTPUT_RETAINED_SZ);
+	dest_itr += OUTPUT_RETAINED_SZ;
+	if (unlikely(this->spans.size() >= OUTPUT_MAX_SPANS))
+		this->flush(dest_itr);
+}
+
+void HtmlOutput::write_spans(){
+	PhaseTimer timer(&ConversionStats::write_ns, &ConversionStats::write_counters);
+	struct iovec* iov = this->spans.data();
+	std::size_t n_iov = this->spans.size();
+	if (unlikely(conversion_stats != nullptr))
+		for (std::size_t i = 0;  i < n_iov;  ++i)
+			conversion_stats->n_output_bytes.fetch_add(iov[i].iov_len, std::memory_order_relaxed);
+	if (this->compression != nullptr)
+		for (std::size_t i = 0;  i < n_iov;  ++i)
+			this->compression->add(reinterpret_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+	while((n_iov != 0) and likely(not this->is_write_failed)){
+		ssize_t n_written = ::writev(this->fd, iov, n_iov);
+		if (likely(n_written > 0)){
+			while((n_iov != 0) and (static_cast<std::size_t>(n_written) >= iov->iov_len)){
+				n_written -= iov->iov_len;
+				++iov;
+				--n_iov;
+			}
+			if (n_iov != 0){
+				iov->iov_base = reinterpret_cast<char*>(iov->iov_base) + n_written;
+				iov->iov_len -= n_written;
+			}
+		} else if ((n_written == -1) and (errno == EINTR)){
+			continue;
+		} else {
+			fprintf(stderr, "ERROR: Cannot write output: %s\n", strerror(errno));
+			this->is_write_failed = true;
+		}
+	}
+	this->spans.clear();
+}
+
+void HtmlOutput::write(const char* data,  std::size_t n){
+	if (this->minifier.level != 0){
+		this->write_minified(data, n);
+		return;
+	}
+	PhaseTimer timer(&ConversionStats::write_ns, &ConversionStats::write_counters);
+	if (unlikely(conversion_stats != nullptr))
+		conversion_stats->n_output_bytes.fetch_add(n, std::memory_order_relaxed);
+	if (this->fd == -1){
+		char* dest_itr = this->buf + this->n_held;
+		this->reserve(dest_itr, n);
+		memcpy(dest_itr, data, n);
+		this->n_held += n;
+		return;
+	}
+	if (this->compression != nullptr)
+		this->compression->add(data, n);
+	while((n != 0) and likely(not this->is_write_failed)){
+		const ssize_t n_written = ::write(this->fd, data, n);
+		if (likely(n_written > 0)){
+			data += n_written;
+			n    -= n_written;
+		} else if ((n_written == -1) and (errno == EINTR)){
+			continue;
+		} else {
+			fprintf(stderr, "ERROR: Cannot write output: %s\n", strerror(errno));
+			this->is_write_failed = true;
+		}
+	}
+}
+
+void HtmlOutput::write_minified(const char* data,  std::size_t n){
+	// Copied into the buffer, to be minified there: after what is held if fd is -1, otherwise over whatever the buffer held
+	// As when flushing, what follows each part is copied after it too, for the minifier to look at. What follows the last part is not known until the next write, so any whitespace at its end is deferred until then.
+	while(n != 0){
+		char* dest_itr = ((this->fd == -1) ? this->buf + this->n_held : this->buf) + this->n_deferred;
+		const std::size_t n_taken = (this->fd == -1) ? n : std::min(n, compsky::utils::ptrdiff(this->flush_threshold,dest_itr) - OUTPUT_RETAINED_SZ);
+		const std::size_t n_peeked = std::min(n - n_taken, OUTPUT_RETAINED_SZ);
+		this->reserve(dest_itr, n_taken + n_peeked);
+		memcpy(dest_itr, data, n_taken + n_peeked);
+		char* const minify_begin = dest_itr - this->n_deferred;
+		char* const minify_end = dest_itr + n_taken;
+		char* deferred_begin = minify_end;
+		if (n_peeked == 0){
+			while((deferred_begin != minify_begin) and (compsky::utils::ptrdiff(minify_end, deferred_begin) < OUTPUT_RETAINED_SZ) and ((deferred_begin[-1] == ' ') or (deferred_begin[-1] == '\n') or (deferred_begin[-1] == '\t') or (deferred_begin[-1] == '\r')))
+				--deferred_begin;
+		}
+		char* const minified_end = this->minifier.minify(minify_begin, deferred_begin, minify_end + n_peeked, false);
+		this->n_deferred = compsky::utils::ptrdiff(minify_end, deferred_begin);
+		if (this->fd == -1){
+			memmove(minified_end, deferred_begin, this->n_deferred);
+			this->n_held = compsky::utils::ptrdiff(minified_end, this->buf);
+			if (unlikely(conversion_stats != nullptr))
+				conversion_stats->n_output_bytes.fetch_add(compsky::utils::ptrdiff(minified_end, minify_begin), std::memory_order_relaxed);
+		} else {
+			this->spans.push_back({minify_begin, compsky::utils::ptrdiff(minified_end, minify_begin)});
+			this->write_spans();
+			memmove(this->buf, deferred_begin, this->n_deferred);
+		}
+		data += n_taken;
+		n -= n_taken;
+	}
+}
+
+void HtmlOutput::reserve(char*& dest_itr,  const std::size_t n){
+	// Ensures that n bytes, plus the usual slack, can be written at dest_itr
+	if (likely(compsky::utils::ptrdiff(dest_itr,this->buf) + n <= compsky::utils::ptrdiff(this->flush_threshold,this->buf)))
+		return;
+	this->flush(dest_itr);
+	const std::size_t n_used = compsky::utils::ptrdiff(dest_itr, this->buf);
+	if (n_used + n <= compsky::utils::ptrdiff(this->flush_threshold,this->buf))
+		return;
+	this->grow(dest_itr, n_used + n + OUTPUT_SLACK_SZ);
+}
+
+void HtmlOutput::grow(char*& dest_itr,  const std::size_t min_sz){
+	const std::size_t n_used = compsky::utils::ptrdiff(dest_itr, this->buf);
+	const std::size_t new_sz = (min_sz + HUGE_PAGE_SZ - 1) & ~(HUGE_PAGE_SZ - 1);
+	char* const new_buf = mmap_huge_pages(new_sz);
+	if (unlikely(new_buf == nullptr)){
+		fprintf(stderr, "ERROR: Cannot allocate %lu bytes of output\n", new_sz);
+		abort();
+	}
+	memcpy(new_buf, this->buf, n_used);
+	munmap(this->buf, this->buf_sz);
+	dest_itr = new_buf + n_used;
+	this->segment_begin = new_buf + compsky::utils::ptrdiff(this->segment_begin, this->buf); // There are no spans pointing into the old buffer: they are written before it needs to grow
+	this->buf = new_buf;
+	this->buf_sz = new_sz;
+	this->buf_end = new_buf + new_sz;
+	this->flush_threshold = this->buf_end - OUTPUT_SLACK_SZ;
+}
+
+void HtmlOutput::flush(char*& dest_itr){
+	// Writes all but the last OUTPUT_RETAINED_SZ bytes
+	if (this->fd == -1){
+		// Held in memory until the caller writes it out
+		this->grow(dest_itr, 2*this->buf_sz);
+		return;
+	}
+	// Unless there are no spans, there are at least OUTPUT_RETAINED_SZ bytes after segment_begin: those copied from the end of the last span
+	if (compsky::utils::ptrdiff(dest_itr, this->buf) <= OUTPUT_RETAINED_SZ)
+		return;
+	char* const flush_until = dest_itr - OUTPUT_RETAINED_SZ;
+	const char* const written_until = (this->minifier.level == 0) ? flush_until : this->minifier.minify(this->segment_begin, flush_until, dest_itr, false);
+	if (written_until != this->segment_begin)
+		this->spans.push_back({this->segment_begin, compsky::utils::ptrdiff(written_until,this->segment_begin)});
+	this->write_spans();
+	memmove(this->buf, flush_until, OUTPUT_RETAINED_SZ);
+	dest_itr = this->buf + OUTPUT_RETAINED_SZ;
+	this->segment_begin = this->buf;
+	*dest_itr = 0;
+}
+
+void HtmlOutput::finish(char*& dest_itr){
+	if (this->minifier.level != 0)
+		dest_itr = this->minifier.minify(this->segment_begin, dest_itr, dest_itr, true);
+	if (this->fd == -1){
+		this->n_held = compsky::utils::ptrdiff(dest_itr,this->buf);
+		if (unlikely(conversion_stats != nullptr))
+			conversion_stats->n_output_bytes.fetch_add(this->n_held, std::memory_order_relaxed);
+		return;
+	}
+	if (dest_itr != this->segment_begin)
+		this->spans.push_back({this->segment_begin, compsky::utils::ptrdiff(dest_itr,this->segment_begin)});
+	this->write_spans();
+	dest_itr = this->buf;
+	this->segment_begin = this->buf;
+}
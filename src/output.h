@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include <sys/uio.h>
+#include "minify.h"
+
+
+struct CompressionPipeline;
+struct Pagination;
+
+
+constexpr std::size_t OUTPUT_BUF_SZ = 1024*1024*4;
+constexpr std::size_t HUGE_PAGE_SZ = 1024*1024*2;
+constexpr std::size_t OUTPUT_RETAINED_SZ = 4096; // md_to_html rewinds over what it has just written, e.g. to remove an empty <p>, so this much is kept back when flushing
+constexpr std::size_t OUTPUT_SLACK_SZ = 1024*64; // The markup written in a single step of md_to_html is not bounds-checked, except for spans of the input which are passed to reserve()
+constexpr std::size_t OUTPUT_SPAN_MIN_SZ = 1024*16; // Smaller spans of the input are copied, as an iovec costs more than copying them. Must exceed OUTPUT_RETAINED_SZ.
+constexpr std::size_t OUTPUT_MAX_SPANS = 256; // Below IOV_MAX, so that a flush is a single writev()
+
+
+struct HtmlOutput {
+	// Buffers the HTML and writes it to fd whenever the buffer nears its end, so that memory use does not scale with the document size
+	// The buffer is backed by transparent huge pages where available, as it is written to one byte at a time
+	// Large spans of the input and of replacements are not copied into the buffer: the buffer is cut where they belong, and they are written from where they are, in order, with writev()
+	int fd; // Can be changed between documents, so that the buffer is reused. If -1, the buffer grows to hold the whole output instead of being flushed.
+	char* buf;
+	char* buf_end;
+	char* flush_threshold;
+	std::size_t buf_sz;
+	std::size_t n_held; // If fd is -1: the size of the output which has been finished or written, at the start of buf
+	std::size_t n_deferred; // If minifying, the whitespace which ended the last write(), which is minified with what the next writes after it - and if nothing does, is left out. Held after what is held, or otherwise at the start of buf.
+	std::size_t span_min_sz; // The smallest span which is written from where it is rather than copied. Everything is copied if fd is -1, or if minifying.
+	std::vector<struct iovec> spans; // What precedes segment_begin, yet to be written: parts of buf, and the spans between them
+	char* segment_begin; // Of the part of buf which is yet to be added to spans
+	CompressionPipeline* compression; // If not nullptr, is also given everything written to fd
+	Pagination* pagination; // If not nullptr, md_to_html splits the document between files at its headings, changing fd
+	HtmlMinifier minifier; // Minifies what is written, unless its level is 0. Only the part of buf which is written is minified, as md_to_html rewinds over what it has just written.
+	bool is_write_failed;
+
+	explicit HtmlOutput(const int _fd,  const std::size_t _buf_sz = OUTPUT_BUF_SZ); // _buf_sz must exceed OUTPUT_SLACK_SZ. Unless it is a multiple of HUGE_PAGE_SZ, huge pages are not used until the buffer grows.
+	~HtmlOutput();
+
+	bool is_null() const {
+		return (this->buf == nullptr);
+	}
+	std::string_view held() const {
+		// The document, once converted with fd -1. Valid until the next is converted.
+		return std::string_view(this->buf, this->n_held);
+	}
+
+	char* begin(); // Discards anything not yet written - e.g. of a document whose conversion failed - and returns where the next document's output starts
+	void append(char*& dest_itr,  const char* const data,  const std::size_t n){
+		// For a span which stays valid until the next flush(), such as the input window
+		if ((n < this->span_min_sz) or (this->fd == -1) or (this->minifier.level != 0)){
+			this->reserve(dest_itr, n);
+			memcpy(dest_itr, data, n);
+			dest_itr += n;
+			return;
+		}
+		this->add_span(dest_itr, data, n);
+	}
+	void add_span(char*& dest_itr,  const char* const data,  const std::size_t n);
+	void write(const char* const data,  const std::size_t n); // If fd is -1, appends to what is held instead
+	void write_minified(const char* data,  std::size_t n);
+	void write_spans();
+	void reserve(char*& dest_itr,  const std::size_t n);
+	void grow(char*& dest_itr,  const std::size_t min_sz);
+	void flush(char*& dest_itr);
+	void finish(char*& dest_itr);
+};
@@ -0,0 +1,88 @@
+#include "paginate.h"
+#include "output.h"
+#include "compress.h"
+
+#include <compsky/macros/likely.hpp>
+#include <compsky/asciify/asciify.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+Pagination::Pagination(const char* const output_path,  const unsigned _heading_level)
+: index_path(output_path)
+, page_titles(1)
+, heading_level(_heading_level)
+, is_page_headed(false)
+{
+	const std::size_t dir_len = this->index_path.rfind('/') + 1; // 0 if there is no directory
+	const std::size_t suffix_begin = this->index_path.rfind('.');
+	const std::size_t stem_len = ((suffix_begin == std::string::npos) or (suffix_begin < dir_len)) ? this->index_path.size() : suffix_begin;
+	this->path_prefix.assign(this->index_path, 0, stem_len);
+	this->path_prefix += '-';
+	this->path_suffix.assign(this->index_path, stem_len);
+	this->link_prefix.assign(this->path_prefix, dir_len);
+	this->index_link.assign(this->index_path, dir_len);
+}
+
+std::string Pagination::page_path(const unsigned page_n) const {
+	return this->path_prefix + std::to_string(page_n) + this->path_suffix;
+}
+
+int Pagination::open_page(const std::string& path){
+	const int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (unlikely(fd == -1))
+		fprintf(stderr, "ERROR: Cannot open %s: %s\n", path.c_str(), strerror(errno));
+	return fd;
+}
+
+void Pagination::switch_to(HtmlOutput& html_output,  const std::string& path){
+	const int fd = this->open_page(path);
+	if (unlikely(fd == -1)){
+		html_output.is_write_failed = true;
+		return;
+	}
+	close(html_output.fd);
+	html_output.fd = fd;
+	if (html_output.compression != nullptr){
+		html_output.compression->end();
+		html_output.compression->begin(path.c_str());
+	}
+}
+
+void Pagination::begin(const char* const head_begin,  const char* const head_end){
+	constexpr std::size_t body_opening_len = std::char_traits<char>::length("</head>\n<body>\n");
+	this->head.assign(head_begin, head_end - body_opening_len);
+}
+
+void Pagination::write_nav(char*& dest_itr,  const bool is_next) const {
+	const unsigned page_n = this->page_titles.size();
+	compsky::asciify::asciify(dest_itr, "\n<nav class=\"pages\">");
+	if (page_n != 1)
+		compsky::asciify::asciify(dest_itr, "<a href=\"", this->link_prefix.c_str(), page_n-1, this->path_suffix.c_str(), "\" rel=\"prev\">Previous</a> ");
+	compsky::asciify::asciify(dest_itr, "<a href=\"", this->index_link.c_str(), "\">Contents</a>");
+	if (is_next)
+		compsky::asciify::asciify(dest_itr, " <a href=\"", this->link_prefix.c_str(), page_n+1, this->path_suffix.c_str(), "\" rel=\"next\">Next</a>");
+	compsky::asciify::asciify(dest_itr, "</nav>\n");
+}
+
+void Pagination::write_index(HtmlOutput& html_output){
+	this->switch_to(html_output, this->index_path);
+	char* dest_itr = html_output.begin();
+	html_output.append(dest_itr, this->head.data(), this->head.size());
+	compsky::asciify::asciify(dest_itr, "</head>\n<body>\n<ol class=\"pages\">\n");
+	for (unsigned i = 0;  i < this->page_titles.size();  ++i){
+		if (unlikely(dest_itr > html_output.flush_threshold))
+			html_output.flush(dest_itr);
+		compsky::asciify::asciify(dest_itr, "<li><a href=\"", this->link_prefix.c_str(), i+1, this->path_suffix.c_str(), "\">");
+		if (this->page_titles[i].empty())
+			compsky::asciify::asciify(dest_itr, "Page ", i+1);
+		else
+			html_output.append(dest_itr, this->page_titles[i].data(), this->page_titles[i].size());
+		compsky::asciify::asciify(dest_itr, "</a></li>\n");
+	}
+	compsky::asciify::asciify(dest_itr, "</ol>\n</body></html>");
+	html_output.finish(dest_itr);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+struct HtmlOutput;
+
+
+struct Pagination {
+	// Splits the HTML of a document into pages as it is converted, each after the first starting at a heading: foo.html is written as foo-1.html, foo-2.html and so on, each linking to the one before and after it, and then foo.html as an index of them
+	// Each page has the <head> of the first, with the <style> elements of the pages before it added, so that it is styled the same
+	std::string path_prefix; // e.g. "dir/foo-" of "dir/foo-1.html"
+	std::string path_suffix; // e.g. ".html"
+	std::string link_prefix; // e.g. "foo-", as the pages link to each other
+	std::string index_path;
+	std::string index_link;
+	std::string head; // What md_to_html_begin wrote, up to </head>
+	std::string styles; // The <style> elements so far, as in the markdown
+	std::vector<std::string> page_titles; // The markdown of the heading which each page so far starts with. Empty for a first page with none.
+	unsigned heading_level; // A heading of this level or higher - e.g. ## or # for 2 - starts a new page, unless it is the first such heading of the current page
+	bool is_page_headed; // Whether the current page has such a heading yet
+
+	Pagination(const char* const output_path,  const unsigned _heading_level);
+
+	std::string page_path(const unsigned page_n) const; // Counting from 1
+	int open_page(const std::string& path);
+	void switch_to(HtmlOutput& html_output,  const std::string& path); // Once the current page is finished. If the next cannot be opened, nothing more is written, as if a write had failed.
+	void begin(const char* const head_begin,  const char* const head_end); // Given what md_to_html_begin wrote
+	void write_nav(char*& dest_itr,  const bool is_next) const; // The links to the previous page, the index and - if is_next - the next page
+	void write_index(HtmlOutput& html_output); // Once the last page is finished
+};
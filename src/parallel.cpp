@@ -0,0 +1,237 @@
+#include "parallel.h"
+#include "md_to_html.h"
+#include "input.h"
+#include "output.h"
+#include "fragment_cache.h"
+#include "children.h"
+#include "scan.h"
+#include "stats.h"
+
+#include <compsky/utils/ptrdiff.hpp>
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <thread>
+#include <vector>
+
+
+struct DocumentChunk {
+	const char* begin;
+	const char* end; // nullptr for the last chunk
+	MarkdownState assumed_state; // The state which the preceding chunks are expected to leave md_to_html in
+	MarkdownState state;
+	HtmlOutput html_output; // Held in memory
+	std::size_t output_offset; // Of the output within html_output.buf, which moves as it grows
+	std::size_t fragment_offset; // Of the output of the chunk's own blocks, i.e. after the document's header in the first chunk
+	char* dest_itr;
+	const char* converted_until;
+	uint64_t cache_key;
+	bool is_cached;
+
+	DocumentChunk(const char* const _begin,  const MarkdownState& _assumed_state,  const std::size_t output_buf_sz)
+	: begin(_begin)
+	, end(nullptr)
+	, assumed_state(_assumed_state)
+	, state(_assumed_state)
+	, html_output(-1, output_buf_sz)
+	, output_offset(0)
+	, fragment_offset(0)
+	, dest_itr(html_output.buf)
+	, converted_until(nullptr)
+	, cache_key(0)
+	, is_cached(false)
+	{}
+};
+
+
+static
+int dom_depth_change(const char* itr){
+	// itr is just after a '<' which is not within - or the opening of - a <script>, <style>, comment or knitr block. Mirrors how md_to_html tracks open tags.
+	if (*itr == '/')
+		return -1;
+	const char* const tagname_start = itr;
+	if (unlikely(startswithreplace(itr)))
+		itr += 14;
+	else if ((*itr < 'a') or (*itr > 'z'))
+		return 0;
+	while(((*itr >= 'a') and (*itr <= 'z')) or ((*itr >= '0') and (*itr <= '9')) or (*itr == '-'))
+		++itr;
+	if ((itr[-1] == '-') or ((*itr != '>') and (*itr != ' ')))
+		return 0;
+	const std::size_t tagname_len = compsky::utils::ptrdiff(itr,tagname_start);
+	while((*itr != 0) and (*itr != '\n') and (*itr != '>'))
+		++itr;
+	if ((*itr != '>') or (itr[-1] == '/'))
+		return 0;
+	if ((tagname_len == 2) and (tagname_start[0] == 'b') and (tagname_start[1] == 'r'))
+		return 0;
+	return 1;
+}
+
+static
+bool is_opening_of_script(const char* const itr){
+	return (itr[0]=='s') and (itr[1]=='c') and (itr[2]=='r') and (itr[3]=='i') and (itr[4]=='p') and (itr[5]=='t') and ((itr[6]=='>') or (itr[6]==' '));
+}
+
+static
+bool is_opening_of_style(const char* const itr){
+	return (itr[0]=='s') and (itr[1]=='t') and (itr[2]=='y') and (itr[3]=='l') and (itr[4]=='e') and ((itr[5]=='>') or (itr[5]==' '));
+}
+
+static
+void split_into_chunks(const ConversionOptions& options,  const MarkdownInput& markdown_input,  const std::size_t min_chunk_sz,  const uint32_t boundary_mask,  const std::size_t output_buf_sz,  std::deque<DocumentChunk>& chunks){
+	// Chunks begin after blank lines which are outside of every block the BlockScanner knows of, and outside of every open tag
+	// With a boundary_mask, only after those whose preceding bytes hash to 0 under it, so that where a chunk begins depends on nothing but what is just before it
+	// The state each chunk assumes has the tag names given display rules by the <style> elements before it
+	MarkdownState prescanned_state(options);
+	BlockScanner scanner;
+	const char* itr = chunks.back().begin;
+	if (itr == markdown_input.window_begin)
+		itr = scanner.begin(itr, markdown_input.data_end);
+	const char* next_chunk_from = itr + min_chunk_sz;
+	unsigned dom_depth = 0;
+	const char* skippable_from = itr; // The BlockScanner looks up to 8 bytes behind a '<' or newline
+	for (;  itr < markdown_input.data_end;  ++itr){
+		const bool is_outside = (scanner.state == BlockScanner::outside) and (scanner.n_to_skip == 0);
+		if (is_outside and (itr >= skippable_from)){
+			// Outside of every block, nothing but a '<' or a newline changes anything, so the plain text between them is skipped
+			itr = find_plain_text_end(itr, markdown_input.data_end);
+			if (itr == markdown_input.data_end)
+				break;
+		}
+		if ((*itr == '<') or (*itr == '\n'))
+			skippable_from = itr + 9;
+		if (scanner.step(itr)){
+			if ((dom_depth == 0) and (itr+1 >= next_chunk_from) and (itr+1 != markdown_input.data_end) and ((hash_tag_name(std::string_view(itr-16, 16), 0) & boundary_mask) == 0)){
+				chunks.back().end = itr+1;
+				chunks.emplace_back(itr+1, prescanned_state, output_buf_sz);
+				next_chunk_from = itr+1 + min_chunk_sz;
+			}
+		} else if (is_outside and (*itr == '<')){
+			if (unlikely(is_opening_of_style(itr+1))){
+				skip_style_element(options, itr+1, prescanned_state.tag_names, false);
+			} else if (not is_opening_of_script(itr+1)){
+				const int change = dom_depth_change(itr+1);
+				if ((change > 0) or (dom_depth != 0))
+					dom_depth += change;
+			}
+		}
+	}
+}
+
+ConversionError md_to_html_parallel(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output,  unsigned n_threads,  FragmentCache* const fragment_cache){
+	// Converts chunks of the document concurrently. Each chunk after the first is converted from the state it is assumed to begin in, which is then checked against the state the preceding chunk actually ended in: if they differ, the preceding chunk's conversion is continued through it instead. So the output is always that of md_to_html.
+	// The whole output is held in memory until every chunk has been converted.
+	// With a fragment_cache, the output of each chunk which was converted on its own - from its assumed state to that of the next chunk - is cached, and chunks whose output is cached are not converted at all. So the output is still that of md_to_html.
+	// A chunk which stops at an error is only an error of the document if the chunk's assumed state was right. Otherwise, its conversion is discarded like any other.
+	if (
+		markdown_input.is_null() or
+		markdown_input.has_more() or
+		options.is_tree_needed() or
+		(
+			(fragment_cache == nullptr) and (
+				(n_threads < 2) or
+				(compsky::utils::ptrdiff(markdown_input.data_end, markdown_input.window_begin) < 2*PARALLEL_MIN_CHUNK_SZ)
+			)
+		)
+	){
+		return md_to_html(options, markdown_input, html_output);
+	}
+	conversion_stats = options.stats;
+	convert_children_ahead(options, markdown_input);
+	std::deque<DocumentChunk> chunks;
+	chunks.emplace_back(nullptr, MarkdownState(options), OUTPUT_BUF_SZ);
+	if (unlikely(chunks.back().html_output.is_null()))
+		return md_to_html(options, markdown_input, html_output);
+	chunks.back().begin = md_to_html_begin(options, markdown_input, chunks.back().html_output, chunks.back().dest_itr);
+	chunks.back().fragment_offset = compsky::utils::ptrdiff(chunks.back().dest_itr, chunks.back().html_output.buf);
+	if (fragment_cache == nullptr)
+		split_into_chunks(options, markdown_input, std::max(PARALLEL_MIN_CHUNK_SZ, compsky::utils::ptrdiff(markdown_input.data_end, markdown_input.window_begin) / (4*n_threads)), 0, OUTPUT_BUF_SZ, chunks);
+	else
+		split_into_chunks(options, markdown_input, FRAGMENT_CACHE_MIN_CHUNK_SZ, FRAGMENT_CACHE_BOUNDARY_MASK, FRAGMENT_CACHE_CHUNK_OUTPUT_SZ, chunks);
+	for (std::size_t i = 1;  i < chunks.size();  ++i){
+		DocumentChunk& chunk = chunks[i];
+		if (unlikely(chunk.html_output.is_null())){
+			fprintf(stderr, "WARNING: Cannot allocate output for %lu chunks, so converting on one thread\n", chunks.size());
+			return md_to_html(options, markdown_input, html_output);
+		}
+		// The preceding chunk's output ends with the newline of the blank line. md_to_html might remove it, e.g. when opening a list, so the chunk begins with a copy of it.
+		chunk.output_offset = PARALLEL_CHUNK_PADDING - 1;
+		chunk.fragment_offset = chunk.output_offset;
+		chunk.html_output.buf[chunk.output_offset] = '\n';
+		chunk.dest_itr = chunk.html_output.buf + chunk.output_offset + 1;
+	}
+
+	std::atomic<std::size_t> next_chunk_indx(0);
+	const auto convert_chunks = [&options, &markdown_input, &chunks, &next_chunk_indx, fragment_cache](){
+		conversion_stats = options.stats;
+		while(true){
+			const std::size_t i = next_chunk_indx.fetch_add(1, std::memory_order_relaxed);
+			if (i >= chunks.size())
+				return;
+			DocumentChunk& chunk = chunks[i];
+			if (fragment_cache != nullptr){
+				chunk.cache_key = fragment_cache->key(chunk.begin, (chunk.end == nullptr) ? markdown_input.data_end : chunk.end, chunk.assumed_state, (i == 0));
+				// The cached output replaces the copy of the preceding chunk's newline
+				const std::size_t dest_offset = compsky::utils::ptrdiff(chunk.dest_itr, chunk.html_output.buf);
+				char* fragment_itr = chunk.html_output.buf + chunk.fragment_offset;
+				if ((chunk.cache_key != 0) and fragment_cache->load(chunk.cache_key, chunk.html_output, fragment_itr)){
+					// It was cached only if it ended in the state the next chunk assumes, which is also what it would end in now
+					chunk.dest_itr = fragment_itr;
+					chunk.is_cached = true;
+					chunk.converted_until = chunk.end;
+					continue;
+				}
+				chunk.dest_itr = chunk.html_output.buf + dest_offset; // The buffer may have moved
+			}
+			chunk.converted_until = md_to_html_blocks(options, markdown_input, chunk.html_output, chunk.state, chunk.dest_itr, chunk.begin, markdown_input.window_begin, chunk.end);
+		}
+	};
+	std::vector<std::thread> workers;
+	for (std::size_t i = 1;  i < std::min<std::size_t>(n_threads, chunks.size());  ++i)
+		workers.emplace_back(convert_chunks);
+	convert_chunks();
+	for (std::thread& worker : workers)
+		worker.join();
+
+	std::vector<DocumentChunk*> segments; // Runs of chunks which were converted as one
+	segments.push_back(&chunks[0]);
+	for (std::size_t i = 1;  i < chunks.size();  ++i){
+		DocumentChunk& chunk = chunks[i];
+		DocumentChunk& segment = *segments.back();
+		if (unlikely(segment.state.error))
+			break;
+		if (segment.converted_until != chunk.begin)
+			continue; // The segment ran on past the chunk's beginning
+		if (likely(segment.is_cached or (chunk.assumed_state == segment.state)))
+			segments.push_back(&chunk);
+		else
+			segment.converted_until = md_to_html_blocks(options, markdown_input, segment.html_output, segment.state, segment.dest_itr, chunk.begin, markdown_input.window_begin, chunk.end);
+	}
+	DocumentChunk& last_segment = *segments.back();
+	if (fragment_cache != nullptr){
+		for (std::size_t i = 0;  i < segments.size();  ++i){
+			const DocumentChunk& segment = *segments[i];
+			// The last is not cached if md_to_html_end will reject it
+			const bool is_converted_alone = (i+1 == segments.size()) ? ((segment.end == nullptr) and segment.state.open_dom_tag_names.empty() and not segment.state.error) : (segments[i+1]->begin == segment.end);
+			if (is_converted_alone and not segment.is_cached and (segment.cache_key != 0))
+				fragment_cache->store(segment.cache_key, segment.html_output.buf + segment.fragment_offset, compsky::utils::ptrdiff(segment.dest_itr, segment.html_output.buf + segment.fragment_offset));
+		}
+	}
+	if (likely(not last_segment.state.error))
+		md_to_html_end(last_segment.state, last_segment.dest_itr);
+	if (unlikely(last_segment.state.error))
+		return last_segment.state.error;
+	html_output.minifier.level = options.minify_level;
+	html_output.begin();
+	for (const DocumentChunk* const segment : segments){
+		// Every segment but the last ends with the newline which the next one begins with a copy of
+		const char* const output_end = (segment == &last_segment) ? segment->dest_itr : segment->dest_itr - 1;
+		const char* const output_begin = segment->html_output.buf + segment->output_offset;
+		html_output.write(output_begin, compsky::utils::ptrdiff(output_end, output_begin));
+	}
+	return last_segment.state.error;
+}
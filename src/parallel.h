@@ -0,0 +1,14 @@
+#pragma once
+
+#include "md_to_html.h"
+
+#include <cstddef>
+
+
+constexpr std::size_t PARALLEL_MIN_CHUNK_SZ = 1024*1024; // Smaller documents are not worth splitting
+constexpr std::size_t PARALLEL_CHUNK_PADDING = 16; // Zeroes before each chunk's output, for md_to_html's look behind its output
+
+
+struct FragmentCache;
+
+ConversionError md_to_html_parallel(const ConversionOptions& options,  MarkdownInput& markdown_input,  HtmlOutput& html_output,  unsigned n_threads,  FragmentCache* const fragment_cache); // fragment_cache may be nullptr
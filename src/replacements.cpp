@@ -0,0 +1,113 @@
+#include "replacements.h"
+#include "md_to_html.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+
+
+void ReplacementTrie::build(const std::vector<Filename>& filenames){
+	// Inserts into a trie whose nodes own their edges, then flattens it
+	struct UnflattenedNode {
+		std::vector<Edge> edges;
+		int filename_indx;
+	};
+	std::vector<UnflattenedNode> unflattened;
+	unflattened.push_back({{}, -1});
+	for (unsigned i = 0;  i < filenames.size();  ++i){
+		unsigned node_indx = 0;
+		for (const char c : filenames[i].name){
+			std::vector<Edge>& edges = unflattened[node_indx].edges;
+			const auto it = std::find_if(edges.begin(), edges.end(), [c](const Edge& edge){
+				return (edge.c == c);
+			});
+			if (it != edges.end()){
+				node_indx = it->node_indx;
+			} else {
+				edges.push_back({c, static_cast<unsigned>(unflattened.size())});
+				node_indx = unflattened.size();
+				unflattened.push_back({{}, -1});
+			}
+		}
+		if (likely(unflattened[node_indx].filename_indx == -1))
+			unflattened[node_indx].filename_indx = i;
+		else
+			fprintf(stderr, "WARNING: Duplicate replacement name: %.*s\n", (int)filenames[i].name.size(), filenames[i].name.data());
+	}
+	this->nodes.clear();
+	this->edges.clear();
+	this->nodes.reserve(unflattened.size());
+	for (UnflattenedNode& node : unflattened){
+		std::sort(node.edges.begin(), node.edges.end(), [](const Edge& a,  const Edge& b){
+			return (a.c < b.c);
+		});
+		this->nodes.push_back({static_cast<unsigned>(this->edges.size()), static_cast<unsigned>(node.edges.size()), node.filename_indx});
+		this->edges.insert(this->edges.end(), node.edges.begin(), node.edges.end());
+	}
+}
+
+int ReplacementTrie::longest_match(const char* str) const {
+	// Returns the index of the longest name which str begins with, or -1. Names cannot contain NUL, so the walk stops at the end of the string.
+	if (unlikely(this->nodes.empty()))
+		return -1;
+	int longest = this->nodes[0].filename_indx;
+	const Node* node = &this->nodes[0];
+	while(node->n_edges != 0){
+		const Edge* const edges_begin = this->edges.data() + node->first_edge;
+		const Edge* const edges_end   = edges_begin + node->n_edges;
+		const Edge* const edge = std::lower_bound(edges_begin, edges_end, *str, [](const Edge& e,  const char c){
+			return (e.c < c);
+		});
+		if ((edge == edges_end) or (edge->c != *str))
+			break;
+		node = &this->nodes[edge->node_indx];
+		if (node->filename_indx != -1)
+			longest = node->filename_indx;
+		++str;
+	}
+	return longest;
+}
+
+void preload_replacements(std::vector<Filename>& filenames){
+	// Maps the contents of every file on all cores, rather than each one on its first use
+	std::atomic<std::size_t> next_indx(0);
+	std::vector<std::thread> threads;
+	const unsigned n_threads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned i = 0;  i < n_threads;  ++i){
+		threads.emplace_back([&filenames, &next_indx](){
+			while(true){
+				const std::size_t indx = next_indx++;
+				if (indx >= filenames.size())
+					break;
+				filenames[indx].contents();
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+bool read_replacement_dir(const char* const dirpath,  std::vector<Filename>& filenames){
+	std::size_t dirpath_len = strlen(dirpath);
+	char fullpath[4096];
+	memcpy(fullpath, dirpath, dirpath_len);
+	if (fullpath[dirpath_len-1] != '/'){
+		fullpath[dirpath_len] = '/';
+		++dirpath_len;
+	}
+	DIR* const dir = opendir(dirpath);
+	if (unlikely(dir == nullptr))
+		return false;
+	struct dirent* ent;
+	while((ent = readdir(dir))){
+		if (likely((ent->d_type == DT_REG) or (ent->d_type == DT_LNK))){
+			filenames.emplace_back(fullpath, dirpath_len, ent->d_name);
+		}
+	}
+	closedir(dir);
+	return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "md_to_html.h"
+
+#include <vector>
+#include <string_view>
+
+
+struct ReplacementTrie {
+	// Maps the names of the -R files (without their R_E_P_L_A_C_E_ prefix) to their index in ReplacementTable::filenames, finding the longest name which prefixes a string in a single walk
+	struct Node {
+		unsigned first_edge;
+		unsigned n_edges;
+		int filename_indx; // -1 if no name ends at this node
+	};
+	struct Edge {
+		char c;
+		unsigned node_indx;
+	};
+	std::vector<Node> nodes;
+	std::vector<Edge> edges; // The edges of each node are contiguous, and sorted by c
+
+	void build(const std::vector<Filename>& filenames);
+	int longest_match(const char* str) const;
+};
+
+struct ReplacementTable {
+	// Only read while documents are converted - each file's contents are mapped, atomically, when first used - so one table can be shared by every thread
+	std::vector<Filename> filenames;
+	ReplacementTrie trie;
+};
+
+bool read_replacement_dir(const char* const dirpath,  std::vector<Filename>& filenames);
+void preload_replacements(std::vector<Filename>& filenames);
@@ -0,0 +1,193 @@
+#include "scan.h"
+
+#include <compsky/utils/ptrdiff.hpp>
+#include <compsky/macros/likely.hpp>
+#include <array>
+#include <cstring>
+#if defined(__x86_64__)
+# include <immintrin.h>
+#endif
+
+
+constexpr
+std::array<bool,256> make_special_chars(){
+	std::array<bool,256> arr{};
+	for (const char c : {'\0', '\n', '#', '"', '[', ']', '<', '>', '*', '`', 'R', '\\'})
+		arr[static_cast<unsigned char>(c)] = true;
+	return arr;
+}
+constexpr std::array<bool,256> is_special_char = make_special_chars();
+
+
+static
+const char* find_plain_text_end_scalar(const char* itr,  const char* const end){
+	while((itr != end) and not is_special_char[static_cast<unsigned char>(*itr)])
+		++itr;
+	return itr;
+}
+
+#if defined(__x86_64__)
+// Neither reads past end: the remainder too short for a vector is left to the scalar loop
+
+static
+const char* find_plain_text_end_sse2(const char* itr,  const char* const end){
+	while(compsky::utils::ptrdiff(end,itr) >= 16){
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(itr));
+		// '"' and '#' differ only in the lowest bit, as do '<' and '>' in the second lowest
+		__m128i m = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(1)), _mm_set1_epi8('#')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_or_si128(v, _mm_set1_epi8(2)), _mm_set1_epi8('>')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('R')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('`')));
+		const unsigned mask = _mm_movemask_epi8(m);
+		if (mask != 0)
+			return itr + __builtin_ctz(mask);
+		itr += 16;
+	}
+	return find_plain_text_end_scalar(itr, end);
+}
+
+__attribute__((target("avx2")))
+static
+const char* find_plain_text_end_avx2(const char* itr,  const char* const end){
+	while(compsky::utils::ptrdiff(end,itr) >= 32){
+		const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(itr));
+		__m256i m = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(1)), _mm256_set1_epi8('#')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_or_si256(v, _mm256_set1_epi8(2)), _mm256_set1_epi8('>')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('R')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('`')));
+		const unsigned mask = _mm256_movemask_epi8(m);
+		if (mask != 0)
+			return itr + __builtin_ctz(mask);
+		itr += 32;
+	}
+	return find_plain_text_end_sse2(itr, end);
+}
+#endif
+
+
+static
+auto resolve_find_plain_text_end(){
+	// SSE2 is part of x86-64, so only AVX2 needs checking for
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return find_plain_text_end_avx2;
+	return find_plain_text_end_sse2;
+#else
+	return find_plain_text_end_scalar;
+#endif
+}
+
+const char* (*const find_plain_text_end)(const char* itr,  const char* const end) = resolve_find_plain_text_end();
+
+
+void InlineLookahead::clear(){
+	for (Memo& memo : this->stop_memos)
+		memo = {nullptr, nullptr};
+	this->asterisk_run = {nullptr, nullptr};
+	for (Memo& memo : this->emphasis_ends)
+		memo = {nullptr, nullptr};
+	this->link_url_end = {nullptr, nullptr};
+	this->bracket_pairs.clear();
+	this->bracket_pairs_cursor = 0;
+	this->bracket_pairs_end = nullptr;
+}
+
+const char* InlineLookahead::find_stop(const char* itr,  const char c){
+	// Any scan from within [from,to] stops where the scan from from did
+	Memo& memo = this->stop_memos[c == ')'];
+	if ((itr >= memo.from) and (itr <= memo.to))
+		return memo.to;
+	memo.from = itr;
+	while((*itr != c) and (*itr != '\n') and (*itr != 0))
+		++itr;
+	memo.to = itr;
+	return itr;
+}
+
+const char* InlineLookahead::find_asterisk_run_end(const char* itr){
+	if ((itr >= this->asterisk_run.from) and (itr <= this->asterisk_run.to))
+		return this->asterisk_run.to;
+	this->asterisk_run.from = itr;
+	while(*itr == '*')
+		++itr;
+	this->asterisk_run.to = itr;
+	return itr;
+}
+
+const char* InlineLookahead::find_emphasis_end(const char* itr,  const unsigned n_asterisks){
+	// A scan from within [from,to] which found no run stops at the same end of the line. One which found a run at to finds the same one from anywhere before the run starts, as it sees a subset of the asterisks the scan from from saw.
+	Memo& memo = this->emphasis_ends[n_asterisks-1];
+	if ((itr >= memo.from) and (itr <= memo.to) and ((*memo.to != '*') or (itr + n_asterisks <= memo.to + 1)))
+		return memo.to;
+	memo.from = itr;
+	unsigned n_asterisks_r = 0;
+	while((*itr != 0) and (*itr != '\n')){
+		if (*itr != '*'){
+			n_asterisks_r = 0;
+		} else {
+			++n_asterisks_r;
+			if (n_asterisks_r == n_asterisks)
+				break;
+		}
+		++itr;
+	}
+	memo.to = itr;
+	return itr;
+}
+
+const char* InlineLookahead::find_closing_bracket(const char* const opening_bracket){
+	// The first lookup on a line pairs every bracket from there to the end of the line, in a single pass with a stack of those not yet paired. The pairing of a '[' only depends on what follows it, so later lookups on the line find theirs among them.
+	if ((this->bracket_pairs.empty()) or (opening_bracket < this->bracket_pairs.front().first) or (opening_bracket >= this->bracket_pairs_end)){
+		this->bracket_pairs.clear();
+		this->unpaired_brackets.clear();
+		this->bracket_pairs_cursor = 0;
+		const char* itr = opening_bracket;
+		while(true){
+			itr += strcspn(itr, "[]\n");
+			if (*itr == '['){
+				this->unpaired_brackets.push_back(this->bracket_pairs.size());
+				this->bracket_pairs.emplace_back(itr, nullptr);
+			} else if (*itr == ']'){
+				if (not this->unpaired_brackets.empty()){
+					this->bracket_pairs[this->unpaired_brackets.back()].second = itr;
+					this->unpaired_brackets.pop_back();
+				}
+			} else {
+				break;
+			}
+			++itr;
+		}
+		this->bracket_pairs_end = itr;
+	}
+	while(this->bracket_pairs[this->bracket_pairs_cursor].first < opening_bracket)
+		++this->bracket_pairs_cursor;
+	return this->bracket_pairs[this->bracket_pairs_cursor].second;
+}
+
+const char* InlineLookahead::find_link_url_end(const char* itr){
+	// A scan from within [from,to] stops where the scan from from did, as the latter passed itr outside of an escape - the byte before itr being a '(', not a backslash
+	if ((itr >= this->link_url_end.from) and (itr <= this->link_url_end.to))
+		return (*this->link_url_end.to == ')') ? this->link_url_end.to : nullptr;
+	this->link_url_end.from = itr;
+	while(true){
+		itr += strcspn(itr, ")\n\\");
+		if ((*itr != '\\') or (itr[1] == 0))
+			break;
+		itr += 2;
+	}
+	this->link_url_end.to = itr;
+	return (*itr == ')') ? itr : nullptr;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// The bytes which md_to_html's main loop does anything with other than copy: NUL, newline, # " [ ] < > * ` R and backslash
+// A space only matters at the start of a line, which a run of plain text never contains, so it is not among them.
+extern const char* (*const find_plain_text_end)(const char* itr,  const char* const end); // Returns the first such byte within [itr,end), or end
+
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+
+struct InlineLookahead {
+	// The inline constructs look ahead, as far as the end of the line, for what closes them. Were each of n unmatched openings on a line to rescan it, the line would cost O(n²), so each scan's result is kept and reused by later scans of the line which start within the range it covered: every byte of a line is scanned at most once for each kind of closing delimiter.
+	// The results are pointers into the input window, so must be cleared whenever it is refilled
+	struct Memo {
+		// A scan which began at from and stopped at to
+		const char* from;
+		const char* to;
+	};
+	Memo stop_memos[2]; // For find_stop, indexed by whether it is for ')'
+	Memo asterisk_run;
+	Memo emphasis_ends[2]; // Indexed by the number of asterisks less one, up to md_to_html's emphasis_max
+	Memo link_url_end;
+	std::vector<std::pair<const char*,const char*>> bracket_pairs; // Each '[' of the line, from the first looked up, and its ']' or nullptr
+	std::vector<std::size_t> unpaired_brackets; // Only while pairing them
+	std::size_t bracket_pairs_cursor;
+	const char* bracket_pairs_end; // The end of the line they were found on
+
+	InlineLookahead(){
+		this->clear();
+	}
+	void clear();
+
+	const char* find_stop(const char* itr,  const char c); // The first c, newline or NUL. c is '>' or ')'.
+	const char* find_asterisk_run_end(const char* itr);
+	const char* find_emphasis_end(const char* itr,  const unsigned n_asterisks); // The last asterisk of the first run of n_asterisks, or the newline or NUL which ends the line
+	const char* find_closing_bracket(const char* const opening_bracket); // The ']' which pairs with it, counting those nested between them, on the same line; or nullptr
+	const char* find_link_url_end(const char* itr); // The first ')' not escaped by a backslash - itr being just after a '(' - or nullptr if the line ends first
+};
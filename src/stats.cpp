@@ -0,0 +1,215 @@
+#include "stats.h"
+
+#include <compsky/macros/likely.hpp>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+
+thread_local ConversionStats* conversion_stats = nullptr;
+thread_local uint64_t phase_timed_ns = 0;
+thread_local uint64_t phase_counted[n_hardware_counters] = {};
+
+constexpr const char* hardware_counter_names[n_hardware_counters] = {"cycles", "instructions", "branch_misses", "cache_misses"};
+
+
+struct HardwareCounters {
+	// Of one thread, as a group, so that they are read at once and cover the same instructions
+	int fds[n_hardware_counters]; // -1 for those which could not be opened
+	int group_fd; // Of the first which could be, otherwise -1
+	bool is_opened;
+
+	HardwareCounters()
+	: group_fd(-1)
+	, is_opened(false)
+	{
+		for (unsigned i = 0;  i < n_hardware_counters;  ++i)
+			this->fds[i] = -1;
+	}
+	~HardwareCounters(){
+		for (unsigned i = 0;  i < n_hardware_counters;  ++i)
+			if (this->fds[i] != -1)
+				close(this->fds[i]);
+	}
+
+	void open(ConversionStats& stats);
+};
+
+static
+int open_hardware_counter(const uint64_t config,  const bool is_counting_kernel,  const int group_fd){
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = not is_counting_kernel;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0); // Of this thread, on any CPU
+}
+
+void HardwareCounters::open(ConversionStats& stats){
+	constexpr uint64_t configs[n_hardware_counters] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+	this->is_opened = true;
+	int error = 0;
+	for (unsigned i = 0;  i < n_hardware_counters;  ++i){
+		this->fds[i] = open_hardware_counter(configs[i], stats.is_counting_kernel.load(std::memory_order_relaxed), this->group_fd);
+		if ((this->fds[i] == -1) and ((errno == EACCES) or (errno == EPERM)) and stats.is_counting_kernel.load(std::memory_order_relaxed)){
+			// perf_event_paranoid allows only the events of user space to be counted. Every thread counts only those from then on, though those before may not have.
+			stats.is_counting_kernel.store(false, std::memory_order_relaxed);
+			this->fds[i] = open_hardware_counter(configs[i], false, this->group_fd);
+		}
+		if (this->fds[i] == -1){
+			error = errno;
+			stats.unavailable_counters.fetch_or(1u << i, std::memory_order_relaxed);
+		} else if (this->group_fd == -1){
+			this->group_fd = this->fds[i];
+		}
+	}
+	int no_error = 0;
+	if ((this->group_fd == -1) and stats.hardware_counters_errno.compare_exchange_strong(no_error, error))
+		fprintf(stderr, "WARNING: Cannot read hardware counters, so they are not reported: %s\n", strerror(error)); // e.g. ENOENT in a virtual machine without a PMU, or EACCES if perf_event_paranoid is above 2
+}
+
+bool read_hardware_counters(ConversionStats& stats,  uint64_t* const counts){
+	static thread_local HardwareCounters counters;
+	if (unlikely(not counters.is_opened))
+		counters.open(stats);
+	if (unlikely(counters.group_fd == -1))
+		return false;
+	struct {
+		uint64_t nr;
+		uint64_t time_enabled;
+		uint64_t time_running;
+		uint64_t values[n_hardware_counters];
+	} group;
+	if (unlikely(read(counters.group_fd, &group, sizeof(group)) <= 0))
+		return false;
+	// If the PMU has too few counters for every group being counted, the kernel multiplexes them, and the counts are estimated from the time this group was counted
+	const double scale = (group.time_running == 0) ? 0.0 : static_cast<double>(group.time_enabled) / group.time_running;
+	unsigned j = 0;
+	for (unsigned i = 0;  i < n_hardware_counters;  ++i)
+		counts[i] = (counters.fds[i] == -1) ? 0 : static_cast<uint64_t>(group.values[j++] * scale);
+	return true;
+}
+
+
+PhaseCounters::PhaseCounters(){
+	for (unsigned i = 0;  i < n_hardware_counters;  ++i)
+		this->counts[i] = 0;
+}
+
+
+ConversionStats::ConversionStats()
+: read_ns(0)
+, parse_ns(0)
+, style_ns(0)
+, replace_ns(0)
+, write_ns(0)
+, tree_ns(0)
+, minify_ns(0)
+, n_input_bytes(0)
+, n_output_bytes(0)
+, n_referenced_bytes(0)
+, n_headings(0)
+, n_links(0)
+, n_emphases(0)
+, n_list_items(0)
+, n_tags_opened(0)
+, n_replacements(0)
+, n_warnings(0)
+, n_style_cache_hits(0)
+, n_children(0)
+, n_child_cache_hits(0)
+, n_inline_functions(0)
+, n_inline_function_cache_hits(0)
+, started_at(monotonic_ns())
+, is_counting_hardware(false)
+, is_counting_kernel(true)
+, unavailable_counters(0)
+, hardware_counters_errno(0)
+{}
+
+void ConversionStats::add(const ConstructCounts& counts){
+	this->n_headings.fetch_add(counts.n_headings, std::memory_order_relaxed);
+	this->n_links.fetch_add(counts.n_links, std::memory_order_relaxed);
+	this->n_emphases.fetch_add(counts.n_emphases, std::memory_order_relaxed);
+	this->n_list_items.fetch_add(counts.n_list_items, std::memory_order_relaxed);
+	this->n_tags_opened.fetch_add(counts.n_tags_opened, std::memory_order_relaxed);
+}
+
+static
+void append_phase_counters(std::string& json,  const char* const name,  const PhaseCounters& counters,  const unsigned unavailable_counters,  const uint64_t n_input_bytes){
+	// With IPC, and the misses per KiB of input, unless they would divide by zero
+	char buf[128];
+	json += '"';
+	json += name;
+	json += "\":{";
+	for (unsigned i = 0;  i < n_hardware_counters;  ++i){
+		json += '"';
+		json += hardware_counter_names[i];
+		json += "\":";
+		json += (unavailable_counters & (1u << i)) ? "null" : std::to_string(counters.counts[i].load());
+		json += ',';
+	}
+	const uint64_t n_cycles = counters.counts[counter_cycles].load();
+	const bool is_ipc_known = (n_cycles != 0) and not (unavailable_counters & ((1u << counter_cycles) | (1u << counter_instructions)));
+	snprintf(buf, sizeof(buf), is_ipc_known ? "\"ipc\":%.3f," : "\"ipc\":null,", is_ipc_known ? static_cast<double>(counters.counts[counter_instructions].load()) / n_cycles : 0.0);
+	json += buf;
+	for (const HardwareCounter counter : {counter_branch_misses, counter_cache_misses}){
+		const bool is_known = (n_input_bytes != 0) and not (unavailable_counters & (1u << counter));
+		snprintf(buf, sizeof(buf), is_known ? "\"%s_per_kib\":%.3f," : "\"%s_per_kib\":null,", hardware_counter_names[counter], is_known ? counters.counts[counter].load() * 1024.0 / n_input_bytes : 0.0);
+		json += buf;
+	}
+	json.back() = '}';
+	json += ',';
+}
+
+bool ConversionStats::write_json(const int fd) const {
+	char buf[2048];
+	std::string json;
+	const int n = snprintf(buf, sizeof(buf),
+		"{"
+			"\"wall_ns\":%lu,"
+			"\"phases_ns\":{\"read\":%lu,\"parse\":%lu,\"style\":%lu,\"replace\":%lu,\"write\":%lu,\"tree\":%lu,\"minify\":%lu},"
+			"\"input_bytes\":%lu,"
+			"\"output_bytes\":%lu,"
+			"\"referenced_bytes\":%lu,"
+			"\"counts\":{\"headings\":%lu,\"links\":%lu,\"emphases\":%lu,\"list_items\":%lu,\"tags_opened\":%lu,\"replacements\":%lu,\"warnings\":%lu,\"style_cache_hits\":%lu,\"children\":%lu,\"child_cache_hits\":%lu,\"inline_functions\":%lu,\"inline_function_cache_hits\":%lu}",
+		monotonic_ns() - this->started_at,
+		this->read_ns.load(), this->parse_ns.load(), this->style_ns.load(), this->replace_ns.load(), this->write_ns.load(), this->tree_ns.load(), this->minify_ns.load(),
+		this->n_input_bytes.load(),
+		this->n_output_bytes.load(),
+		this->n_referenced_bytes.load(),
+		this->n_headings.load(), this->n_links.load(), this->n_emphases.load(), this->n_list_items.load(), this->n_tags_opened.load(), this->n_replacements.load(), this->n_warnings.load(), this->n_style_cache_hits.load(), this->n_children.load(), this->n_child_cache_hits.load(), this->n_inline_functions.load(), this->n_inline_function_cache_hits.load()
+	);
+	json.assign(buf, n);
+	if (this->is_counting_hardware){
+		json += ",\"counters\":{";
+		const int error = this->hardware_counters_errno.load();
+		const unsigned unavailable_counters = this->unavailable_counters.load();
+		if ((error != 0) and (unavailable_counters == (1u << n_hardware_counters) - 1)){
+			// No thread could open any
+			json += "\"error\":\"";
+			json += strerror(error);
+			json += "\",";
+		} else {
+			json += this->is_counting_kernel.load() ? "\"kernel\":true," : "\"kernel\":false,";
+			const uint64_t n_input_bytes = this->n_input_bytes.load();
+			append_phase_counters(json, "read", this->read_counters, unavailable_counters, n_input_bytes);
+			append_phase_counters(json, "parse", this->parse_counters, unavailable_counters, n_input_bytes);
+			append_phase_counters(json, "style", this->style_counters, unavailable_counters, n_input_bytes);
+			append_phase_counters(json, "replace", this->replace_counters, unavailable_counters, n_input_bytes);
+			append_phase_counters(json, "write", this->write_counters, unavailable_counters, n_input_bytes);
+			append_phase_counters(json, "tree", this->tree_counters, unavailable_counters, n_input_bytes);
+			append_phase_counters(json, "minify", this->minify_counters, unavailable_counters, n_input_bytes);
+		}
+		json.back() = '}';
+	}
+	json += "}\n";
+	return (write(fd, json.data(), json.size()) == static_cast<ssize_t>(json.size()));
+}
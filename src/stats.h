@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <time.h>
+
+
+struct ConstructCounts {
+	// Counted by md_to_html's main loop, in locals, and added to the totals when it returns
+	uint64_t n_headings;
+	uint64_t n_links;
+	uint64_t n_emphases;
+	uint64_t n_list_items;
+	uint64_t n_tags_opened;
+};
+
+enum HardwareCounter : unsigned char {
+	counter_cycles,
+	counter_instructions,
+	counter_branch_misses,
+	counter_cache_misses, // Of the last level cache
+	n_hardware_counters
+};
+
+struct PhaseCounters {
+	// The hardware events of a phase, counted as its time is, if ConversionStats::is_counting_hardware
+	std::atomic<uint64_t> counts[n_hardware_counters];
+
+	PhaseCounters();
+};
+
+struct ConversionStats {
+	// Times are in nanoseconds, summed over every thread. Each phase excludes those nested within it - e.g. a write() when md_to_html flushes - so that the phases add up to the time spent converting.
+	// The pages of mapped inputs are faulted in as they are parsed, so reading them counts towards parse_ns rather than read_ns.
+	std::atomic<uint64_t> read_ns;
+	std::atomic<uint64_t> parse_ns;
+	std::atomic<uint64_t> style_ns;
+	std::atomic<uint64_t> replace_ns;
+	std::atomic<uint64_t> write_ns;
+	std::atomic<uint64_t> tree_ns; // Parsing, transforming and rendering a DocumentTree
+	std::atomic<uint64_t> minify_ns;
+	PhaseCounters read_counters;
+	PhaseCounters parse_counters;
+	PhaseCounters style_counters;
+	PhaseCounters replace_counters;
+	PhaseCounters write_counters;
+	PhaseCounters tree_counters;
+	PhaseCounters minify_counters;
+	std::atomic<uint64_t> n_input_bytes;
+	std::atomic<uint64_t> n_output_bytes;
+	std::atomic<uint64_t> n_referenced_bytes; // Of n_output_bytes, those written from the input or the replacements where they were, rather than copied into the output buffer
+	std::atomic<uint64_t> n_headings;
+	std::atomic<uint64_t> n_links;
+	std::atomic<uint64_t> n_emphases;
+	std::atomic<uint64_t> n_list_items;
+	std::atomic<uint64_t> n_tags_opened;
+	std::atomic<uint64_t> n_replacements;
+	std::atomic<uint64_t> n_warnings;
+	std::atomic<uint64_t> n_style_cache_hits; // <style> elements whose display rules were cached from another document
+	std::atomic<uint64_t> n_children; // Child documents included
+	std::atomic<uint64_t> n_child_cache_hits; // Of n_children, those whose HTML was cached - from an earlier inclusion, or converted ahead
+	std::atomic<uint64_t> n_inline_functions; // Calls of inline functions
+	std::atomic<uint64_t> n_inline_function_cache_hits; // Of n_inline_functions, those whose result was cached
+	uint64_t started_at;
+	bool is_counting_hardware; // Each thread opens its own counters through perf_event_open, and every phase reads them twice, so this is opt-in
+	std::atomic<bool> is_counting_kernel; // Whether the counters include the kernel's events, e.g. within write(). They do unless perf_event_paranoid forbids it.
+	std::atomic<unsigned> unavailable_counters; // A bit for each counter which a thread could not open
+	std::atomic<int> hardware_counters_errno; // Of the first thread which could open none, otherwise 0
+
+	ConversionStats();
+
+	void add(const ConstructCounts& counts);
+	bool write_json(const int fd) const;
+};
+
+extern thread_local ConversionStats* conversion_stats; // The ConversionOptions::stats of the conversion running on this thread, set by whatever starts it. If nullptr, nothing is timed or counted.
+
+
+inline
+uint64_t monotonic_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec)*1000000000u + ts.tv_nsec;
+}
+
+extern thread_local uint64_t phase_timed_ns; // The time attributed to every phase so far on this thread, so that an enclosing phase can exclude it
+extern thread_local uint64_t phase_counted[n_hardware_counters]; // Likewise, of the hardware events
+
+bool read_hardware_counters(ConversionStats& stats,  uint64_t* const counts); // Of this thread, since it first read them. Opens them on its first call. false if none can be.
+
+struct PhaseTimer {
+	// Adds the time until it is destroyed to a phase, less the time of the phases timed within it - and likewise the hardware events, if they are being counted. Does nothing unless stats are being collected.
+	std::atomic<uint64_t>* const phase_ns;
+	PhaseCounters* phase_counters; // nullptr unless the hardware events are being counted
+	uint64_t started_at;
+	uint64_t timed_ns_before;
+	uint64_t counted_at[n_hardware_counters];
+	uint64_t counted_before[n_hardware_counters];
+
+	PhaseTimer(std::atomic<uint64_t> ConversionStats::* const phase,  PhaseCounters ConversionStats::* const counters)
+	: phase_ns((conversion_stats == nullptr) ? nullptr : &(conversion_stats->*phase))
+	, phase_counters(nullptr)
+	, started_at(0)
+	, timed_ns_before(0)
+	{
+		if (this->phase_ns != nullptr){
+			if (conversion_stats->is_counting_hardware and read_hardware_counters(*conversion_stats, this->counted_at)){
+				this->phase_counters = &(conversion_stats->*counters);
+				for (unsigned i = 0;  i < n_hardware_counters;  ++i)
+					this->counted_before[i] = phase_counted[i];
+			}
+			this->timed_ns_before = phase_timed_ns;
+			this->started_at = monotonic_ns();
+		}
+	}
+	~PhaseTimer(){
+		if (this->phase_ns != nullptr){
+			const uint64_t elapsed = monotonic_ns() - this->started_at;
+			const uint64_t nested = phase_timed_ns - this->timed_ns_before;
+			this->phase_ns->fetch_add(elapsed - nested, std::memory_order_relaxed);
+			phase_timed_ns = this->timed_ns_before + elapsed;
+		}
+		if (this->phase_counters != nullptr){
+			uint64_t counted_to[n_hardware_counters];
+			read_hardware_counters(*conversion_stats, counted_to);
+			for (unsigned i = 0;  i < n_hardware_counters;  ++i){
+				const uint64_t counted = counted_to[i] - this->counted_at[i];
+				const uint64_t nested = phase_counted[i] - this->counted_before[i];
+				this->phase_counters->counts[i].fetch_add(counted - nested, std::memory_order_relaxed);
+				phase_counted[i] = this->counted_before[i] + counted;
+			}
+		}
+	}
+};
+
+inline
+void count_input_bytes(const uint64_t n){
+	if (conversion_stats != nullptr)
+		conversion_stats->n_input_bytes.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline
+void count_warning(){
+	if (conversion_stats != nullptr)
+		conversion_stats->n_warnings.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,274 @@
+#include "style_rules.h"
+#include "md_to_html.h"
+#include "stats.h"
+#include "tag_names.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+
+
+static
+bool is_css_space(const char c){
+	return ((c == ' ') or (c == '\t') or (c == '\n') or (c == '\r') or (c == '\f'));
+}
+
+static
+bool is_css_name_char(const char c){
+	return (
+		((c >= 'a') and (c <= 'z')) or
+		((c >= 'A') and (c <= 'Z')) or
+		((c >= '0') and (c <= '9')) or
+		(c == '-') or
+		(c == '_')
+	);
+}
+
+static
+bool equals_ignoring_case(const std::string_view a,  const char* const b){
+	return ((a.size() == strlen(b)) and (strncasecmp(a.data(), b, a.size()) == 0));
+}
+
+static
+const char* skip_css_comment(const char* itr,  const char* const end){
+	// itr is at the "/*". Returns the position after the "*/", or end if there is none.
+	itr += 2;
+	while((end - itr >= 2) and not ((itr[0] == '*') and (itr[1] == '/')))
+		++itr;
+	return (end - itr >= 2) ? itr + 2 : end;
+}
+
+static
+const char* skip_css_string(const char* itr,  const char* const end){
+	// itr is at the opening quote. Returns the position after the closing quote, or end if there is none.
+	const char quote = *itr;
+	++itr;
+	while((itr != end) and (*itr != quote)){
+		if ((*itr == '\\') and (itr+1 != end))
+			++itr;
+		++itr;
+	}
+	return (itr == end) ? end : itr + 1;
+}
+
+static
+const char* skip_css_space(const char* itr,  const char* const end){
+	// And comments
+	while(itr != end){
+		if (is_css_space(*itr))
+			++itr;
+		else if ((*itr == '/') and (itr+1 != end) and (itr[1] == '*'))
+			itr = skip_css_comment(itr, end);
+		else
+			break;
+	}
+	return itr;
+}
+
+static
+std::string_view trim_css(const char* begin,  const char* end){
+	begin = skip_css_space(begin, end);
+	while((end != begin) and is_css_space(end[-1]))
+		--end;
+	return std::string_view(begin, end - begin);
+}
+
+constexpr
+std::array<bool,256> make_css_special_chars(){
+	std::array<bool,256> arr{};
+	for (const char c : {'/', '"', '\'', '(', ')', '[', ']', '{', '}', ';', ':', ','})
+		arr[static_cast<unsigned char>(c)] = true;
+	return arr;
+}
+constexpr std::array<bool,256> is_css_special_char = make_css_special_chars(); // Those which find_css_delimiter does anything with: any of its delimiters, and the openings and closings of what it skips
+
+static
+const char* find_css_delimiter(const char* itr,  const char* const end,  const char* const delimiters){
+	// The first of delimiters which is not within a comment, a string or brackets, or end
+	unsigned bracket_depth = 0;
+	while(itr != end){
+		const char c = *itr;
+		if (not is_css_special_char[static_cast<unsigned char>(c)]){
+			++itr;
+			continue;
+		}
+		if ((c == '/') and (itr+1 != end) and (itr[1] == '*')){
+			itr = skip_css_comment(itr, end);
+			continue;
+		}
+		if ((c == '"') or (c == '\'')){
+			itr = skip_css_string(itr, end);
+			continue;
+		}
+		if ((bracket_depth == 0) and (c != 0) and (strchr(delimiters, c) != nullptr))
+			return itr;
+		if ((c == '(') or (c == '['))
+			++bracket_depth;
+		else if (((c == ')') or (c == ']')) and (bracket_depth != 0))
+			--bracket_depth;
+		++itr;
+	}
+	return end;
+}
+
+static
+const char* find_css_block_end(const char* itr,  const char* const end){
+	// itr is just after a '{'. Returns the position of the '}' which closes it, or end if there is none.
+	unsigned depth = 0;
+	while(true){
+		itr = find_css_delimiter(itr, end, "{}");
+		if (itr == end)
+			return end;
+		if (*itr == '}'){
+			if (depth == 0)
+				return itr;
+			--depth;
+		} else {
+			++depth;
+		}
+		++itr;
+	}
+}
+
+static
+bool is_rule_list_at_rule(const std::string_view prelude){
+	// Those whose blocks contain rules, rather than declarations
+	std::size_t name_end = 1;
+	while((name_end < prelude.size()) and is_css_name_char(prelude[name_end]))
+		++name_end;
+	const std::string_view name = prelude.substr(1, name_end-1);
+	for (const char* const rule_list_at_rule : {"media", "supports", "layer", "container", "document", "-moz-document", "scope"})
+		if (equals_ignoring_case(name, rule_list_at_rule))
+			return true;
+	return false;
+}
+
+static
+unsigned char display_flag(std::string_view value){
+	// Of the outer display type: inline for inline, inline-block, inline-flex and the like, block for the others which generate a box
+	const std::size_t important = value.find('!');
+	if (important != std::string_view::npos)
+		value = trim_css(value.data(), value.data() + important);
+	std::size_t word_end = 0;
+	while((word_end < value.size()) and not is_css_space(value[word_end]))
+		++word_end;
+	const std::string_view word = value.substr(0, word_end);
+	if ((word.size() >= 6) and (strncasecmp(word.data(), "inline", 6) == 0))
+		return tag_inline;
+	for (const char* const block_value : {"block", "flex", "grid", "table", "list-item", "flow-root"})
+		if (equals_ignoring_case(word, block_value))
+			return tag_noninline;
+	return 0;
+}
+
+static
+unsigned char display_flag_of_declarations(const char* itr,  const char* const end){
+	// The last display declaration wins, as it would in the browser. Nested rules are skipped.
+	unsigned char flag = 0;
+	while(true){
+		itr = skip_css_space(itr, end);
+		const char* const declaration_end = find_css_delimiter(itr, end, ";{");
+		if ((declaration_end != end) and (*declaration_end == '{')){
+			const char* const nested_end = find_css_block_end(declaration_end+1, end);
+			if (nested_end == end)
+				return flag;
+			itr = nested_end + 1;
+			continue;
+		}
+		const char* const colon = find_css_delimiter(itr, declaration_end, ":");
+		if ((colon != declaration_end) and equals_ignoring_case(trim_css(itr, colon), "display"))
+			flag = display_flag(trim_css(colon+1, declaration_end));
+		if (declaration_end == end)
+			return flag;
+		itr = declaration_end + 1;
+	}
+}
+
+static
+void add_selector_subjects(const std::string_view selectors,  const unsigned char flag,  std::vector<DisplayRule>& rules){
+	// The subject of a selector is its last compound selector. Only if that is a bare tag name - e.g. "li" of "ul > li", but not "div.x" - is every element of that name given the display value.
+	const char* itr = selectors.data();
+	const char* const end = itr + selectors.size();
+	while(true){
+		const char* const selector_end = find_css_delimiter(itr, end, ",");
+		const char* name_end = selector_end;
+		while((name_end != itr) and is_css_space(name_end[-1]))
+			--name_end;
+		const char* name_begin = name_end;
+		while((name_begin != itr) and is_css_name_char(name_begin[-1]))
+			--name_begin;
+		if ((name_begin == itr) or is_css_space(name_begin[-1]) or (name_begin[-1] == '>') or (name_begin[-1] == '+') or (name_begin[-1] == '~')){
+			if ((name_end - name_begin > 14) and startswithreplace(name_begin))
+				name_begin += 14;
+			bool is_tag_name = ((name_begin != name_end) and (*name_begin >= 'a') and (*name_begin <= 'z'));
+			for (const char* c = name_begin;  c != name_end;  ++c)
+				is_tag_name &= (((*c >= 'a') and (*c <= 'z')) or ((*c >= '0') and (*c <= '9')) or (*c == '-'));
+			if (is_tag_name)
+				rules.push_back({std::string_view(name_begin, name_end - name_begin), flag});
+		}
+		if (selector_end == end)
+			return;
+		itr = selector_end + 1;
+	}
+}
+
+void scan_display_rules(const std::string_view css,  std::vector<DisplayRule>& rules,  const bool is_reporting){
+	// A single pass over the rules, which may be nested within rule-list at-rules such as @media
+	const char* itr = css.data();
+	const char* const end = itr + css.size();
+	while(true){
+		itr = skip_css_space(itr, end);
+		const char* const prelude_begin = itr;
+		itr = find_css_delimiter(itr, end, "{};");
+		if (itr == end)
+			break;
+		if (*itr != '{'){
+			// The end of an at-rule's block of rules, or of a statement at-rule such as @import
+			++itr;
+			continue;
+		}
+		const std::string_view prelude = trim_css(prelude_begin, itr);
+		++itr;
+		if ((not prelude.empty()) and (prelude[0] == '@') and is_rule_list_at_rule(prelude))
+			continue;
+		const char* const block_end = find_css_block_end(itr, end);
+		if ((prelude.empty()) or (prelude[0] != '@')){
+			const unsigned char flag = display_flag_of_declarations(itr, block_end);
+			if (flag != 0)
+				add_selector_subjects(prelude, flag, rules);
+		}
+		if (block_end == end){
+			if (is_reporting){
+				fprintf(stderr, "WARNING: Unclosed block in <style>: %.*s\n", (int)std::min<std::size_t>(prelude.size(), 100), prelude.data());
+				count_warning();
+			}
+			break;
+		}
+		itr = block_end + 1;
+	}
+}
+
+
+const std::vector<DisplayRule>* StyleCache::find(const Key& key){
+	std::lock_guard<std::mutex> lock(this->mutex);
+	const auto it = this->entries.find(key);
+	return (it == this->entries.end()) ? nullptr : &it->second->rules;
+}
+
+const std::vector<DisplayRule>* StyleCache::add(const Key& key,  const std::vector<DisplayRule>& rules){
+	std::unique_ptr<Entry> entry(new Entry{std::string(key.css), {}});
+	entry->rules.reserve(rules.size());
+	for (const DisplayRule& rule : rules)
+		entry->rules.push_back({std::string_view(entry->css.data() + (rule.tag_name.data() - key.css.data()), rule.tag_name.size()), rule.flag});
+	const Key cached_key = {entry->css, key.hash};
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->n_bytes + key.css.size() > STYLE_CACHE_MAX_SZ)
+		return nullptr;
+	const auto inserted = this->entries.emplace(cached_key, std::move(entry)); // Unless another thread has added it meanwhile
+	if (inserted.second)
+		this->n_bytes += key.css.size();
+	return &inserted.first->second->rules;
+}
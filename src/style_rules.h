@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+constexpr std::size_t STYLE_CACHE_MAX_SZ = 1024*1024*16; // Of stylesheets held. Beyond this, those not yet cached are scanned every time.
+
+
+struct DisplayRule {
+	// A tag name which a <style> element gives a display value
+	std::string_view tag_name;
+	unsigned char flag; // tag_inline or tag_noninline
+};
+
+void scan_display_rules(const std::string_view css,  std::vector<DisplayRule>& rules,  const bool is_reporting); // Appends the rules whose selectors' subjects are bare tag names, e.g. "card" and "li" of "card, ul > li {display: block}". The tag names are views into css.
+
+
+struct StyleCache {
+	// The display rules of each distinct stylesheet - the contents of a <style> element - so that documents sharing one, as in batch mode, only scan it once. Shared by concurrent conversions.
+	// Entries are never removed, as the tag names of a document being converted are views into them
+	struct Entry {
+		std::string css;
+		std::vector<DisplayRule> rules; // Views into css
+	};
+	struct Key {
+		// The hash is computed before the mutex is locked, as a stylesheet can be large
+		std::string_view css;
+		std::size_t hash;
+		bool operator==(const Key& othr) const {
+			return (this->css == othr.css);
+		}
+	};
+	struct KeyHash {
+		std::size_t operator()(const Key& key) const {
+			return key.hash;
+		}
+	};
+	std::mutex mutex;
+	std::unordered_map<Key, std::unique_ptr<Entry>, KeyHash> entries; // Keyed by views of their css
+	std::size_t n_bytes;
+
+	StyleCache()
+	: n_bytes(0)
+	{}
+
+	static Key key_of(const std::string_view css){
+		return Key{css, std::hash<std::string_view>()(css)};
+	}
+	const std::vector<DisplayRule>* find(const Key& key); // nullptr if not cached
+	const std::vector<DisplayRule>* add(const Key& key,  const std::vector<DisplayRule>& rules); // nullptr if the cache is full, otherwise the cached copy - with its tag names views into the copy of the css
+};
@@ -0,0 +1,174 @@
+#include "tag_names.h"
+
+#include <compsky/macros/likely.hpp>
+#include <array>
+
+
+struct BuiltinTagName {
+	std::string_view name;
+	unsigned char flags;
+};
+constexpr BuiltinTagName builtin_tag_names[] = {
+	{"br", tag_noninline},
+	{"hr", tag_noninline},
+	{"div", tag_noninline},
+	{"script", tag_noninline},
+	{"style", tag_noninline},
+	{"h1", tag_noninline},
+	{"h2", tag_noninline},
+	{"h3", tag_noninline},
+	{"h4", tag_noninline},
+	{"h5", tag_noninline},
+	{"h6", tag_noninline},
+	{"h7", tag_noninline},
+	{"h8", tag_noninline},
+	{"h9", tag_noninline},
+	{"h10", tag_noninline},
+	{"ul", tag_noninline},
+	{"li", tag_noninline},
+	{"canvas", tag_noninline},
+	{"button", tag_noninline},
+	{"p", tag_noninline},
+	{"table", tag_noninline},
+	{"tr", tag_noninline},
+	{"svg", tag_inline},
+	{"circle", tag_inline},
+	{"path", tag_inline},
+	{"img", tag_inline},
+	{"td", tag_inline},
+	{"th", tag_inline},
+	{"time", tag_inline},
+	{"input", tag_inline},
+	{"highlighttagnamehere", tag_inline}, // TODO
+	{"a", tag_inline},
+	{"span", tag_inline},
+	{"q", tag_inline},
+	{"em", tag_inline},
+	{"i", tag_inline},
+	{"b", tag_inline},
+	{"strong", tag_inline},
+	{"label", tag_inline}
+};
+constexpr std::size_t n_builtin_tag_names = sizeof(builtin_tag_names) / sizeof(builtin_tag_names[0]);
+constexpr std::size_t BUILTIN_TAG_TABLE_SZ = 256; // Large enough that a perfect seed is found after a few dozen tries
+static_assert(n_builtin_tag_names < BUILTIN_TAG_TABLE_SZ);
+
+constexpr
+uint32_t find_perfect_seed(){
+	for (uint32_t seed = 2166136261u;  ;  ++seed){
+		bool is_used[BUILTIN_TAG_TABLE_SZ] = {};
+		bool is_perfect = true;
+		for (const BuiltinTagName& tag : builtin_tag_names){
+			const uint32_t slot = hash_tag_name(tag.name, seed) % BUILTIN_TAG_TABLE_SZ;
+			if (is_used[slot]){
+				is_perfect = false;
+				break;
+			}
+			is_used[slot] = true;
+		}
+		if (is_perfect)
+			return seed;
+	}
+}
+constexpr uint32_t builtin_tag_seed = find_perfect_seed();
+
+constexpr
+std::array<unsigned char,BUILTIN_TAG_TABLE_SZ> make_builtin_tag_table(){
+	// Slot => index into builtin_tag_names, or 0xff
+	std::array<unsigned char,BUILTIN_TAG_TABLE_SZ> table{};
+	for (unsigned char& indx : table)
+		indx = 0xff;
+	for (std::size_t i = 0;  i < n_builtin_tag_names;  ++i)
+		table[hash_tag_name(builtin_tag_names[i].name, builtin_tag_seed) % BUILTIN_TAG_TABLE_SZ] = i;
+	return table;
+}
+constexpr std::array<unsigned char,BUILTIN_TAG_TABLE_SZ> builtin_tag_table = make_builtin_tag_table();
+
+constexpr
+std::size_t max_builtin_tag_name_len(){
+	std::size_t n = 0;
+	for (const BuiltinTagName& tag : builtin_tag_names)
+		if (tag.name.size() > n)
+			n = tag.name.size();
+	return n;
+}
+
+
+TagNames::TagNames()
+: n_entries(0)
+, max_name_len(max_builtin_tag_name_len())
+{}
+
+unsigned char TagNames::classify(const std::string_view name) const {
+	const uint32_t h = hash_tag_name(name, builtin_tag_seed);
+	unsigned char flags = 0;
+	const unsigned char builtin_indx = builtin_tag_table[h % BUILTIN_TAG_TABLE_SZ];
+	if ((builtin_indx != 0xff) and (builtin_tag_names[builtin_indx].name == name))
+		flags = builtin_tag_names[builtin_indx].flags;
+	if (this->n_entries != 0){
+		const std::size_t mask = this->entries.size() - 1;
+		for (std::size_t i = h & mask;  not this->entries[i].name.empty();  i = (i + 1) & mask){
+			if (this->entries[i].name == name){
+				flags |= this->entries[i].flags;
+				break;
+			}
+		}
+	}
+	return flags;
+}
+
+bool TagNames::is_opening_of_noninline(const char* const itr) const {
+	if (itr[0] != '<')
+		return false;
+	for (std::size_t i = 1;  i <= this->max_name_len + 1;  ++i){
+		switch(itr[i]){
+			case '>':
+			case ' ':
+				return (this->classify(std::string_view(itr+1, i-1)) & tag_noninline);
+			case 0:
+				return false;
+		}
+	}
+	return false;
+}
+
+void TagNames::add(const std::string_view name,  const unsigned char flags){
+	if (unlikely(2*(this->n_entries + 1) > this->entries.size())){
+		std::vector<Entry> old_entries;
+		old_entries.swap(this->entries);
+		this->entries.resize((old_entries.size() == 0) ? 16 : 2*old_entries.size(), Entry{std::string_view(), 0});
+		this->n_entries = 0;
+		for (const Entry& entry : old_entries)
+			if (not entry.name.empty())
+				this->add(entry.name, entry.flags);
+	}
+	const std::size_t mask = this->entries.size() - 1;
+	std::size_t i = hash_tag_name(name, builtin_tag_seed) & mask;
+	for (;  not this->entries[i].name.empty();  i = (i + 1) & mask){
+		if (this->entries[i].name == name){
+			this->entries[i].flags |= flags;
+			return;
+		}
+	}
+	this->entries[i] = Entry{name, flags};
+	++this->n_entries;
+	if (name.size() > this->max_name_len)
+		this->max_name_len = name.size();
+}
+
+bool TagNames::operator==(const TagNames& othr) const {
+	constexpr unsigned char display_flags = tag_noninline | tag_inline;
+	std::size_t n_displayed = 0;
+	for (const Entry& entry : this->entries){
+		if (entry.flags & display_flags){
+			++n_displayed;
+			if ((othr.classify(entry.name) & display_flags) != (this->classify(entry.name) & display_flags))
+				return false;
+		}
+	}
+	for (const Entry& entry : othr.entries){
+		if (entry.flags & display_flags)
+			--n_displayed;
+	}
+	return (n_displayed == 0);
+}
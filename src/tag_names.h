@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+
+enum TagNameFlag : unsigned char {
+	tag_noninline = 1,
+	tag_inline = 2,
+	tag_warned_about = 4 // Not given a display rule, which has already been warned about
+};
+
+constexpr
+uint32_t hash_tag_name(const std::string_view name,  const uint32_t seed){
+	// FNV-1a
+	uint32_t h = seed;
+	for (const char c : name)
+		h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+	return h;
+}
+
+
+struct TagNames {
+	// Classifies tag names: those built in by a perfect hash computed at compile time, and those added while converting a document - by <style> display rules, -b, and warnings - by an open addressing table
+	struct Entry {
+		std::string_view name; // Empty if the slot is free
+		unsigned char flags;
+	};
+	std::vector<Entry> entries; // Its size is 0 or a power of two
+	std::size_t n_entries;
+	std::size_t max_name_len;
+
+	TagNames();
+
+	unsigned char classify(const std::string_view name) const;
+	bool is_opening_of_noninline(const char* const itr) const; // itr is at a '<'
+	void add(const std::string_view name,  const unsigned char flags);
+	bool operator==(const TagNames& othr) const; // Ignores which tags have been warned about
+};
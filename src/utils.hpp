@@ -37,74 +37,25 @@ bool str_eq(const std::string_view& a,  const std::string_view& b){
 }
 
 
+// These scan up to the end of the line at most, but are called for every heading, link and emphasis, so use the vectorised string functions of libc
+
 const char* str_if_ends_with__before(const char* const init,  const char d,  const char before1){
 	// e.g. (init,d,before1)==("foo bar]",']','\n') => position before ']'
-	const char* itr = init;
-	while(*itr != 0){
-		if (*itr == before1){
-			break;
-		}
-		if (*itr == d){
-			return itr-1;
-		}
-		++itr;
-	}
-	return init-1;
-}
-const char* str_if_ends_with__before__allowescapes(const char* const init,  const char d,  const char before1){
-	// e.g. (init,d,before1)==("foo bar]",']','\n') => position before ']'
-	const char* itr = init;
-	while(*itr != 0){
-		if (*itr == before1){
-			break;
-		}
-		if (*itr == '\\'){
-			itr += 2;
-			continue;
-		}
-		if (*itr == d){
-			return itr-1;
-		}
-		++itr;
-	}
+	const char stop_at[3] = {d, before1, 0};
+	const char* const itr = strpbrk(init, stop_at);
+	if ((itr != nullptr) and (*itr == d))
+		return itr-1;
 	return init-1;
 }
-const char* str_if_ends_with__before__pair_up_with(const char* const init,  const char d,  const char before1,  const char pair_with){
-	// e.g. (init,d,before1)==("foo [bar] ree]",']','\n','[') => position after "ree" before ']'
-	const char* itr = init;
-	unsigned n_paired = 0;
-	while(*itr != 0){
-		if (*itr == before1){
-			break;
-		}
-		if (*itr == pair_with)
-			++n_paired;
-		if (*itr == d){
-			if (n_paired == 0)
-				return itr-1;
-			else
-				--n_paired;
-		}
-		++itr;
-	}
-	return init-1;
-}
-
 const char* str_if_ends_with(const char* const init,  const char d){
-	const char* itr = init;
-	while(*itr != 0){
-		if (*itr == d){
-			return itr-1;
-		}
-		++itr;
-	}
-	return init-1;
+	const char* const itr = strchr(init, d);
+	return (itr == nullptr) ? init-1 : itr-1;
 }
 
 const char* str_if_ends_with3(const char* const init,  const char d1,  const char d2,  const char d3){
 	const char* itr = init;
-	while(*itr != 0){
-		if ((itr[0] == d1) and (itr[1] == d2) and (itr[2] == d3)){
+	while((itr = strchr(itr, d1)) != nullptr){
+		if ((itr[1] == d2) and (itr[2] == d3)){
 			return itr-1;
 		}
 		++itr;
@@ -114,7 +65,7 @@ const char* str_if_ends_with3(const char* const init,  const char d1,  const cha
 
 
 const char* char2humanvis(const char c){
-	static char buf[2] = {0,0};
+	static thread_local char buf[2] = {0,0};
 	switch(c){
 		case '\n':
 			return "\\n";
@@ -0,0 +1,159 @@
+#include "watch.h"
+#include "batch.h"
+#include "md_to_html.h"
+#include "output.h"
+#include "compress.h"
+#include "replacements.h"
+
+#include <compsky/macros/likely.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+
+extern bool IS_VERBOSE;
+
+
+struct WatchedDocument {
+	const BatchJob* job;
+	const char* basename; // Within job->input_path
+	int wd; // Of the directory containing it, as editors tend to save by replacing the file
+	std::vector<unsigned> filename_indxs; // The -R files it used when last converted
+	bool is_stale;
+};
+
+
+static
+int watch_parent_dir(const int inotify_fd,  const char* const path,  const char*& basename){
+	const char* const slash = strrchr(path, '/');
+	basename = (slash == nullptr) ? path : slash+1;
+	const std::string dirpath = (slash == nullptr) ? std::string(".") : (slash == path) ? std::string("/") : std::string(path, slash-path);
+	return inotify_add_watch(inotify_fd, dirpath.c_str(), IN_CLOSE_WRITE|IN_MOVED_TO);
+}
+
+static
+bool convert_watched_document(const ConversionOptions& options,  const ReplacementTable& replacements,  WatchedDocument& doc,  HtmlOutput& html_output,  std::vector<unsigned>& n_uses_before){
+	// Documents are converted one at a time, so the -R files whose use counts change are exactly those this document uses
+	n_uses_before.resize(replacements.filenames.size());
+	for (unsigned i = 0;  i < replacements.filenames.size();  ++i)
+		n_uses_before[i] = replacements.filenames[i].n_uses.load(std::memory_order_relaxed);
+	const auto started_at = std::chrono::steady_clock::now();
+	const bool is_ok = convert_batch_job(options, *doc.job, html_output);
+	doc.filename_indxs.clear();
+	for (unsigned i = 0;  i < replacements.filenames.size();  ++i)
+		if (replacements.filenames[i].n_uses.load(std::memory_order_relaxed) != n_uses_before[i])
+			doc.filename_indxs.push_back(i);
+	doc.is_stale = false;
+	if (IS_VERBOSE)
+		fprintf(stderr, "Converted %s in %ldus\n", doc.job->input_path, (long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started_at).count());
+	return is_ok;
+}
+
+static
+int find_filename_indx(const ReplacementTable& replacements,  const char* const dirpath,  const char* const name){
+	const std::size_t dirpath_len = strlen(dirpath);
+	const std::size_t name_len = strlen(name);
+	for (unsigned i = 0;  i < replacements.filenames.size();  ++i){
+		// Paths are built as by read_replacement_dir
+		const char* const filepath = replacements.filenames[i].filepath;
+		if (memcmp(filepath, dirpath, dirpath_len) != 0)
+			continue;
+		const char* const filename = filepath + dirpath_len + ((dirpath[dirpath_len-1] == '/') ? 0 : 1);
+		if ((memcmp(filename, name, name_len) == 0) and (filename[name_len] == 0))
+			return i;
+	}
+	return -1;
+}
+
+
+bool watch_documents(const ConversionOptions& options,  const CompressionOptions& compression_options,  ReplacementTable& replacements,  std::vector<BatchJob>& jobs,  const std::vector<const char*>& replacement_dirpaths){
+	// Converts the documents, then reconverts each whenever it or an -R file it used changes. Only returns if it cannot start watching.
+	const int inotify_fd = inotify_init1(IN_CLOEXEC);
+	if (unlikely(inotify_fd == -1)){
+		fprintf(stderr, "ERROR: Cannot watch for changes: %s\n", strerror(errno));
+		return false;
+	}
+	std::vector<WatchedDocument> docs(jobs.size());
+	for (std::size_t i = 0;  i < jobs.size();  ++i){
+		WatchedDocument& doc = docs[i];
+		doc.job = &jobs[i];
+		doc.wd = watch_parent_dir(inotify_fd, jobs[i].input_path, doc.basename);
+		doc.is_stale = true;
+		if (unlikely(doc.wd == -1))
+			fprintf(stderr, "WARNING: Cannot watch %s: %s\n", jobs[i].input_path, strerror(errno));
+	}
+	std::vector<int> replacement_dir_wds;
+	for (const char* const dirpath : replacement_dirpaths){
+		replacement_dir_wds.push_back(inotify_add_watch(inotify_fd, dirpath, IN_CLOSE_WRITE|IN_MOVED_TO|IN_DELETE|IN_MOVED_FROM));
+		if (unlikely(replacement_dir_wds.back() == -1))
+			fprintf(stderr, "WARNING: Cannot watch %s: %s\n", dirpath, strerror(errno));
+	}
+	HtmlOutput html_output(-1);
+	std::unique_ptr<CompressionPipeline> compression;
+	if (compression_options.any()){
+		compression.reset(new CompressionPipeline(compression_options));
+		html_output.compression = compression.get();
+	}
+	if (unlikely(html_output.is_null() or ((compression != nullptr) and compression->is_null()))){
+		close(inotify_fd);
+		return false;
+	}
+	std::vector<unsigned> n_uses_before;
+	alignas(struct inotify_event) char events_buf[4096*4];
+	while(true){
+		for (WatchedDocument& doc : docs)
+			if (doc.is_stale)
+				convert_watched_document(options, replacements, doc, html_output, n_uses_before);
+
+		// Block until something changes, then gather the rest of the events of the same change
+		bool is_rescan_needed = false;
+		int timeout_ms = -1;
+		struct pollfd pfd = {inotify_fd, POLLIN, 0};
+		while(poll(&pfd, 1, timeout_ms) > 0){
+			const ssize_t n_read = read(inotify_fd, events_buf, sizeof(events_buf));
+			if (unlikely(n_read <= 0))
+				break;
+			for (const char* itr = events_buf;  itr < events_buf + n_read;  ){
+				const struct inotify_event* const event = reinterpret_cast<const struct inotify_event*>(itr);
+				itr += sizeof(struct inotify_event) + event->len;
+				if (event->len == 0)
+					continue;
+				for (WatchedDocument& doc : docs)
+					if ((doc.wd == event->wd) and (strcmp(doc.basename, event->name) == 0))
+						doc.is_stale = true;
+				for (std::size_t i = 0;  i < replacement_dir_wds.size();  ++i){
+					if ((replacement_dir_wds[i] != event->wd) or not startswithreplace(event->name))
+						continue;
+					const int filename_indx = (event->mask & (IN_DELETE|IN_MOVED_FROM)) ? -1 : find_filename_indx(replacements, replacement_dirpaths[i], event->name);
+					if (filename_indx == -1){
+						// A file was added or removed, which can change what any document's R_E_P_L_A_C_E_ strings match
+						is_rescan_needed = true;
+						continue;
+					}
+					replacements.filenames[filename_indx].forget_contents();
+					for (WatchedDocument& doc : docs)
+						if (std::find(doc.filename_indxs.begin(), doc.filename_indxs.end(), static_cast<unsigned>(filename_indx)) != doc.filename_indxs.end())
+							doc.is_stale = true;
+				}
+			}
+			timeout_ms = WATCH_COALESCE_MS;
+		}
+		if (is_rescan_needed){
+			for (const Filename& filename : replacements.filenames)
+				filename.deconstruct(IS_VERBOSE);
+			replacements.filenames.clear();
+			for (const char* const dirpath : replacement_dirpaths)
+				read_replacement_dir(dirpath, replacements.filenames);
+			replacements.trie.build(replacements.filenames);
+			for (WatchedDocument& doc : docs)
+				doc.is_stale = true;
+		}
+	}
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+
+
+constexpr int WATCH_COALESCE_MS = 2; // An editor's save is several events in quick succession: those within this long of each other cause a single reconversion
+
+struct BatchJob;
+struct ConversionOptions;
+struct ReplacementTable;
+struct CompressionOptions;
+
+bool watch_documents(const ConversionOptions& options,  const CompressionOptions& compression_options,  ReplacementTable& replacements,  std::vector<BatchJob>& jobs,  const std::vector<const char*>& replacement_dirpaths); // options.replacements is replacements, which is reread when the -R directories change